@@ -5,30 +5,292 @@
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <string>
 #include <map>
 #include <deque>
 #include <set>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <stdint.h>
+#include <algorithm>
+#include <complex>
+#include <type_traits>
+#include "smraytrc.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include <boost/geometry.hpp>
 #include <boost/geometry/geometries/point_xy.hpp>
 
 namespace bg = boost::geometry;
 
+namespace { // The internals - so that the library exports just smraytrc.h's API (closed before it, and reopened after main())
+
 const double My_PI = 3.141592653589793; /* Yes - I know this is defined in various header files (maybe cmath, math.h, or boost/math/constants.h), but
                                     * getting it actually included was dependent on setting other various #defines - and it became
                                     * difficult to get it all to build reliably on various platforms. So I gave up and defined it here.
                                     * (Now, let's debate how many digits I should have defined this to.)
                                     */
 
-int dvo_debug = 0;
+// The run-time options below are thread_local - so each thread (e.g. each smraytrc::Context, see smraytrc.h) has its own.
+// ParallelFor() hands the calling thread's values on to its worker threads (but for dvo_threads - see ParallelFor()).
+thread_local int dvo_debug = 0;
+thread_local int dvo_threads = 0; // -threads: # of worker threads for the parallel kernels. 0=one per hardware thread.
 const double BadValue = 9.999e9;
 const double SmallValue = 0.000001; // for use in tolerances, etc.
 
+struct QualityTier
+    // -quality: the solvers' tolerances and limits - traded together for speed. "default" is the original set.
+{
+    const char* m_name;
+    double m_tolerance;         // degrees - the reverse-trace searches stop within this of their target
+    int m_search_steps;         // Recursive_ConcaveRaySearch() - the sub-divisions of the arc at each level
+    int m_search_iterations;    // SearchForSkyAng_Convex() - the most bisections
+    unsigned m_loop_limit;      // the most reflections followed along a concave mirror (then NStrikeOut)
+    bool m_fast_trig;           // the sun-sample kernels use FastSinCos() (and the trig-free ConcaveRayKernel_Angular())
+};
+const QualityTier quality_tiers[] = {
+    { "fast",    1e-4,       17,  40,  8, true  },
+    { "default", SmallValue, 51, 100, 20, false },
+    { "exact",   1e-9,      101, 200, 50, false },
+};
+thread_local const QualityTier* dvo_quality = &quality_tiers[1];
+
 
 template <typename T> inline const T& Max(const T&arg1, const T&arg2) { return (arg1>arg2) ? arg1 : arg2; };
 template <typename T> inline const T& Min(const T&arg1, const T&arg2) { return (arg1<arg2) ? arg1 : arg2; };
 
+
+unsigned NumThreads(size_t work_items)
+    // How many threads to use for work_items independent pieces of work (see -threads).
+{
+    unsigned num_threads = (dvo_threads > 0) ? dvo_threads : std::thread::hardware_concurrency();
+    if (num_threads == 0) num_threads = 1; // hardware_concurrency() may not know
+    if (num_threads > work_items) num_threads = work_items;
+    return (num_threads == 0) ? 1 : num_threads;
+}
+
+template <typename Func> void ParallelFor(size_t count, Func func)
+    // Splits [0,count) into one contiguous chunk per thread and calls func(begin, end, thread_index) for each chunk.
+    // With a single thread, func is called directly (no thread is created). The workers are single-threaded - so a
+    // nested ParallelFor() (e.g. a case's kernels, with each worker of a sweep running whole cases) runs inline.
+{
+    unsigned num_threads = NumThreads(count);
+    if (num_threads <= 1) {
+        if (count) func(size_t(0), count, 0u);
+        return;
+    }
+    const int debug = dvo_debug; // the workers inherit the caller's (thread_local) options
+    const QualityTier* quality = dvo_quality;
+    std::vector<std::thread> threads;
+    for (unsigned tt=0; tt<num_threads; tt++) {
+        size_t begin = count * tt / num_threads;
+        size_t end   = count * (tt+1) / num_threads;
+        threads.push_back( std::thread( [=]() {
+            dvo_debug = debug;
+            dvo_threads = 1; // (not N workers each starting N more)
+            dvo_quality = quality;
+            func(begin, end, tt);
+        } ) );
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+}
+
+inline uint64_t SplitMix64(uint64_t x)
+    // A 64-bit mixing function (the finalizer of Steele/Lea/Flood's SplitMix64).
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+inline double CounterRandom(uint64_t seed, uint64_t index, unsigned dimension)
+    /* Counter-based random number in [0,1). There's no generator state - the value is purely a function of
+     * the (seed, index, dimension) triple. So sample #index gets the same random numbers regardless of which
+     * thread traces it (or how many threads there are).
+     */
+{
+    uint64_t bits = SplitMix64( seed ^ SplitMix64( index ^ SplitMix64( dimension ) ) );
+    return (bits >> 11) * (1.0 / 9007199254740992.0); // 53 bits
+}
+
+double SobolPoint(uint64_t index, unsigned dimension)
+    /* Coordinate 'dimension' (0 to 9) of point #index (from 0) of the Sobol low-discrepancy sequence - in [0,1), or BadValue
+     * for a dimension beyond 9. Direction numbers are from Joe & Kuo (2008); the points are in Gray-code order (Antonov-Saleev).
+     * Like CounterRandom(), it's purely a function of its arguments.
+     */
+{
+    static const unsigned num_dimensions = 10;
+    struct DirectionNumbers {
+        uint32_t v[num_dimensions][32];
+        DirectionNumbers() {
+            static const struct { unsigned s, a, m[5]; } primitive_polynomials[num_dimensions-1] = { // (the 1st dimension's is trivial)
+                {1,0,{1}}, {2,1,{1,3}}, {3,1,{1,3,1}}, {3,2,{1,1,1}}, {4,1,{1,1,3,3}},
+                {4,4,{1,3,5,13}}, {5,2,{1,1,5,5,17}}, {5,4,{1,1,5,5,5}}, {5,7,{1,1,7,11,19}}
+            };
+            for (unsigned kk=0; kk<32; kk++) v[0][kk] = 1u << (31-kk);
+            for (unsigned dd=1; dd<num_dimensions; dd++) {
+                unsigned s = primitive_polynomials[dd-1].s, a = primitive_polynomials[dd-1].a;
+                for (unsigned kk=0; kk<32; kk++) {
+                    if (kk < s) { v[dd][kk] = primitive_polynomials[dd-1].m[kk] << (31-kk); continue; }
+                    v[dd][kk] = v[dd][kk-s] ^ (v[dd][kk-s] >> s);
+                    for (unsigned jj=1; jj<s; jj++)
+                        if ((a >> (s-1-jj)) & 1) v[dd][kk] ^= v[dd][kk-jj];
+                }
+            }
+        }
+    };
+    static const DirectionNumbers directions;
+    if (dimension >= num_dimensions) return BadValue;
+
+    uint64_t gray = index ^ (index >> 1);
+    uint32_t bits = 0;
+    for (unsigned kk=0; gray && (kk<32); kk++, gray >>= 1)
+        if (gray & 1) bits ^= directions.v[dimension][kk];
+    return bits * (1.0 / 4294967296.0);
+}
+
+std::vector<std::string> SplitNames(const std::string& names)
+    // Splits a comma-separated list of names
+{
+    std::vector<std::string> result;
+    for (size_t start=0, comma; start <= names.size(); start = comma+1) {
+        comma = names.find(',', start);
+        if (comma == std::string::npos) comma = names.size();
+        if (comma > start) result.push_back( names.substr(start, comma-start) );
+    }
+    return result;
+}
+
+class MappedFile
+    // A file's contents, read-only - memory-mapped (so large inputs aren't copied), or read into memory where there's no mmap().
+{
+    public:
+        MappedFile() : m_data(NULL), m_size(0), m_mapped(false), m_buffer() {}
+        ~MappedFile() { Close(); }
+
+        bool Open(const char* filename); // returns success (after an error message)
+        void Close();
+        const char* Data() const { return m_data; }
+        size_t Size() const { return m_size; }
+
+    private:
+        MappedFile(const MappedFile&);            // not copyable
+        MappedFile& operator=(const MappedFile&);
+
+        const char* m_data;
+        size_t m_size;
+        bool m_mapped; // else m_data is m_buffer's
+        std::vector<char> m_buffer;
+};
+
+bool MappedFile::Open(const char* filename)
+{
+    Close();
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    struct stat status;
+    if ((fd >= 0) && (fstat(fd, &status) == 0) && S_ISREG(status.st_mode)) {
+        m_size = status.st_size;
+        void* data = (m_size > 0) ? mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (data != MAP_FAILED) {
+            madvise(data, m_size, MADV_SEQUENTIAL);
+            close(fd);
+            m_data = static_cast<const char*>(data);
+            m_mapped = true;
+            return true;
+        }
+        m_size = 0;
+    }
+    if (fd >= 0) close(fd); // an empty file, or not a regular one (a pipe, say) - read it instead
+#endif
+    FILE* fin = fopen(filename, "rb");
+    if (fin == NULL) {
+        fprintf(stderr, "ERROR: Can't open %s for reading.\n", filename);
+        return false;
+    }
+    char buffer[65536];
+    for (size_t count; (count = fread(buffer, 1, sizeof(buffer), fin)) > 0; ) m_buffer.insert(m_buffer.end(), buffer, buffer + count);
+    fclose(fin);
+    m_data = m_buffer.empty() ? "" : &m_buffer[0];
+    m_size = m_buffer.size();
+    return true;
+}
+
+void MappedFile::Close()
+{
+#ifndef _WIN32
+    if (m_mapped) munmap(const_cast<char*>(m_data), m_size);
+#endif
+    m_data = NULL;
+    m_size = 0;
+    m_mapped = false;
+    m_buffer.clear();
+}
+
+bool ParseNumbers(const char* data, size_t size, bool binary, const char* source, unsigned per_record, std::vector<double>& values)
+    /* Appends the records of data (size bytes - not necessarily terminated) to values - per_record numbers each. binary: packed
+     * doubles (native byte order - e.g. numpy's tofile()). Else text - a record per line, its numbers separated by spaces, tabs
+     * or commas. Blank lines, and lines starting with #, are skipped. Returns success (after an error message naming source).
+     */
+{
+    if (binary) {
+        const size_t record_size = per_record * sizeof(double);
+        if (size % record_size) {
+            fprintf(stderr, "ERROR: %s is %zu bytes - expecting records of %u doubles (%zu bytes).\n", source, size, per_record, record_size);
+            return false;
+        }
+        size_t first = values.size();
+        values.resize( first + size / sizeof(double) );
+        if (size) memcpy(&values[first], data, size); // (data needn't be aligned)
+        return true;
+    }
+    char line[1024];
+    size_t line_number = 0;
+    for (const char *start = data, *end = data + size; start < end; ) {
+        const char* eol = static_cast<const char*>( memchr(start, '\n', end - start) );
+        if (eol == NULL) eol = end;
+        line_number++;
+        size_t length = Min( size_t(eol - start), sizeof(line)-1 ); // (a longer line can't be a record anyway)
+        memcpy(line, start, length);
+        line[length] = 0;
+        start = eol + 1;
+
+        char* field = line + strspn(line, " \t\r");
+        if ((*field == 0) || (*field == '#')) continue;
+        unsigned count = 0;
+        for (char* after; *field; field = after + strspn(after, " ,\t\r"), count++) {
+            double value = strtod(field, &after);
+            if (after == field) break;
+            if (count < per_record) values.push_back(value);
+        }
+        if ((count != per_record) || *field) {
+            values.resize( values.size() - Min(count, per_record) ); // (not this line's)
+            fprintf(stderr, "ERROR: Expecting %u numbers at line %d of %s: %s\n", per_record, int(line_number), source, line);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LoadNumbers(const char* filename, unsigned per_record, std::vector<double>& values)
+    // ParseNumbers() of a file - packed binary if its name ends with .bin
+{
+    MappedFile file;
+    size_t length = strlen(filename);
+    bool binary = (length > 4) && (strcmp(filename + length - 4, ".bin") == 0);
+    return file.Open(filename) && ParseNumbers(file.Data(), file.Size(), binary, filename, per_record, values);
+}
+
 const char* Indent(unsigned level, unsigned spaces_per_level=4)
 {
     static const char lots_of_spaces[] = "                                                                                                 " // no comma
@@ -72,6 +334,40 @@ const char* Indent(unsigned level, unsigned spaces_per_level=4)
  *
  */
 
+struct Dual
+    /* A dual number - a value and its derivative (with respect to the one -gradient parameter) - for forward-mode
+     * automatic differentiation. The geometry core is templated so that it runs on double or Dual. Comparisons use
+     * just the value - so Dual takes the same branches as double (the derivative is that of the branch taken).
+     */
+{
+    double v, d;
+    Dual(double value=0, double derivative=0) : v(value), d(derivative) {};
+
+    Dual& operator+=(const Dual& other) { v += other.v; d += other.d; return *this; }
+    Dual& operator-=(const Dual& other) { v -= other.v; d -= other.d; return *this; }
+};
+inline Dual operator-(const Dual& a) { return Dual(-a.v, -a.d); }
+inline Dual operator+(const Dual& a, const Dual& b) { return Dual(a.v + b.v, a.d + b.d); }
+inline Dual operator-(const Dual& a, const Dual& b) { return Dual(a.v - b.v, a.d - b.d); }
+inline Dual operator*(const Dual& a, const Dual& b) { return Dual(a.v * b.v, a.d * b.v + a.v * b.d); }
+inline Dual operator/(const Dual& a, const Dual& b) { return Dual(a.v / b.v, (a.d * b.v - a.v * b.d) / (b.v * b.v)); }
+inline bool operator< (const Dual& a, const Dual& b) { return a.v <  b.v; }
+inline bool operator> (const Dual& a, const Dual& b) { return a.v >  b.v; }
+inline bool operator<=(const Dual& a, const Dual& b) { return a.v <= b.v; }
+inline bool operator>=(const Dual& a, const Dual& b) { return a.v >= b.v; }
+inline bool operator==(const Dual& a, const Dual& b) { return a.v == b.v; }
+inline bool operator!=(const Dual& a, const Dual& b) { return a.v != b.v; }
+using ::sin; using ::cos; using ::tan; using ::sqrt; using ::fabs; using ::asin; using ::atan2; // (else the Dual overloads hide them)
+inline Dual sin(const Dual& a)  { return Dual(sin(a.v),  a.d * cos(a.v)); }
+inline Dual cos(const Dual& a)  { return Dual(cos(a.v), -a.d * sin(a.v)); }
+inline Dual tan(const Dual& a)  { double t = tan(a.v); return Dual(t, a.d * (1 + t*t)); }
+inline Dual sqrt(const Dual& a) { double s = sqrt(a.v); return Dual(s, (s > 0) ? a.d / (2*s) : 0); }
+inline Dual fabs(const Dual& a) { return (a.v < 0) ? -a : a; }
+inline Dual asin(const Dual& a) { return Dual(asin(a.v), a.d / sqrt(1 - a.v*a.v)); }
+inline Dual atan2(const Dual& y, const Dual& x) { return Dual(atan2(y.v, x.v), (x.v * y.d - y.v * x.d) / (x.v*x.v + y.v*y.v)); }
+inline double Value(double a) { return a; }
+inline double Value(const Dual& a) { return a.v; }
+
 double to_degrees(double radians) { return radians * (180.0 / My_PI); }
 double to_radians(double degrees) { return degrees / (180.0 / My_PI); }
 double NormalizeAngle(double degrees) /* Adjust to between 0 and 360 degrees -
@@ -89,6 +385,40 @@ double MinAngle(double degrees) /* Similar to NormalizeAngle() - but adjust to b
        while (degrees < 0) degrees += 180;
        return degrees;
 }
+Dual to_degrees(const Dual& radians) { return radians * (180.0 / My_PI); }
+Dual to_radians(const Dual& degrees) { return degrees / (180.0 / My_PI); }
+Dual NormalizeAngle(const Dual& degrees) { return Dual( NormalizeAngle(degrees.v), degrees.d ); } // (shifts by 360s don't change the derivative)
+Dual MinAngle(const Dual& degrees) { return Dual( MinAngle(degrees.v), degrees.d ); }
+// -precision float - so the kernels stay in float. Templates that accept only float - so that (e.g.) to_radians(30) still
+// means the double version, rather than being ambiguous.
+template <typename Real> using FloatOnly = typename std::enable_if<std::is_same<Real,float>::value, float>::type;
+template <typename Real> FloatOnly<Real> to_degrees(Real radians) { return radians * float(180.0 / My_PI); }
+template <typename Real> FloatOnly<Real> to_radians(Real degrees) { return degrees / float(180.0 / My_PI); }
+template <typename Real> FloatOnly<Real> NormalizeAngle(Real degrees)
+{
+       while(degrees >= 360) degrees -= 360;
+       while (degrees < 0) degrees += 360;
+       return degrees;
+}
+
+const double FastTrigError = 2e-9; // the largest error of FastSinCos()
+inline void FastSinCos(double degrees, double& sin_value, double& cos_value)
+    /* sin and cos (of degrees) by Taylor polynomials about the nearest multiple of 90 degrees (so |x| <= pi/4, where
+     * the next terms are below FastTrigError). No branches but the final quadrant swap - for -quality fast.
+     */
+{
+    double quadrant = floor( degrees / 90 + 0.5 );
+    double x = to_radians( degrees - 90 * quadrant );
+    double x2 = x * x;
+    double sin_x = x * (1 + x2 * (-1.0/6 + x2 * (1.0/120 + x2 * (-1.0/5040 + x2 * (1.0/362880)))));
+    double cos_x = 1 + x2 * (-1.0/2 + x2 * (1.0/24 + x2 * (-1.0/720 + x2 * (1.0/40320 + x2 * (-1.0/3628800)))));
+    switch (int(quadrant) & 3) {
+        case 0:  sin_value =  sin_x; cos_value =  cos_x; break;
+        case 1:  sin_value =  cos_x; cos_value = -sin_x; break;
+        case 2:  sin_value = -sin_x; cos_value = -cos_x; break;
+        default: sin_value = -cos_x; cos_value =  sin_x; break;
+    }
+}
 
 int RayStrikeConcave(double ray_dir, double normal_dir)
     // A ray reaches the surface of a circle - is the ray approaching from the inside (concave
@@ -138,16 +468,33 @@ bool NearlyEqual(double f1, double f2, double multiply_tolerance=NearlyEqual_def
 
 typedef bg::model::d2::point_xy<double>  Point;
 typedef bg::model::segment<Point> Segment;
+typedef bg::model::d2::point_xy<float>   FloatPoint; // for the -precision float kernels
+
+struct DualPoint
+    // The Dual counterpart of Point - for the templated geometry core (with the same x()/y() accessors)
+{
+    DualPoint(const Dual& X=Dual(), const Dual& Y=Dual()) : m_x(X), m_y(Y) {};
+    const Dual& x() const { return m_x; }
+    const Dual& y() const { return m_y; }
+    void x(const Dual& X) { m_x = X; }
+    void y(const Dual& Y) { m_y = Y; }
+    Dual m_x, m_y;
+};
 
-static std::deque<Segment> debug_segments;
+template<class PointType> struct ScalarOf { typedef double type; };    // a point's coordinate type
+template<> struct ScalarOf<DualPoint> { typedef Dual type; };
+template<> struct ScalarOf<FloatPoint> { typedef float type; };
+
+thread_local std::deque<Segment> debug_segments; // (-debug) drawn by GenSVG_Concave(). Per thread - so concurrent Contexts don't share it.
 
 void AddDebugSegment(const Segment&seg)
 {
     debug_segments.push_back( seg );
 }
+template<class PointType> PointType Find2ndPoint(const PointType& pt1, typename ScalarOf<PointType>::type direction,
+                                                  typename ScalarOf<PointType>::type distance);
 void AddDebugSegment(const Point& pt, double ray_dir, double length=30)
 {
-    Point Find2ndPoint(const Point&, double direction, double distance);
     Point pt_b = Find2ndPoint(pt, ray_dir, length );
     debug_segments.push_back( Segment(pt,pt_b) );
 }
@@ -168,10 +515,19 @@ bool Defined(const Point& pt)
 {
     return (pt.x() != BadValue) && (pt.y() != BadValue);
 }
+bool Defined(const DualPoint& pt)
+{
+    return (pt.x() != BadValue) && (pt.y() != BadValue);
+}
+bool operator==(const DualPoint& pt1, const DualPoint& pt2)
+{
+    return (pt1.x() == pt2.x()) && (pt1.y() == pt2.y());
+}
 
-bool NearlyEqual(const Point& p1, const Point& p2, double multiply_tolerance=SmallValue, double additive_tolerance=SmallValue)
+template<class PointType>
+bool NearlyEqual(const PointType& p1, const PointType& p2, double multiply_tolerance=SmallValue, double additive_tolerance=SmallValue)
 {
-    return NearlyEqual(p1.x(), p2.x(),multiply_tolerance, additive_tolerance) && NearlyEqual(p1.y(), p2.y(),multiply_tolerance, additive_tolerance);
+    return NearlyEqual(Value(p1.x()), Value(p2.x()),multiply_tolerance, additive_tolerance) && NearlyEqual(Value(p1.y()), Value(p2.y()),multiply_tolerance, additive_tolerance);
 }
 
 
@@ -185,16 +541,26 @@ double Distance(const Point& pt1, const Point& pt2)
     return new_distance;
 }
 
-double Direction(const Point& pt1, const Point& pt2) // the direction from pt1 to pt2 - in degrees.
+Dual Distance(const DualPoint& pt1, const DualPoint& pt2)
+{
+    Dual delta_X = pt2.x() - pt1.x();
+    Dual delta_Y = pt2.y() - pt1.y();
+    return sqrt( delta_X*delta_X + delta_Y*delta_Y );
+}
+
+template<class PointType>
+typename ScalarOf<PointType>::type Direction(const PointType& pt1, const PointType& pt2) // the direction from pt1 to pt2 - in degrees.
 {
     return NormalizeAngle(to_degrees( atan2( pt2.y()-pt1.y(), pt2.x()-pt1.x() )));
 }
 
-Point Find2ndPoint(const Point& pt1, double direction, double distance)
+template<class PointType>
+PointType Find2ndPoint(const PointType& pt1, typename ScalarOf<PointType>::type direction, typename ScalarOf<PointType>::type distance)
 {
-    double X = pt1.x() + distance * cos( to_radians( direction ) );
-    double Y = pt1.y() + distance * sin( to_radians( direction ) );
-    return Point(X,Y);
+    typedef typename ScalarOf<PointType>::type Scalar;
+    Scalar X = pt1.x() + distance * cos( to_radians( direction ) );
+    Scalar Y = pt1.y() + distance * sin( to_radians( direction ) );
+    return PointType(X,Y);
 }
 
 Point Closest(const Point& from_pt, double direction, const Point& pt1, const Point& pt2)
@@ -257,6 +623,24 @@ void TerminateRay(const Segment& Ray, const Segment& LineB, Point &closest_far_p
 }
 
 
+bool RaySegmentHit(double x, double y, double dx, double dy, const Segment& seg, double& distance, double& fraction)
+    /* Analytic intersection of a ray (from x,y in unit direction dx,dy) with a line segment - for the bulk ray
+     * kernels (TerminateRay() is the general, but much slower, equivalent).
+     * If the ray hits the segment: returns true, distance=along the ray to the hit, fraction=0..1 along seg (from seg.first).
+     */
+{
+    double sx = seg.second.x() - seg.first.x();
+    double sy = seg.second.y() - seg.first.y();
+    double denom = dx*sy - dy*sx;
+    if (denom == 0) return false; // parallel
+    double wx = seg.first.x() - x;
+    double wy = seg.first.y() - y;
+    distance = (wx*sy - wy*sx) / denom;
+    fraction = (wx*dy - wy*dx) / denom;
+    return (distance > 0) && (fraction >= 0) && (fraction <= 1);
+}
+
+
 int ProjectPointOntoCircle(const Point& from_pt, double direction, const Point& cir_center, double radius, Point& pt1, Point& pt2)
     /* Project a ray in direction onto the circle.
      * Returns 0, 1 or 2 - the number of times the ray intersects with the circle.
@@ -281,60 +665,126 @@ int ProjectPointOntoCircle(const Point& from_pt, double direction, const Point&
     pt1.x( shadow_X );
     pt1.y( shadow_Y );
 
-    debug_segments.push_back( Segment( from_pt, pt1 ) );
+    if (dvo_debug) debug_segments.push_back( Segment( from_pt, pt1 ) );
     return 1;
 }
 
-double ApparentWidth( const Point&p1, const Point&p2, double from_this_angle)
+template<class PointType>
+typename ScalarOf<PointType>::type ApparentWidth( const PointType&p1, const PointType&p2, typename ScalarOf<PointType>::type from_this_angle)
   // Given two points (via cartesian coordinates), and an observer at infinite
   // distance - how far apart do the points appear?
 {
-    double delta_X = p1.x() - p2.x();
-    double delta_Y = p1.y() - p2.y();
-    double hypotenuse_length = sqrt( delta_X*delta_X + delta_Y*delta_Y ); // length between the points
+    typedef typename ScalarOf<PointType>::type Scalar;
+    Scalar delta_X = p1.x() - p2.x();
+    Scalar delta_Y = p1.y() - p2.y();
+    Scalar hypotenuse_length = sqrt( delta_X*delta_X + delta_Y*delta_Y ); // length between the points
 //    double hypotenuse_angle_radians = (delta_X == 0) ? 0 : atan( delta_Y / delta_X );
-    double hypotenuse_angle_radians = atan2( delta_Y, delta_X );
-    double   observer_angle_radians = to_radians(from_this_angle);
-    double delta_radians = hypotenuse_angle_radians - observer_angle_radians;
-    double apparent_height = hypotenuse_length * sin( delta_radians );
+    Scalar hypotenuse_angle_radians = atan2( delta_Y, delta_X );
+    Scalar   observer_angle_radians = to_radians(from_this_angle);
+    Scalar delta_radians = hypotenuse_angle_radians - observer_angle_radians;
+    Scalar apparent_height = hypotenuse_length * sin( delta_radians );
     return fabs(apparent_height);
 }
 
-double ApparentWidth_ang( const Point&p1, const Point&p2, const Point&observer)
+template<class PointType>
+typename ScalarOf<PointType>::type ApparentWidth_ang( const PointType&p1, const PointType&p2, const PointType&observer)
     // Similar to ApparentWidth() - but reports in apparent angle (in degrees)
 {
-    double dir1 = Direction( observer, p1 );
-    double dir2 = Direction( observer, p2 );
+    typedef typename ScalarOf<PointType>::type Scalar;
+    Scalar dir1 = Direction( observer, p1 );
+    Scalar dir2 = Direction( observer, p2 );
     return MinAngle( fabs(dir1 - dir2) );
 }
 
 
-struct BBox
+void SolarDeclinationEoT(double julian_day, double& declination, double& eot_minutes)
+    /* The sun's declination (degrees) and the equation of time (minutes) - per NOAA's solar calculator
+     * (after Meeus, "Astronomical Algorithms"). julian_day is in UT.
+     */
+{
+    double jc = (julian_day - 2451545.0) / 36525.0; // Julian century
+    double mean_long = fmod( 280.46646 + jc * (36000.76983 + jc * 0.0003032), 360.0 );
+    double mean_anom = 357.52911 + jc * (35999.05029 - 0.0001537 * jc);
+    double eccent = 0.016708634 - jc * (0.000042037 + 0.0000001267 * jc);
+    double center = sin( to_radians(mean_anom) ) * (1.914602 - jc * (0.004817 + 0.000014 * jc))
+                  + sin( to_radians(2 * mean_anom) ) * (0.019993 - 0.000101 * jc)
+                  + sin( to_radians(3 * mean_anom) ) * 0.000289;
+    double omega = 125.04 - 1934.136 * jc;
+    double app_long = mean_long + center - 0.00569 - 0.00478 * sin( to_radians(omega) );
+    double mean_obliq = 23 + (26 + (21.448 - jc * (46.815 + jc * (0.00059 - jc * 0.001813))) / 60) / 60;
+    double obliq = mean_obliq + 0.00256 * cos( to_radians(omega) );
+    declination = to_degrees( asin( sin( to_radians(obliq) ) * sin( to_radians(app_long) ) ) );
+
+    double yy = tan( to_radians(obliq / 2) );
+    yy *= yy;
+    double L0 = to_radians(mean_long), M = to_radians(mean_anom);
+    eot_minutes = 4 * to_degrees( yy * sin(2*L0) - 2 * eccent * sin(M) + 4 * eccent * yy * sin(M) * cos(2*L0)
+                                  - 0.5 * yy * yy * sin(4*L0) - 1.25 * eccent * eccent * sin(2*M) );
+}
+
+void SunElevationAzimuth(double latitude, double declination, double hour_angle, double& elevation, double& azimuth)
+    // All in degrees. hour_angle is 0 at solar noon (negative in the morning). azimuth is clockwise from north.
+{
+    double lat = to_radians(latitude), dec = to_radians(declination), ha = to_radians(hour_angle);
+    double sin_elev = sin(lat) * sin(dec) + cos(lat) * cos(dec) * cos(ha);
+    elevation = to_degrees( asin( Max( -1.0, Min( 1.0, sin_elev ) ) ) );
+    azimuth = NormalizeAngle( to_degrees( atan2( -cos(dec) * sin(ha), sin(dec) * cos(lat) - cos(dec) * cos(ha) * sin(lat) ) ) );
+}
+
+double SunDirInPlane(double elevation, double azimuth, double plane_azimuth)
+    /* The direction (as -sa) of the sun's rays - projected onto the vertical plane of the model, whose +X axis
+     * points towards plane_azimuth (degrees clockwise from north). All in degrees.
+     */
+{
+    double horizontal = cos( to_radians(elevation) ) * cos( to_radians(azimuth - plane_azimuth) ); // towards +X
+    double vertical   = sin( to_radians(elevation) );
+    return NormalizeAngle( to_degrees( atan2( -vertical, -horizontal ) ) ); // the rays travel away from the sun
+}
+
+bool ParseDateTime(const char* text, time_t& result)
+    // "YYYY-MM-DD" or "YYYY-MM-DDTHH:MM" (or with a space instead of the T) - in UT. Returns success.
+{
+    struct tm tm_value;
+    memset(&tm_value, 0, sizeof(tm_value));
+    int fields = sscanf(text, "%d-%d-%d%*[T ]%d:%d", &tm_value.tm_year, &tm_value.tm_mon, &tm_value.tm_mday, &tm_value.tm_hour, &tm_value.tm_min);
+    if ((fields != 3) && (fields != 5)) return false;
+    tm_value.tm_year -= 1900;
+    tm_value.tm_mon -= 1;
+    result = timegm(&tm_value);
+    return result != (time_t)-1;
+}
+
+
+template<class PointType>
+struct BasicBBox
 {
-    BBox() : min_pt(BadValue,BadValue), max_pt(BadValue,BadValue) {};
+    typedef typename ScalarOf<PointType>::type Scalar;
+
+    BasicBBox() : min_pt(BadValue,BadValue), max_pt(BadValue,BadValue) {};
 
-    void Update(const Point& new_pt) {
+    void Update(const PointType& new_pt) {
                if ((new_pt.x() > max_pt.x()) || (max_pt.x() == BadValue)) max_pt.x( new_pt.x() );
                if ((new_pt.y() > max_pt.y()) || (max_pt.y() == BadValue)) max_pt.y( new_pt.y() );
                if ((new_pt.x() < min_pt.x()) || (min_pt.x() == BadValue)) min_pt.x( new_pt.x() );
                if ((new_pt.y() < min_pt.y()) || (min_pt.y() == BadValue)) min_pt.y( new_pt.y() );
     }
 
-    double MaxX() const { return max_pt.x(); }
-    double MaxY() const { return max_pt.y(); }
-    double MinX() const { return min_pt.x(); }
-    double MinY() const { return min_pt.y(); }
+    Scalar MaxX() const { return max_pt.x(); }
+    Scalar MaxY() const { return max_pt.y(); }
+    Scalar MinX() const { return min_pt.x(); }
+    Scalar MinY() const { return min_pt.y(); }
 
-    double MidX() const { return (max_pt.x() == BadValue) ? BadValue : (max_pt.x() + min_pt.x()) / 2; }
-    double MidY() const { return (max_pt.y() == BadValue) ? BadValue : (max_pt.y() + min_pt.y()) / 2; }
+    Scalar MidX() const { return (max_pt.x() == BadValue) ? Scalar(BadValue) : (max_pt.x() + min_pt.x()) / 2; }
+    Scalar MidY() const { return (max_pt.y() == BadValue) ? Scalar(BadValue) : (max_pt.y() + min_pt.y()) / 2; }
 
-    double Diagonal() const { return Defined() ? Distance( min_pt, max_pt ) : BadValue; }
+    Scalar Diagonal() const { return Defined() ? Distance( min_pt, max_pt ) : Scalar(BadValue); }
 
     bool Defined() const { return ::Defined(min_pt) && ::Defined(max_pt); }
 
-    Point min_pt;
-    Point max_pt;
+    PointType min_pt;
+    PointType max_pt;
 };
+typedef BasicBBox<Point> BBox;
 
 struct TracedRay
     // For forward-tracing one ray and its interactions with a Concave mirror surface.
@@ -346,6 +796,7 @@ struct TracedRay
                     Convex,     // The incident ray reaches the Target on the Concave Mirror from the wrong side (outside - convex) of the  mirror.
                     Concave,    // The incident ray reaches the Target on the Concave Mirror from the expected side (inside - concave), but not further traced.
                     Obscured,   // Although Concave is true (above), the incident ray would have 1st crossed the mirror's arc (so would not reach the target).
+                    Blocked,    // (MirrorScene only) The ray is reflected, but then strikes the back of a mirror, or a stencil.
                     NStrike,    // The ray strikes the concave side of the mirror, and its reflection also strikes the mirror (perhaps more than once),
                                 // but eventually a reflected ray progresses beyond the mirror.
                     NStrikeOut, // Similar to NStrike - ray tracing stops before a ray escapes the mirror.
@@ -373,6 +824,7 @@ static const char* Name(TracedRay::RayStatus rs)
         case TracedRay::Convex:        return "Convex";
         case TracedRay::Concave:    return "Concave";
         case TracedRay::Obscured:    return "Obscured";
+        case TracedRay::Blocked:    return "Blocked";
         case TracedRay::NStrike:    return "NStrike";
         case TracedRay::NStrikeOut:    return "NStrikeOut";
         case TracedRay::Unobscured:    return "Unobscured";
@@ -388,6 +840,7 @@ void TracedRay::RayReport(FILE *fout, unsigned level) const
         case TracedRay::Convex:      break;
         case TracedRay::Concave:     fprintf(fout, ", (not traced further)");    break;
         case TracedRay::Obscured:    fprintf(fout, ", 1st Strike=(%g,%g)", m_StrikePts.begin()->x(), m_StrikePts.begin()->y() ); break;
+        case TracedRay::Blocked:     break;
         case TracedRay::NStrike:     // fall thru
         case TracedRay::NStrikeOut:  // fall thru
         case TracedRay::Unobscured:  {
@@ -411,11 +864,236 @@ unsigned TracedRay::CountObscuredRays() const
 }
 
 
-bool Intersection(const Point& pt1, double arg_dir1, const Point& pt2, double arg_dir2, Point &intersection_pt) // returns success
+template <typename Real>
+struct BasicRayBatch
+    // Structure-of-arrays storage for large numbers of independent forward-traced rays (such as the sun-disk samples
+    // from -sun-samples). Unlike TracedRay, only the last reflection point is kept - enough for screen and far-field metrics.
+    // The geometry is stored as Real - float for -precision float (46 rather than 70 bytes per ray); the weights are always double.
+{
+    std::vector<Real> m_normal_dir;     // the incident ray targets the mirror here (direction from the mirror's COC)
+    std::vector<unsigned> m_mirror;     // ... on this mirror (index into MirrorScene::m_arcs - or 0 for TheData's single mirror)
+    std::vector<Real> m_position;       // ... at this distance along the mirror(s) - from the start of the 1st
+    std::vector<Real> m_sun_dir;        // direction of the incident ray
+    std::vector<double> m_weight;       // the ray's share of the incident flux (in units of direct-sun irradiance * length)
+    std::vector<double> m_out_weight;   // m_weight after the reflection losses (m_weight * reflectivity^m_strikes). 0 if not reflected.
+    std::vector<unsigned char> m_ray_status; // a TracedRay::RayStatus
+    std::vector<unsigned char> m_strikes;    // # of reflections off the mirror (valid if m_ray_status >= NStrike)
+    std::vector<Real> m_reflect_dir;    // Valid only if m_ray_status >= NStrike
+    std::vector<Real> m_exit_x;         // The last reflection point - from which the ray leaves the mirror
+    std::vector<Real> m_exit_y;
+
+    size_t Size() const { return m_normal_dir.size(); }
+    void Resize(size_t size) {
+        m_normal_dir.resize(size);  m_sun_dir.resize(size);      m_weight.resize(size);      m_out_weight.resize(size);
+        m_mirror.resize(size);      m_position.resize(size);
+        m_ray_status.resize(size);  m_strikes.resize(size);      m_reflect_dir.resize(size);
+        m_exit_x.resize(size);      m_exit_y.resize(size);
+    }
+    bool Reflected(size_t index) const { return m_ray_status[index] >= TracedRay::NStrike; }
+};
+typedef BasicRayBatch<double> RayBatch;
+typedef BasicRayBatch<float>  FloatRayBatch;
+
+
+double HistogramQuantile(const std::vector<double>& bins, double first_bin_start, double bin_width, double fraction)
+    /* The position (in the same units as first_bin_start/bin_width) below which fraction (0..1) of the histogram's
+     * total lies - interpolated linearly within the bin where the cumulative total crosses fraction.
+     */
+{
+    double total = 0;
+    for (auto it = bins.begin(); it != bins.end(); ++it) total += *it;
+    if (total <= 0) return BadValue;
+    double target = fraction * total;
+    double cumulative = 0;
+    for (size_t bb=0; bb<bins.size(); bb++) {
+        if ((bins[bb] > 0) && (cumulative + bins[bb] >= target))
+            return first_bin_start + bin_width * (bb + (target - cumulative) / bins[bb]);
+        cumulative += bins[bb];
+    }
+    return first_bin_start + bin_width * bins.size();
+}
+
+
+void FFT(std::vector< std::complex<double> >& data, bool inverse)
+    /* In-place radix-2 (iterative Cooley-Tukey) fast Fourier transform. data.size() must be a power of 2.
+     * The inverse transform includes the 1/N scaling.
+     */
+{
+    const size_t size = data.size();
+    for (size_t ii=1, jj=0; ii<size; ii++) { // bit-reversal permutation
+        size_t bit = size >> 1;
+        for ( ; jj & bit; bit >>= 1) jj ^= bit;
+        jj ^= bit;
+        if (ii < jj) std::swap( data[ii], data[jj] );
+    }
+    for (size_t len=2; len<=size; len <<= 1) {
+        double angle = 2 * My_PI / len * (inverse ? 1 : -1);
+        std::complex<double> w_len( cos(angle), sin(angle) );
+        for (size_t start=0; start<size; start += len) {
+            std::complex<double> w(1);
+            for (size_t kk=0; kk<len/2; kk++) {
+                std::complex<double> even = data[start+kk];
+                std::complex<double> odd  = data[start+kk+len/2] * w;
+                data[start+kk]       = even + odd;
+                data[start+kk+len/2] = even - odd;
+                w *= w_len;
+            }
+        }
+    }
+    if (inverse)
+        for (size_t ii=0; ii<size; ii++) data[ii] /= double(size);
+}
+
+std::vector<double> Convolve(const std::vector<double>& signal, const std::vector<double>& kernel)
+    /* Convolution (via FFT) of signal with a kernel of odd size - centered on its middle element.
+     * The result is the same size as signal (i.e. whatever spreads beyond either end of signal is lost).
+     */
+{
+    if (signal.empty() || kernel.empty()) return signal;
+    const size_t half = kernel.size() / 2;
+    size_t size = 1;
+    while (size < signal.size() + kernel.size() - 1) size <<= 1;
+    std::vector< std::complex<double> > ft_signal(size), ft_kernel(size);
+    for (size_t ii=0; ii<signal.size(); ii++) ft_signal[ii] = signal[ii];
+    for (size_t ii=0; ii<kernel.size(); ii++) ft_kernel[ii] = kernel[ii];
+    FFT( ft_signal, false );
+    FFT( ft_kernel, false );
+    for (size_t ii=0; ii<size; ii++) ft_signal[ii] *= ft_kernel[ii];
+    FFT( ft_signal, true );
+    std::vector<double> result( signal.size() );
+    for (size_t ii=0; ii<signal.size(); ii++) result[ii] = ft_signal[ii+half].real();
+    return result;
+}
+
+
+struct SunShape
+    /* The angular distribution of the sun's light across its width (within this 2D model - i.e. a slice through the
+     * sun's disk in the plane of the mirror). Sampled with an inverse cumulative distribution table.
+     *   Uniform: each direction across the sun's width is equally bright (the classic top/bot ray model).
+     *   Disk: a uniformly bright disk - integrated perpendicular to the plane - so proportional to sqrt(1-x^2).
+     *   LimbDarkened: as Disk, but with linear limb darkening: I(mu) = 1 - u*(1-mu)
+     * where x is the offset from the sun's center relative to its radius.
+     */
+{
+    enum Type { Uniform, Disk, LimbDarkened };
+
+    SunShape() : m_type(LimbDarkened), m_limb_u(0.6), m_cdf() {};
+
+    double Profile(double x) const; // relative brightness at x (-1..1)
+    void Build(); // calculates m_cdf
+    double Sample(double uniform_0_1, double width_ang) const; // returns an offset (degrees) from the sun's center
+    double Cumulative(double offset, double width_ang) const;  // the inverse of Sample() - fraction of the light below offset (degrees)
+
+    Type m_type;
+    double m_limb_u; // limb-darkening coefficient (LimbDarkened only)
+    std::vector<double> m_cdf; // m_cdf[ii] = fraction of the sun's light at offsets below x=-1+2*ii/(size-1)
+};
+
+double SunShape::Profile(double x) const
+{
+    if (fabs(x) > 1) return 0;
+    double half_chord = sqrt(1 - x*x);
+    switch (m_type) {
+        case Uniform:   return 1;
+        case Disk:      return half_chord;
+        case LimbDarkened: { // integrate I(mu) along the chord perpendicular to the plane (midpoint rule)
+                            const int num_steps = 64;
+                            double sum = 0;
+                            for (int ii=0; ii<num_steps; ii++) {
+                                double y = half_chord * (ii + 0.5) / num_steps;
+                                double r_squared = x*x + y*y;
+                                double mu = sqrt( Max(0.0, 1 - r_squared) );
+                                sum += 1 - m_limb_u * (1 - mu);
+                            }
+                            return sum * half_chord / num_steps;
+                        }
+        default:        return 1;
+    }
+}
+
+void SunShape::Build()
+{
+    const int num_entries = 1025;
+    m_cdf.resize(num_entries);
+    m_cdf[0] = 0;
+    double previous = Profile(-1);
+    for (int ii=1; ii<num_entries; ii++) {
+        double current = Profile( -1 + 2.0 * ii / (num_entries-1) );
+        m_cdf[ii] = m_cdf[ii-1] + (previous + current) / 2; // trapezoid
+        previous = current;
+    }
+    for (int ii=1; ii<num_entries; ii++) m_cdf[ii] /= m_cdf[num_entries-1];
+}
+
+double SunShape::Sample(double uniform_0_1, double width_ang) const
+{
+    assert( !m_cdf.empty() );
+    // Binary search for the m_cdf interval containing uniform_0_1, then interpolate linearly within it
+    size_t low = 0, high = m_cdf.size()-1;
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (m_cdf[mid] <= uniform_0_1) low = mid; else high = mid;
+    }
+    double span = m_cdf[high] - m_cdf[low];
+    double fraction = (span > 0) ? (uniform_0_1 - m_cdf[low]) / span : 0.5;
+    double x = -1 + 2.0 * (low + fraction) / (m_cdf.size()-1);
+    return x * width_ang / 2;
+}
+
+double SunShape::Cumulative(double offset, double width_ang) const
+{
+    assert( !m_cdf.empty() );
+    if (width_ang <= 0) return (offset < 0) ? 0 : 1;
+    double position = (offset / (width_ang/2) + 1) / 2 * (m_cdf.size()-1);
+    if (position <= 0) return 0;
+    if (position >= m_cdf.size()-1) return 1;
+    size_t low = size_t(position);
+    return m_cdf[low] + (position - low) * (m_cdf[low+1] - m_cdf[low]);
+}
+
+std::vector<double> AngularKernel(const SunShape& shape, double sun_width_ang, double slope_error, double bin_width)
+    /* The angular spread of the reflected light from an ideal (point sun, perfect mirror) reflection - as a convolution
+     * kernel in bins of bin_width degrees (odd size, centered). It's the sun's shape convolved with a Gaussian for the
+     * mirror's slope error (the standard deviation of the surface normal, in degrees - which doubles on reflection).
+     */
+{
+    const double sigma = 2 * slope_error;
+    std::vector<double> sun_kernel( 2 * unsigned( ceil( sun_width_ang/2 / bin_width ) ) + 1 );
+    std::vector<double> slope_kernel( 2 * unsigned( ceil( 4 * sigma / bin_width ) ) + 1 );
+    for (size_t ii=0; ii<sun_kernel.size(); ii++) {
+        double offset = (double(ii) - sun_kernel.size()/2) * bin_width;
+        sun_kernel[ii] = shape.Cumulative( offset + bin_width/2, sun_width_ang ) - shape.Cumulative( offset - bin_width/2, sun_width_ang );
+    }
+    for (size_t ii=0; ii<slope_kernel.size(); ii++) {
+        double offset = (double(ii) - slope_kernel.size()/2) * bin_width;
+        slope_kernel[ii] = (sigma > 0) ? (erf( (offset + bin_width/2) / (sigma * sqrt(2.0)) ) - erf( (offset - bin_width/2) / (sigma * sqrt(2.0)) )) / 2
+                                       : (ii == slope_kernel.size()/2);
+    }
+    // Pad the sun's kernel, so that the result has room for the full width of both
+    std::vector<double> padded( sun_kernel.size() + slope_kernel.size() - 1, 0.0 );
+    std::copy( sun_kernel.begin(), sun_kernel.end(), padded.begin() + slope_kernel.size()/2 );
+    return Convolve( padded, slope_kernel );
+}
+
+static const char* Name(SunShape::Type type)
+{
+    switch(type) {
+        case SunShape::Uniform:      return "uniform";
+        case SunShape::Disk:         return "disk";
+        case SunShape::LimbDarkened: return "limb";
+        default:                     return "undefined";
+    }
+}
+
+
+template<class PointType>
+bool Intersection(const PointType& pt1, typename ScalarOf<PointType>::type arg_dir1, const PointType& pt2, typename ScalarOf<PointType>::type arg_dir2,
+                  PointType &intersection_pt) // returns success
 {
+    typedef typename ScalarOf<PointType>::type Scalar;
     if (pt1 == pt2) { intersection_pt = pt1; return true; } // avoids some special cases below
-    double dir1 = NormalizeAngle( arg_dir1 );
-    double dir2 = NormalizeAngle( arg_dir2 );
+    Scalar dir1 = NormalizeAngle( arg_dir1 );
+    Scalar dir2 = NormalizeAngle( arg_dir2 );
     if (dir1 == dir2) return false; // Could be true! If the lines are co-linear!
     if (dir1 == NormalizeAngle(dir2+180)) return false; // Could be true! If the lines are co-linear!
 
@@ -425,42 +1103,43 @@ bool Intersection(const Point& pt1, double arg_dir1, const Point& pt2, double ar
     if ( bad_tan1 ) {
         if (bad_tan2)
             fprintf(stderr,"%s((%g,%g),%g, (%g,%g),%g,...), unexpected case at %d of %s\n", __func__,
-                       pt1.x(), pt1.y(), arg_dir1, pt2.x(), pt2.y(), arg_dir2, __LINE__, __FILE__);
-        Set( intersection_pt, pt1.x(), pt2.y() + tan(to_radians(dir2)) * (pt1.x() - pt2.x()) );
+                       Value(pt1.x()), Value(pt1.y()), Value(arg_dir1), Value(pt2.x()), Value(pt2.y()), Value(arg_dir2), __LINE__, __FILE__);
+        intersection_pt = PointType( pt1.x(), pt2.y() + tan(to_radians(dir2)) * (pt1.x() - pt2.x()) );
         return true;
     } 
     if ( bad_tan2 ) {
-        Set( intersection_pt, pt2.x(), pt1.y() + tan(to_radians(dir1)) * (pt2.x() - pt1.x()) );
+        intersection_pt = PointType( pt2.x(), pt1.y() + tan(to_radians(dir1)) * (pt2.x() - pt1.x()) );
         return true;
     }
 
-    double tan1 = tan(to_radians( dir1 ));
-    double tan2 = tan(to_radians( dir2 ));
+    Scalar tan1 = tan(to_radians( dir1 ));
+    Scalar tan2 = tan(to_radians( dir2 ));
 
-    double X = (pt2.y() - pt1.y() + tan1 * pt1.x() - tan2 * pt2.x()) / (tan1-tan2);
-    double Y = BadValue;
+    Scalar X = (pt2.y() - pt1.y() + tan1 * pt1.x() - tan2 * pt2.x()) / (tan1-tan2);
+    Scalar Y = BadValue;
     if (X != pt1.x()) {
         Y = pt1.y() + tan1 * (X - pt1.x());
     } else if (X != pt2.x()){
         Y = pt2.y() + tan2 * (X - pt2.x());
     } else { // X == pt1.x() == pt2.x() - so must also have the same Ys - should have been caught for the pt1==pt2 above
         fprintf(stderr,"%s((%g,%g),%g, (%g,%g),%g,...), unexpected case at %d of %s\n", __func__,
-                   pt1.x(), pt1.y(), arg_dir1, pt2.x(), pt2.y(), arg_dir2, __LINE__, __FILE__);
+                   Value(pt1.x()), Value(pt1.y()), Value(arg_dir1), Value(pt2.x()), Value(pt2.y()), Value(arg_dir2), __LINE__, __FILE__);
         return false;
     }
 
-    Set(intersection_pt, X,Y);
+    intersection_pt = PointType(X,Y);
     if (NearlyEqual( intersection_pt, pt1 )) return true;
     if (NearlyEqual( intersection_pt, pt2 )) return true;
 
     // Found and intersection point - now check if it is in the negative direction (i.e. before where the ray starts).
-    double final_dir1 = Direction(pt1, intersection_pt);
-    double final_dir2 = Direction(pt2, intersection_pt);
+    Scalar final_dir1 = Direction(pt1, intersection_pt);
+    Scalar final_dir2 = Direction(pt2, intersection_pt);
 
-    if (     (!NearlyEqual( dir1, final_dir1 )) || (!NearlyEqual( dir2, final_dir2 )) ) {
+    if (     (!NearlyEqual( Value(dir1), Value(final_dir1) )) || (!NearlyEqual( Value(dir2), Value(final_dir2) )) ) {
         if(dvo_debug)
             printf("%s((%g,%g),dir1=%g, (%g,%g),dir2=%g), intersection=(%g,%g), final1=%g, final2=%g\n",
-                   __func__, pt1.x(), pt1.y(), arg_dir1, pt2.x(), pt2.y(), arg_dir2, intersection_pt.x(), intersection_pt.y(), final_dir1, final_dir2);
+                   __func__, Value(pt1.x()), Value(pt1.y()), Value(arg_dir1), Value(pt2.x()), Value(pt2.y()), Value(arg_dir2),
+                   Value(intersection_pt.x()), Value(intersection_pt.y()), Value(final_dir1), Value(final_dir2));
         return false;
     }
 
@@ -468,18 +1147,21 @@ bool Intersection(const Point& pt1, double arg_dir1, const Point& pt2, double ar
 }
 
 
-Point FindReflectPoint_Concave( const Point& MirrorCOC, double Radius, const Point& MirrorReflectPt, double Incident_dir)
+template<class PointType>
+PointType FindReflectPoint_Concave( const PointType& MirrorCOC, typename ScalarOf<PointType>::type Radius, const PointType& MirrorReflectPt,
+                                   typename ScalarOf<PointType>::type Incident_dir)
     /* A reflected ray originates at MirrorReflectPt on the concave surface of a (semi-)circular mirror with center
      * of curvature at MirrorCOC. The ray will travel a distance across the interior and the cross the circle (again
      * striking the mirror if it extends that far). This routine determines the point where the ray would strike
      * the mirror.
      */
 {
-    double normal_dir = Direction(MirrorCOC,MirrorReflectPt);
-    double tangent_dir = NormalizeAngle(normal_dir + 90);
-    double inner_angle = NormalizeAngle(Incident_dir - tangent_dir); // angle from COC to MirrorReflectPt to Incident_dir
-    double arc_length_deg = inner_angle *2;
-    double second_normal_dir = NormalizeAngle(normal_dir + arc_length_deg);
+    typedef typename ScalarOf<PointType>::type Scalar;
+    Scalar normal_dir = Direction(MirrorCOC,MirrorReflectPt);
+    Scalar tangent_dir = NormalizeAngle(normal_dir + 90);
+    Scalar inner_angle = NormalizeAngle(Incident_dir - tangent_dir); // angle from COC to MirrorReflectPt to Incident_dir
+    Scalar arc_length_deg = inner_angle *2;
+    Scalar second_normal_dir = NormalizeAngle(normal_dir + arc_length_deg);
 
     return Find2ndPoint(MirrorCOC, second_normal_dir, Radius );
 }
@@ -567,7 +1249,7 @@ double ConcaveRayCalculate (
     double next_incident_dir = incident_dir;
     double reflect_dir = BadValue;
 
-    const int loop_limit = 20;
+    const int loop_limit = dvo_quality->m_loop_limit;
     int loop_count = 0;
     while (1) { // follow reflections along the mirror surface
         loop_count++;
@@ -594,57 +1276,787 @@ double ConcaveRayCalculate (
 }
 
 
-class TheData { // Please come up with a better name
-    public:
-        // input data
-        double m_radius;
-        double m_sun_dir; // degrees
-        double m_sun_width_ang; // degrees;
+template<class PointType>
+TracedRay::RayStatus ConcaveRayKernel (
+        const PointType& MirrorCOC, typename ScalarOf<PointType>::type Radius, double min_normal_dir, double max_normal_dir,
+        typename ScalarOf<PointType>::type incident_dir, typename ScalarOf<PointType>::type target_normal_dir,
+        typename ScalarOf<PointType>::type& reflect_dir, PointType& exit_pt, unsigned& strikes // output arguments
+        )
+    /* Same classification as ConcaveRayCalculate() for a ray from the sun (i.e. no RayOriginPt), but without storing the
+     * strike points - so without any memory allocation. Intended for the RayBatch (many rays) kernels - and, on Dual, for
+     * -gradient. On return, exit_pt is the last reflection point and strikes is the number of reflections (both valid only
+     * if NStrike or better).
+     */
+{
+    typedef typename ScalarOf<PointType>::type Scalar;
+    PointType TargetPt = Find2ndPoint( MirrorCOC, target_normal_dir, Radius );
+    reflect_dir = BadValue;
+    strikes = 0;
+    exit_pt = TargetPt;
+
+    // Case 1 - see ConcaveRayCalculate()
+    if ( !RayStrikeConcave( Value(incident_dir), Value(target_normal_dir) ) ) return TracedRay::Convex;
+
+    // Case 2
+    PointType potential_1stStrikePt = FindReflectPoint_Concave( MirrorCOC, Radius, TargetPt, NormalizeAngle( incident_dir + 180 ) );
+    if ( NormalWithinArc( Value(Direction( MirrorCOC, potential_1stStrikePt )), min_normal_dir, max_normal_dir) ) return TracedRay::Obscured;
+
+    // Case 3
+    TracedRay::RayStatus ray_status = TracedRay::Unobscured;
+    Scalar next_incident_dir = incident_dir;
+    const unsigned loop_limit = dvo_quality->m_loop_limit;
+    for (strikes = 1; ; strikes++) {
+        Scalar this_strike_normal = Direction( MirrorCOC, exit_pt );
+        reflect_dir = NormalizeAngle( next_incident_dir + 2*(this_strike_normal + -next_incident_dir) +180);
+        PointType next_potential_strike_pt = FindReflectPoint_Concave( MirrorCOC, Radius, exit_pt, reflect_dir );
+        if ( ! NormalWithinArc( Value(Direction( MirrorCOC, next_potential_strike_pt )), min_normal_dir, max_normal_dir) ) break;
+        ray_status = TracedRay::NStrike;
+        exit_pt = next_potential_strike_pt;
+        next_incident_dir = reflect_dir;
+        if (strikes >= loop_limit) {
+            ray_status = TracedRay::NStrikeOut;
+            break;
+        }
+    }
+    return ray_status;
+}
 
-        
-// Concave - the following fields are applicable to CONCAVE mirrors only
-               // Limits a portion of the circle (i.e. arc-length)
-        bool m_IsConvex; // true=Convex, false=Concave
-        Point m_MirrorCOCPt; // mirror's center-of-curvature
-        double m_min_normal_dir; // min/max normal directions define the limits of the ARC
-        double m_max_normal_dir;
 
-        Point m_min_normal_pt;
-        Point m_max_normal_pt;
-        Point m_MidArcPt;
+TracedRay::RayStatus ConcaveRayKernel_Angular (
+        double Radius, double min_normal_dir, double max_normal_dir, double incident_dir, double target_normal_dir,
+        double& reflect_dir, double& exit_x, double& exit_y, unsigned& strikes // output arguments
+        )
+    /* ConcaveRayKernel() for a mirror centered on the origin - but followed entirely in angles: a chord leaving the circle at
+     * normal n in direction d next meets it at normal n + 2*(d - (n+90)) (see FindReflectPoint_Concave()). So there's no
+     * trig (nor atan2) until the exit point, which uses FastSinCos(). For -quality fast.
+     */
+{
+    reflect_dir = BadValue;
+    strikes = 0;
+    double normal_dir = NormalizeAngle( target_normal_dir );
+    TracedRay::RayStatus ray_status = TracedRay::Unobscured;
+
+    if ( !RayStrikeConcave( incident_dir, target_normal_dir ) ) ray_status = TracedRay::Convex; // Case 1
+    else if ( NormalWithinArc( NormalizeAngle( normal_dir + 2*NormalizeAngle( NormalizeAngle( incident_dir + 180 ) - NormalizeAngle( normal_dir + 90 ) ) ),
+                               min_normal_dir, max_normal_dir ) ) ray_status = TracedRay::Obscured; // Case 2
+    else { // Case 3
+        const unsigned loop_limit = dvo_quality->m_loop_limit;
+        double next_incident_dir = incident_dir;
+        for (strikes = 1; ; strikes++) {
+            reflect_dir = NormalizeAngle( next_incident_dir + 2*(normal_dir + -next_incident_dir) +180);
+            double next_normal_dir = NormalizeAngle( normal_dir + 2*NormalizeAngle( reflect_dir - NormalizeAngle( normal_dir + 90 ) ) );
+            if ( ! NormalWithinArc( next_normal_dir, min_normal_dir, max_normal_dir ) ) break;
+            ray_status = TracedRay::NStrike;
+            normal_dir = next_normal_dir;
+            next_incident_dir = reflect_dir;
+            if (strikes >= loop_limit) {
+                ray_status = TracedRay::NStrikeOut;
+                break;
+            }
+        }
+    }
+    double sin_normal, cos_normal;
+    FastSinCos( normal_dir, sin_normal, cos_normal );
+    exit_x = Radius * cos_normal;
+    exit_y = Radius * sin_normal;
+    return ray_status;
+}
 
-        Segment m_screen;
-        std::deque< Segment > m_stencils;
-        std::list<Point> m_target_pts;
+class ReflectionLUT
+    /* -lut: the single (circular) mirror's classification - ConcaveRayKernel()'s status, strikes, reflected direction and
+     * exit normal - tabulated over the target normal (across the arc) and the incident ray's angle from it (-90 to 90 - the
+     * rest strike the convex side). Within a cell whose 4 corners agree in status and strikes, the directions are linear in
+     * both (each reflection adds a multiple of each), so interpolating them is exact; the cells next to a status boundary
+     * are traced exactly (see m_interpolate). Built once per mirror (see Get()) - shared by the cases, and the threads, that use it.
+     */
+{
+public:
+    ReflectionLUT(double radius, double min_normal_dir, double max_normal_dir, unsigned cells);
+
+    TracedRay::RayStatus Trace(double incident_dir, double target_normal_dir, double& reflect_dir, double& exit_normal_dir, unsigned& strikes) const;
+    static std::shared_ptr<const ReflectionLUT> Get(double radius, double min_normal_dir, double max_normal_dir, unsigned cells);
+
+private:
+    double m_radius, m_min_normal_dir, m_max_normal_dir;
+    unsigned m_loop_limit; // (of the -quality when built)
+    unsigned m_cells;      // in each of normal and angle - so (m_cells+1)^2 nodes
+    double m_normal_step, m_angle_step;
+    std::vector<unsigned char> m_status, m_strikes;
+    std::vector<double> m_reflect_dir, m_exit_normal_dir;
+    std::vector<unsigned char> m_interpolate; // per cell - the nodes of it and its neighbors agree in status and strikes
+
+    TracedRay::RayStatus TraceExactly(double incident_dir, double target_normal_dir, double& reflect_dir, double& exit_normal_dir, unsigned& strikes) const;
+};
 
-// Convex - the following fields are applicable to CONVEX mirrors only - DVO 12/16/2018: why is that a restriction?
-        double m_distance; // from observer to mirror's COC
-		Point m_ObserverPt;
+ReflectionLUT::ReflectionLUT(double radius, double min_normal_dir, double max_normal_dir, unsigned cells)
+    : m_radius(radius), m_min_normal_dir(min_normal_dir), m_max_normal_dir(max_normal_dir), m_loop_limit(dvo_quality->m_loop_limit),
+      m_cells(Max(cells, 1u)), m_normal_step((max_normal_dir - min_normal_dir) / Max(cells, 1u)), m_angle_step(180.0 / Max(cells, 1u)),
+      m_status(), m_strikes(), m_reflect_dir(), m_exit_normal_dir(), m_interpolate()
+{
+    const size_t nodes = size_t(m_cells+1) * (m_cells+1);
+    m_status.resize(nodes); m_strikes.resize(nodes); m_reflect_dir.resize(nodes); m_exit_normal_dir.resize(nodes);
+    ParallelFor( m_cells+1, [this](size_t begin, size_t end, unsigned) {
+        for (size_t nn=begin; nn<end; nn++) {
+            double normal_dir = m_min_normal_dir + nn * m_normal_step;
+            for (size_t aa=0; aa<=m_cells; aa++) {
+                size_t node = nn * (m_cells+1) + aa;
+                unsigned strikes;
+                m_status[node] = TraceExactly( normal_dir - 90 + aa * m_angle_step, normal_dir, m_reflect_dir[node], m_exit_normal_dir[node], strikes );
+                m_strikes[node] = Min( strikes, 255u );
+            }
+        }
+    });
+
+    // A change of status can also lie wholly within a cell whose corners agree (entering and leaving by the same side) -
+    // but then its neighbor across that side doesn't agree. So only the cells within agreeing neighbors are interpolated.
+    m_interpolate.resize( size_t(m_cells) * m_cells );
+    for (unsigned nn=0; nn<m_cells; nn++) {
+        for (unsigned aa=0; aa<m_cells; aa++) {
+            const size_t first = size_t(nn) * (m_cells+1) + aa;
+            bool agree = true;
+            for (unsigned n2 = (nn ? nn-1 : 0); agree && (n2 <= Min(nn+2, m_cells)); n2++)
+                for (unsigned a2 = (aa ? aa-1 : 0); agree && (a2 <= Min(aa+2, m_cells)); a2++) {
+                    const size_t node = size_t(n2) * (m_cells+1) + a2;
+                    agree = (m_status[node] == m_status[first]) && (m_strikes[node] == m_strikes[first]);
+                }
+            m_interpolate[size_t(nn) * m_cells + aa] = agree;
+        }
+    }
+}
 
-        // Results (output data)
-        //
-        std::deque<TracedRay> m_TopRays; // indexed in steps from m_min_normal_dir to m_max_normal_dir.
-        std::deque<TracedRay> m_BotRays;
+TracedRay::RayStatus ReflectionLUT::TraceExactly(double incident_dir, double target_normal_dir, double& reflect_dir, double& exit_normal_dir, unsigned& strikes) const
+{
+    Point exit_pt;
+    TracedRay::RayStatus status = ConcaveRayKernel( Point(0,0), m_radius, m_min_normal_dir, m_max_normal_dir, incident_dir, target_normal_dir,
+                                                    reflect_dir, exit_pt, strikes );
+    exit_normal_dir = Direction( Point(0,0), exit_pt );
+    return status;
+}
 
-        unsigned m_CountOfObscuredRays; // # of m_TopRays+m_BotRays whose reflected rays are invalid (see TracedRay::m_ray_status)
+TracedRay::RayStatus ReflectionLUT::Trace(double incident_dir, double target_normal_dir, double& reflect_dir, double& exit_normal_dir, unsigned& strikes) const
+    // As ConcaveRayKernel() (for a mirror centered on the origin) - but exit_normal_dir rather than the exit point.
+{
+    double normal_pos = (target_normal_dir - m_min_normal_dir) / m_normal_step;
+    double angle_pos = (NormalizeAngle( incident_dir - target_normal_dir + 180 ) - 90) / m_angle_step; // from -90 degrees
+    if (!(normal_pos >= 0) || (normal_pos > m_cells) || (angle_pos <= 0) || (angle_pos >= m_cells)) {
+        return TraceExactly( incident_dir, target_normal_dir, reflect_dir, exit_normal_dir, strikes );
+    }
+    unsigned nn = Min( unsigned(normal_pos), m_cells-1 ), aa = Min( unsigned(angle_pos), m_cells-1 );
+    const size_t n00 = size_t(nn) * (m_cells+1) + aa, n01 = n00 + 1, n10 = n00 + (m_cells+1), n11 = n10 + 1;
+    const unsigned char status = m_status[n00];
+    if (!m_interpolate[size_t(nn) * m_cells + aa]) return TraceExactly( incident_dir, target_normal_dir, reflect_dir, exit_normal_dir, strikes );
+
+    strikes = m_strikes[n00];
+    if (status < TracedRay::NStrike) { // Convex or Obscured - nothing reflected
+        reflect_dir = BadValue;
+        exit_normal_dir = NormalizeAngle( target_normal_dir );
+        return TracedRay::RayStatus(status);
+    }
+    const double fn = normal_pos - nn, fa = angle_pos - aa;
+    auto Interpolate = [fn, fa](const std::vector<double>& values, size_t n00, size_t n01, size_t n10, size_t n11) -> double {
+        double v00 = values[n00]; // (the others unwrapped to within 180 degrees of it)
+        double d01 = NormalizeAngle( values[n01] - v00 + 180 ) - 180;
+        double d10 = NormalizeAngle( values[n10] - v00 + 180 ) - 180;
+        double d11 = NormalizeAngle( values[n11] - v00 + 180 ) - 180;
+        return NormalizeAngle( v00 + fa * d01 + fn * d10 + fn * fa * (d11 - d10 - d01) );
+    };
+    reflect_dir = Interpolate( m_reflect_dir, n00, n01, n10, n11 );
+    exit_normal_dir = Interpolate( m_exit_normal_dir, n00, n01, n10, n11 );
+    return TracedRay::RayStatus(status);
+}
 
-        std::deque<Point> m_TopIntersectionPts; // (N-1)squared - intersection points of the reflected Top rays
-        std::deque<Point> m_BotIntersectionPts; // (N-1)squared - intersection points of the reflected Bot rays
+std::shared_ptr<const ReflectionLUT> ReflectionLUT::Get(double radius, double min_normal_dir, double max_normal_dir, unsigned cells)
+    // The table for this mirror - built on first use, then shared (the last few are kept).
+{
+    static std::mutex mutex;
+    static std::deque< std::shared_ptr<const ReflectionLUT> > tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = tables.begin(); it != tables.end(); ++it)
+        if (((*it)->m_radius == radius) && ((*it)->m_min_normal_dir == min_normal_dir) && ((*it)->m_max_normal_dir == max_normal_dir)
+         && ((*it)->m_cells == Max(cells, 1u)) && ((*it)->m_loop_limit == dvo_quality->m_loop_limit))
+            return *it;
+    tables.push_back( std::make_shared<const ReflectionLUT>( radius, min_normal_dir, max_normal_dir, cells ) );
+    if (tables.size() > 4) tables.pop_front();
+    return tables.back();
+}
 
-        BBox m_TopIntersectionBBox; // bounding-box of all m_TopIntersectionPts
-        BBox m_BotIntersectionBBox; // bounding-box of all m_BotIntersectionPts
 
-        double m_reflected_rays_width_ang;
-        double m_reflected_focal_distance;
-        double m_reflected_blur; // a distance across the BBox
 
-		// Tangent (light ray that reaches observer that skims the mirror)
-		double m_ObserverTangentAng;  // from observer to tangent point. 0 is horizontal (>0 is up)
-		double m_NormalTangentAng; // From center of mirror
-		Point m_TangentPt; // On mirror
+class ProfileMirror
+    /* A mirror with a tabulated (e.g. measured) profile - a list of points, fitted with a (natural, cubic) spline x(u),y(u)
+     * where u is the cumulative chord length (so ~the distance along the mirror). The points must be in order along the
+     * mirror, with the reflective side on the left (e.g. left to right for a mirror facing up). As for the circular mirrors,
+     * the 'normal' points out of the back of the mirror.
+     * A lookup table (LUT) - uniform in u - of surface points and normals is precomputed, in chunks, each with a bounding
+     * box. A ray is intersected by skipping the chunks its line misses, bracketing the hit between LUT entries (a change
+     * of side of the ray), and then refining it on the spline.
+     */
+{
+public:
+    ProfileMirror() : m_knot_u(), m_knot_x(), m_knot_y(), m_d2x(), m_d2y(), m_lut_x(), m_lut_y(), m_lut_nx(), m_lut_ny(), m_chunks(), m_epsilon(SmallValue) {};
+
+    bool Load(const char* filename); // returns success
+    void Fit(const std::vector<Point>& points);
+    bool Empty() const { return m_knot_u.size() < 2; }
+    unsigned NumPoints() const { return m_knot_u.size(); }
+    double Length() const { return Empty() ? 0 : m_knot_u.back(); }
+
+    void Evaluate(double u, double& x, double& y, double& nx, double& ny) const; // point and (unit) normal at u
+    bool Intersect(double x, double y, double dx, double dy, double max_distance, double& distance, double& u) const;
+    TracedRay::RayStatus Trace(double u, double incident_dir, double& reflect_dir, Point& exit_pt, unsigned& strikes) const; // as ConcaveRayKernel()
+
+private:
+    struct Chunk { double m_min_x, m_min_y, m_max_x, m_max_y; };
+    static const unsigned LutSize = 1025;  // entries
+    static const unsigned ChunkSize = 32;  // LUT intervals per chunk
+
+    double Lut_u(unsigned index) const { return Length() * index / (LutSize-1); }
+
+    std::vector<double> m_knot_u, m_knot_x, m_knot_y; // the profile's points
+    std::vector<double> m_d2x, m_d2y;                 // 2nd derivatives (d2x/du2, d2y/du2) at the knots
+    std::vector<double> m_lut_x, m_lut_y, m_lut_nx, m_lut_ny;
+    std::vector<Chunk> m_chunks;
+    double m_epsilon; // hits closer than this (to the ray's start) are ignored
+};
 
+const unsigned ProfileMirror::LutSize;
+const unsigned ProfileMirror::ChunkSize;
 
-		double m_ObserverReflectedSunBot; // Sun's bottom
+static void NaturalSpline(const std::vector<double>& u, const std::vector<double>& value, std::vector<double>& d2)
+    // 2nd derivatives at the knots of a natural cubic spline (tridiagonal solve)
+{
+    const size_t num = u.size();
+    d2.assign( num, 0.0 );
+    if (num < 3) return;
+    std::vector<double> temp( num, 0.0 );
+    for (size_t ii=1; ii<num-1; ii++) {
+        double sig = (u[ii] - u[ii-1]) / (u[ii+1] - u[ii-1]);
+        double pp = sig * d2[ii-1] + 2;
+        d2[ii] = (sig - 1) / pp;
+        temp[ii] = (value[ii+1] - value[ii]) / (u[ii+1] - u[ii]) - (value[ii] - value[ii-1]) / (u[ii] - u[ii-1]);
+        temp[ii] = (6 * temp[ii] / (u[ii+1] - u[ii-1]) - sig * temp[ii-1]) / pp;
+    }
+    d2[num-1] = 0;
+    for (size_t ii=num-1; ii-- > 0; ) d2[ii] = d2[ii] * d2[ii+1] + temp[ii];
+}
+
+bool ProfileMirror::Load(const char* filename)
+    // One point per line: X Y (separated by spaces, tabs or a comma). Blank lines, and lines starting with #, are skipped.
+{
+    FILE* fin = fopen(filename, "r");
+    if (fin == NULL) {
+        fprintf(stderr, "ERROR: Can't open the profile %s for reading.\n", filename);
+        return false;
+    }
+    std::vector<Point> points;
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), fin)) {
+        line_number++;
+        char* start = line + strspn(line, " \t");
+        if ((*start == '#') || (*start == '\n') || (*start == '\r') || (*start == 0)) continue;
+        double X, Y;
+        if (sscanf(start, "%lf%*[ ,\t]%lf", &X, &Y) != 2) {
+            fprintf(stderr, "ERROR: Expecting X,Y at line %d of the profile %s: %s", line_number, filename, line);
+            fclose(fin);
+            return false;
+        }
+        points.push_back( Point(X,Y) );
+    }
+    fclose(fin);
+    if (points.size() < 2) {
+        fprintf(stderr, "ERROR: The profile %s has %d points (at least 2 are needed).\n", filename, int(points.size()));
+        return false;
+    }
+    Fit(points);
+    return true;
+}
+
+void ProfileMirror::Fit(const std::vector<Point>& points)
+{
+    m_knot_u.clear(); m_knot_x.clear(); m_knot_y.clear();
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        double u = m_knot_u.empty() ? 0 : m_knot_u.back() + Distance( Point(m_knot_x.back(), m_knot_y.back()), *it );
+        if (!m_knot_u.empty() && (u == m_knot_u.back())) continue; // a repeated point
+        m_knot_u.push_back( u );
+        m_knot_x.push_back( it->x() );
+        m_knot_y.push_back( it->y() );
+    }
+    if (Empty()) return;
+    NaturalSpline( m_knot_u, m_knot_x, m_d2x );
+    NaturalSpline( m_knot_u, m_knot_y, m_d2y );
+    m_epsilon = SmallValue * 0.001 * Max( 1.0, Length() );
+
+    m_lut_x.resize(LutSize); m_lut_y.resize(LutSize); m_lut_nx.resize(LutSize); m_lut_ny.resize(LutSize);
+    for (unsigned ii=0; ii<LutSize; ii++)
+        Evaluate( Lut_u(ii), m_lut_x[ii], m_lut_y[ii], m_lut_nx[ii], m_lut_ny[ii] );
+
+    m_chunks.clear();
+    for (unsigned first=0; first<LutSize-1; first += ChunkSize) {
+        Chunk chunk = { m_lut_x[first], m_lut_y[first], m_lut_x[first], m_lut_y[first] };
+        for (unsigned ii=first; ii<=Min(first+ChunkSize, LutSize-1); ii++) {
+            chunk.m_min_x = Min( chunk.m_min_x, m_lut_x[ii] ); chunk.m_max_x = Max( chunk.m_max_x, m_lut_x[ii] );
+            chunk.m_min_y = Min( chunk.m_min_y, m_lut_y[ii] ); chunk.m_max_y = Max( chunk.m_max_y, m_lut_y[ii] );
+        }
+        m_chunks.push_back( chunk );
+    }
+}
+
+void ProfileMirror::Evaluate(double u, double& x, double& y, double& nx, double& ny) const
+{
+    u = Max( 0.0, Min( u, Length() ) );
+    size_t hi = std::upper_bound( m_knot_u.begin(), m_knot_u.end(), u ) - m_knot_u.begin();
+    hi = Max( size_t(1), Min( hi, m_knot_u.size()-1 ) );
+    size_t lo = hi - 1;
+    double h = m_knot_u[hi] - m_knot_u[lo];
+    double a = (m_knot_u[hi] - u) / h;
+    double b = 1 - a;
+    x = a*m_knot_x[lo] + b*m_knot_x[hi] + ((a*a*a - a)*m_d2x[lo] + (b*b*b - b)*m_d2x[hi]) * h*h / 6;
+    y = a*m_knot_y[lo] + b*m_knot_y[hi] + ((a*a*a - a)*m_d2y[lo] + (b*b*b - b)*m_d2y[hi]) * h*h / 6;
+    double tx = (m_knot_x[hi] - m_knot_x[lo]) / h + (-(3*a*a - 1)*m_d2x[lo] + (3*b*b - 1)*m_d2x[hi]) * h / 6;
+    double ty = (m_knot_y[hi] - m_knot_y[lo]) / h + (-(3*a*a - 1)*m_d2y[lo] + (3*b*b - 1)*m_d2y[hi]) * h / 6;
+    double length = sqrt( tx*tx + ty*ty );
+    nx =  ty / length; // to the right of the tangent - out of the back of the mirror
+    ny = -tx / length;
+}
+
+bool ProfileMirror::Intersect(double x, double y, double dx, double dy, double max_distance, double& distance, double& u) const
+    // The nearest hit (beyond m_epsilon, and before max_distance) of the ray from x,y in (unit) direction dx,dy.
+{
+    bool found = false;
+    const double inv_dx = 1 / dx, inv_dy = 1 / dy; // may be infinite
+    for (unsigned cc=0; cc<m_chunks.size(); cc++) {
+        const Chunk& chunk = m_chunks[cc];
+        // Slab test (as MirrorScene::NearestHit())
+        double t1 = (chunk.m_min_x - x) * inv_dx, t2 = (chunk.m_max_x - x) * inv_dx;
+        double t_near = Min(t1, t2), t_far = Max(t1, t2);
+        if (dx == 0) { t_near = -BadValue; t_far = ((x < chunk.m_min_x) || (x > chunk.m_max_x)) ? -BadValue : BadValue; }
+        t1 = (chunk.m_min_y - y) * inv_dy; t2 = (chunk.m_max_y - y) * inv_dy;
+        if (dy == 0) { t1 = -BadValue; t2 = ((y < chunk.m_min_y) || (y > chunk.m_max_y)) ? -BadValue : BadValue; }
+        t_near = Max( t_near, Min(t1, t2) );
+        t_far  = Min( t_far,  Max(t1, t2) );
+        if ((t_near > t_far) || (t_far < 0) || (t_near >= max_distance)) continue;
+
+        // Bracket - which side of the ray's line is each LUT point?
+        const unsigned first = cc * ChunkSize, last = Min( first + ChunkSize, LutSize-1 );
+        double side_lo = dx * (m_lut_y[first] - y) - dy * (m_lut_x[first] - x);
+        for (unsigned ii=first; ii<last; ii++) {
+            double side_hi = dx * (m_lut_y[ii+1] - y) - dy * (m_lut_x[ii+1] - x);
+            if ((side_lo < 0) != (side_hi < 0)) {
+                // Refine on the spline - regula falsi (with the Illinois modification), starting from the LUT interval
+                double u_lo = Lut_u(ii), u_hi = Lut_u(ii+1), f_lo = side_lo, f_hi = side_hi;
+                double u_hit = u_lo, px = m_lut_x[ii], py = m_lut_y[ii];
+                int last_side = 0;
+                for (int iteration=0; iteration<30; iteration++) {
+                    u_hit = (f_hi == f_lo) ? (u_lo + u_hi)/2 : u_hi - f_hi * (u_hi - u_lo) / (f_hi - f_lo);
+                    double nx, ny;
+                    Evaluate( u_hit, px, py, nx, ny );
+                    double f = dx * (py - y) - dy * (px - x);
+                    if (fabs(f) <= m_epsilon * 0.001) break;
+                    if ((f < 0) == (f_lo < 0)) { u_lo = u_hit; f_lo = f; if (last_side == -1) f_hi /= 2; last_side = -1; }
+                    else                       { u_hi = u_hit; f_hi = f; if (last_side ==  1) f_lo /= 2; last_side =  1; }
+                }
+                double hit_distance = (px - x) * dx + (py - y) * dy;
+                if ((hit_distance > m_epsilon) && (hit_distance < max_distance)) {
+                    max_distance = distance = hit_distance;
+                    u = u_hit;
+                    found = true;
+                }
+            }
+            side_lo = side_hi;
+        }
+    }
+    return found;
+}
+
+TracedRay::RayStatus ProfileMirror::Trace(double u, double incident_dir, double& reflect_dir, Point& exit_pt, unsigned& strikes) const
+    // As MirrorScene::Trace() - for a ray from the sun (incident_dir) that targets the mirror at u.
+{
+    double x, y, nx, ny;
+    Evaluate( u, x, y, nx, ny );
+    double dx = cos( to_radians( incident_dir ) ), dy = sin( to_radians( incident_dir ) );
+    reflect_dir = BadValue;
+    strikes = 0;
+    exit_pt = Point(x, y);
+
+    if (dx*nx + dy*ny <= 0) return TracedRay::Convex; // from behind the mirror
+
+    // Does the ray cross the mirror before reaching the target? (Start it from beyond the mirror's extent)
+    double back_distance = 2 * Length() + 1;
+    double distance, hit_u;
+    if (Intersect( x - back_distance*dx, y - back_distance*dy, dx, dy, back_distance - 2*m_epsilon - SmallValue*Length(), distance, hit_u ))
+        return TracedRay::Obscured;
+
+    const unsigned loop_limit = dvo_quality->m_loop_limit;
+    for (strikes = 1; ; strikes++) {
+        double dot = dx*nx + dy*ny; // reflect
+        dx -= 2*dot*nx;
+        dy -= 2*dot*ny;
+        reflect_dir = NormalizeAngle( to_degrees( atan2( dy, dx ) ) );
+        exit_pt = Point(x, y);
+        if (! Intersect( x, y, dx, dy, BadValue, distance, hit_u )) break; // escapes
+        Evaluate( hit_u, x, y, nx, ny );
+        if (dx*nx + dy*ny <= 0) return TracedRay::Blocked; // the back of the mirror
+        if (strikes >= loop_limit) return TracedRay::NStrikeOut;
+    }
+    return (strikes == 1) ? TracedRay::Unobscured : TracedRay::NStrike;
+}
+
+
+struct MirrorArc
+    // One (concave) mirror of a MirrorScene - an arc of a circle, as for TheData's single mirror.
+{
+    MirrorArc(const Point& coc, double radius, double min_normal_dir, double max_normal_dir);
+
+    double Length() const { return m_radius * to_radians( m_max_normal_dir - m_min_normal_dir ); }
+    bool WithinArc(double x, double y) const { // is the point (on the circle) within the arc?
+        return ((x - m_coc.x()) * m_mid_x + (y - m_coc.y()) * m_mid_y) >= m_cos_half * m_radius;
+    }
+    BBox Bounds() const;
+
+    Point m_coc;
+    double m_radius;
+    double m_min_normal_dir;
+    double m_max_normal_dir;
+
+    double m_mid_x, m_mid_y; // unit vector from m_coc to the middle of the arc
+    double m_cos_half;       // cosine of half the arc's angle
+};
+
+MirrorArc::MirrorArc(const Point& coc, double radius, double min_normal_dir, double max_normal_dir) :
+    m_coc(coc),
+    m_radius(radius),
+    m_min_normal_dir(min_normal_dir),
+    m_max_normal_dir(max_normal_dir),
+    m_mid_x( cos( to_radians( (min_normal_dir + max_normal_dir)/2 ) ) ),
+    m_mid_y( sin( to_radians( (min_normal_dir + max_normal_dir)/2 ) ) ),
+    m_cos_half( (max_normal_dir - min_normal_dir >= 360) ? -2 : cos( to_radians( (max_normal_dir - min_normal_dir)/2 ) ) - SmallValue*SmallValue )
+{
+}
+
+BBox MirrorArc::Bounds() const
+{
+    BBox bounds;
+    bounds.Update( Find2ndPoint( m_coc, m_min_normal_dir, m_radius ) );
+    bounds.Update( Find2ndPoint( m_coc, m_max_normal_dir, m_radius ) );
+    for (int dir=0; dir<360; dir += 90) // the circle's extreme points - if within the arc
+        if (NormalWithinArc( dir, m_min_normal_dir, m_max_normal_dir ) || (m_max_normal_dir - m_min_normal_dir >= 360))
+            bounds.Update( Find2ndPoint( m_coc, dir, m_radius ) );
+    return bounds;
+}
+
+
+class MirrorScene
+    /* A mirror-field: many mirrors (arcs - each with its own COC, radius and extent) and stencils (opaque line segments).
+     * A bounding-volume hierarchy (BVH) over all of them finds a ray's nearest hit in ~logarithmic time - so mirrors that
+     * shade (the incident light) and block (the reflected light) one another are traced correctly, even with thousands of
+     * mirrors. Call Build() after adding mirrors and stencils.
+     */
+{
+public:
+    MirrorScene() : m_arcs(), m_stencils(), m_nodes(), m_order(), m_depth(0), m_epsilon(SmallValue) {};
+
+    bool Empty() const { return m_arcs.empty(); }
+    void Build();
+
+    bool NearestHit(double x, double y, double dx, double dy, double max_distance,
+                    double& distance, unsigned& index) const; // index: < m_arcs.size() for a mirror, else a stencil
+
+    TracedRay::RayStatus Trace(unsigned arc_index, double target_normal_dir, double incident_dir,
+                               double& reflect_dir, Point& exit_pt, unsigned& strikes) const; // as ConcaveRayKernel()
+
+    std::vector<MirrorArc> m_arcs;
+    std::vector<Segment> m_stencils;
+
+private:
+    struct Node {
+        double m_min_x, m_min_y, m_max_x, m_max_y;
+        unsigned m_first; // leaf: 1st entry in m_order. Otherwise: index of the right child (the left child is the next node)
+        unsigned m_count; // leaf: # of entries in m_order. 0 if not a leaf
+    };
+    unsigned BuildNode(unsigned begin, unsigned end, const std::vector<BBox>& bounds, unsigned depth);
+    bool HitPrimitive(unsigned index, double x, double y, double dx, double dy, double max_distance, double& distance) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<unsigned> m_order; // indices of mirrors (then stencils) - in leaf order
+    unsigned m_depth; // of the deepest node (the root is 0) - NearestHit()'s stack holds up to m_depth+1 nodes
+    BBox m_bounds;
+    double m_epsilon; // hits closer than this (to the ray's start) are ignored
+};
+
+void MirrorScene::Build()
+{
+    const unsigned num_primitives = m_arcs.size() + m_stencils.size();
+    std::vector<BBox> bounds( num_primitives );
+    m_bounds = BBox();
+    for (unsigned ii=0; ii<num_primitives; ii++) {
+        if (ii < m_arcs.size()) bounds[ii] = m_arcs[ii].Bounds();
+        else {
+            bounds[ii].Update( m_stencils[ii - m_arcs.size()].first );
+            bounds[ii].Update( m_stencils[ii - m_arcs.size()].second );
+        }
+        m_bounds.Update( bounds[ii].min_pt );
+        m_bounds.Update( bounds[ii].max_pt );
+    }
+    m_epsilon = SmallValue * SmallValue * Max( 1.0, m_bounds.Diagonal() );
+
+    m_order.resize( num_primitives );
+    for (unsigned ii=0; ii<num_primitives; ii++) m_order[ii] = ii;
+    m_nodes.clear();
+    m_nodes.reserve( 2 * num_primitives );
+    m_depth = 0;
+    if (num_primitives) BuildNode( 0, num_primitives, bounds, 0 );
+}
+
+unsigned MirrorScene::BuildNode(unsigned begin, unsigned end, const std::vector<BBox>& bounds, unsigned depth)
+    // Splits m_order[begin,end) at the median (of the primitives' centers) along the longer axis.
+{
+    const unsigned max_leaf_size = 4;
+    m_depth = Max( m_depth, depth );
+    unsigned node_index = m_nodes.size();
+    m_nodes.push_back( Node() );
+    BBox box;
+    for (unsigned ii=begin; ii<end; ii++) {
+        box.Update( bounds[ m_order[ii] ].min_pt );
+        box.Update( bounds[ m_order[ii] ].max_pt );
+    }
+    m_nodes[node_index].m_min_x = box.MinX(); m_nodes[node_index].m_min_y = box.MinY();
+    m_nodes[node_index].m_max_x = box.MaxX(); m_nodes[node_index].m_max_y = box.MaxY();
+
+    if (end - begin <= max_leaf_size) {
+        m_nodes[node_index].m_first = begin;
+        m_nodes[node_index].m_count = end - begin;
+        return node_index;
+    }
+    bool split_x = (box.MaxX() - box.MinX()) >= (box.MaxY() - box.MinY());
+    unsigned middle = (begin + end) / 2;
+    std::nth_element( m_order.begin() + begin, m_order.begin() + middle, m_order.begin() + end,
+                      [&bounds, split_x](unsigned aa, unsigned bb) {
+                          return split_x ? (bounds[aa].MidX() < bounds[bb].MidX()) : (bounds[aa].MidY() < bounds[bb].MidY()); } );
+    BuildNode( begin, middle, bounds, depth+1 );
+    unsigned right = BuildNode( middle, end, bounds, depth+1 );
+    m_nodes[node_index].m_first = right;
+    m_nodes[node_index].m_count = 0;
+    return node_index;
+}
+
+bool MirrorScene::HitPrimitive(unsigned index, double x, double y, double dx, double dy, double max_distance, double& distance) const
+{
+    if (index >= m_arcs.size()) {
+        double fraction;
+        return RaySegmentHit( x, y, dx, dy, m_stencils[index - m_arcs.size()], distance, fraction ) &&
+               (distance > m_epsilon) && (distance < max_distance);
+    }
+    // Ray/circle (dx,dy is a unit vector) - then check that the hit is within the arc
+    const MirrorArc& arc = m_arcs[index];
+    double fx = x - arc.m_coc.x();
+    double fy = y - arc.m_coc.y();
+    double half_b = fx*dx + fy*dy;
+    double discriminant = half_b*half_b - (fx*fx + fy*fy - arc.m_radius*arc.m_radius);
+    if (discriminant < 0) return false;
+    double root = sqrt(discriminant);
+    double candidates[] = { -half_b - root, -half_b + root };
+    for (int cc=0; cc<2; cc++) {
+        if ((candidates[cc] <= m_epsilon) || (candidates[cc] >= max_distance)) continue;
+        if (arc.WithinArc( x + candidates[cc]*dx, y + candidates[cc]*dy )) {
+            distance = candidates[cc];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MirrorScene::NearestHit(double x, double y, double dx, double dy, double max_distance, double& distance, unsigned& index) const
+{
+    if (m_nodes.empty()) return false;
+    const double inv_dx = 1 / dx, inv_dy = 1 / dy; // may be infinite
+    bool found = false;
+    unsigned fixed_stack[64]; // (enough for any median-split tree - but a deeper one gets a stack on the heap)
+    std::vector<unsigned> heap_stack;
+    unsigned* stack = fixed_stack;
+    if (m_depth + 1 > sizeof(fixed_stack)/sizeof(fixed_stack[0])) {
+        heap_stack.resize( m_depth + 1 );
+        stack = &heap_stack[0];
+    }
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size) {
+        const Node& node = m_nodes[ stack[--stack_size] ];
+        // Slab test - does the ray enter the node's box before max_distance?
+        double t1 = (node.m_min_x - x) * inv_dx, t2 = (node.m_max_x - x) * inv_dx;
+        double t_near = Min(t1, t2), t_far = Max(t1, t2);
+        if (dx == 0) { t_near = -BadValue; t_far = ((x < node.m_min_x) || (x > node.m_max_x)) ? -BadValue : BadValue; }
+        t1 = (node.m_min_y - y) * inv_dy; t2 = (node.m_max_y - y) * inv_dy;
+        if (dy == 0) { t1 = -BadValue; t2 = ((y < node.m_min_y) || (y > node.m_max_y)) ? -BadValue : BadValue; }
+        t_near = Max( t_near, Min(t1, t2) );
+        t_far  = Min( t_far,  Max(t1, t2) );
+        if ((t_near > t_far) || (t_far < 0) || (t_near >= max_distance)) continue;
+
+        if (node.m_count) {
+            for (unsigned ii=node.m_first; ii<node.m_first+node.m_count; ii++) {
+                double hit_distance;
+                if (HitPrimitive( m_order[ii], x, y, dx, dy, max_distance, hit_distance )) {
+                    max_distance = distance = hit_distance;
+                    index = m_order[ii];
+                    found = true;
+                }
+            }
+        } else {
+            stack[stack_size++] = node.m_first;                          // right
+            stack[stack_size++] = unsigned(&node - &m_nodes[0]) + 1;     // left
+        }
+    }
+    return found;
+}
+
+TracedRay::RayStatus MirrorScene::Trace(unsigned arc_index, double target_normal_dir, double incident_dir,
+                                        double& reflect_dir, Point& exit_pt, unsigned& strikes) const
+    /* Forward-traces a ray from the sun (incident_dir) that targets mirror arc_index at target_normal_dir. Statuses are as
+     * ConcaveRayKernel(), with Obscured if anything (any mirror or stencil) shades the target, and Blocked if the reflected
+     * light is stopped by the back of a mirror or by a stencil. Reflections off the front of other mirrors are followed.
+     */
+{
+    const MirrorArc& target = m_arcs[arc_index];
+    double nx = cos( to_radians( target_normal_dir ) ), ny = sin( to_radians( target_normal_dir ) );
+    double dx = cos( to_radians( incident_dir ) ),      dy = sin( to_radians( incident_dir ) );
+    double x = target.m_coc.x() + target.m_radius * nx;
+    double y = target.m_coc.y() + target.m_radius * ny;
+    reflect_dir = BadValue;
+    strikes = 0;
+    exit_pt = Point(x, y);
+
+    if (dx*nx + dy*ny <= 0) return TracedRay::Convex; // from outside (the mirror's back)
+
+    // Shading - does anything lie between the sun and the target? (Start the ray from outside the whole scene)
+    double back_distance = m_bounds.Diagonal() + target.m_radius + 1;
+    double distance;
+    unsigned index;
+    if (NearestHit( x - back_distance*dx, y - back_distance*dy, dx, dy, back_distance - 2*m_epsilon, distance, index ))
+        return TracedRay::Obscured;
+
+    const unsigned loop_limit = dvo_quality->m_loop_limit;
+    for (strikes = 1; ; strikes++) {
+        double dot = dx*nx + dy*ny; // reflect
+        dx -= 2*dot*nx;
+        dy -= 2*dot*ny;
+        reflect_dir = NormalizeAngle( to_degrees( atan2( dy, dx ) ) );
+        exit_pt = Point(x, y);
+        if (! NearestHit( x, y, dx, dy, BadValue, distance, index )) break; // escapes
+        if (index >= m_arcs.size()) return TracedRay::Blocked; // stencil
+        const MirrorArc& arc = m_arcs[index];
+        x += distance * dx;
+        y += distance * dy;
+        nx = (x - arc.m_coc.x()) / arc.m_radius;
+        ny = (y - arc.m_coc.y()) / arc.m_radius;
+        if (dx*nx + dy*ny <= 0) return TracedRay::Blocked; // the back of a mirror
+        if (strikes >= loop_limit) return TracedRay::NStrikeOut;
+    }
+    return (strikes == 1) ? TracedRay::Unobscured : TracedRay::NStrike;
+}
+
+
+enum Output { // TheData::m_outputs - the stages of Calculate() whose results are consumed. The others are skipped.
+    OutRays         = 1,  // the forward (-nr) or reverse-traced rays - m_TopRays, m_BotRays, (convex) m_FanRays - and their counts
+    OutFocal        = 2,  // ref_width, ref_focal_d and ref_blur - the bounding boxes of the reflected rays' intersections
+    OutFocalPts     = 4,  // the intersection points themselves (-svg's focal points and -debug)
+    OutSolved       = 8,  // (convex) the three reverse-traced rays - the pupils and brightness (-pupil), -svg and -csv
+    OutSamples      = 16, // the -sun-samples and their histograms - flux_in, screen_flux, ff_w90, shading, ...
+    OutAll          = ~0u
+};
+
+class TheData { // Please come up with a better name
+    public:
+        // input data
+        double m_radius;
+        double m_sun_dir; // degrees
+        double m_sun_width_ang; // degrees;
+        double m_ray_tolerance; // degrees - if >0, forward-trace adaptively (-nr auto) rather than in uniform steps
+        bool m_convex_fan;      // (-nr given, for a convex mirror) also forward-trace a fan (TraceFan_Convex()) - else just the solved rays
+        unsigned m_sun_samples; // if >0, also forward-trace this many rays sampled from across the sun's disk (and the mirror)
+        SunShape m_sun_shape;   // the distribution of the m_sun_samples across the sun's width
+        uint64_t m_seed;        // for the m_sun_samples random numbers
+        unsigned m_flux_bins;   // if >0, histogram the m_sun_samples that reach m_screen into this many bins along it (-flux-bins)
+        unsigned m_farfield_bins; // if >0, histogram the reflected directions of the m_sun_samples into this many bins (-farfield)
+        double m_reflectivity;  // fraction of the light reflected at each strike on the mirror (for the m_sun_samples)
+        bool m_convolve;        // if true, trace the m_sun_samples from a point sun, and convolve the histograms with the sun's shape
+        double m_slope_error;   // (with m_convolve) standard deviation of the mirror's surface normal (degrees)
+        std::string m_gradient_parameter; // if not empty (-gradient), also calculate m_gradient - with respect to this SetParameter() name
+        bool m_single_precision; // (-precision float) trace and store the m_sun_samples in float (m_SampleRaysFloat)
+        unsigned m_lut_cells;    // if >0 (-lut), the m_sun_samples (single mirror) are looked up in a ReflectionLUT of this many cells each way
+        bool m_keep_sample_rays; // keep m_SampleRays after the histograms are built from them (else they're freed - see SunSampleMetrics())
+        unsigned m_outputs;      // the Output stages needed (by the reports, -svg, the -csv2 value, ...) - see OutputsFor()
+
+        
+// Concave - the following fields are applicable to CONCAVE mirrors only
+               // Limits a portion of the circle (i.e. arc-length)
+        bool m_IsConvex; // true=Convex, false=Concave
+        Point m_MirrorCOCPt; // mirror's center-of-curvature
+        double m_min_normal_dir; // min/max normal directions define the limits of the ARC
+        double m_max_normal_dir;
+
+        Point m_min_normal_pt;
+        Point m_max_normal_pt;
+        Point m_MidArcPt;
+
+        Segment m_screen;
+        std::deque< Segment > m_stencils;
+        std::list<Point> m_target_pts;
+        MirrorScene m_scene; // if not Empty() - a mirror-field of many mirrors (-mirror, -mirror-row) replaces the single mirror above
+        ProfileMirror m_profile; // if not Empty() - a mirror with a tabulated profile (-profile) replaces the single mirror above
+
+// Convex - the following fields are applicable to CONVEX mirrors only - DVO 12/16/2018: why is that a restriction?
+        double m_distance; // from observer to mirror's COC
+		Point m_ObserverPt;
+
+        // Results (output data)
+        //
+        std::deque<TracedRay> m_TopRays; // indexed in steps from m_min_normal_dir to m_max_normal_dir.
+        std::deque<TracedRay> m_BotRays;
+
+        unsigned m_CountOfObscuredRays; // # of m_TopRays+m_BotRays whose reflected rays are invalid (see TracedRay::m_ray_status)
+        unsigned m_NumRayPositions; // # of points along the arc that were forward-traced (each for both the top and bot rays)
+        double m_converge_error; // Set by CalculateConverged() - the relative change in the metrics at the final doubling of the ray count
+        double m_quality_error; // degrees - the estimated error of the solved (reverse-traced) and fast-trig directions (see -quality)
+        std::map<std::string,double> m_gradient; // d(GetValue() name)/d(m_gradient_parameter) - by automatic differentiation (see Dual)
+
+        RayBatch m_SampleRays; // m_sun_samples rays - from across the sun's disk, aimed at random points along the mirror.
+        FloatRayBatch m_SampleRaysFloat; // (m_single_precision) instead of m_SampleRays
+        unsigned m_num_samples;   // # of m_SampleRays traced (they're usually freed once the metrics below are built)
+        double m_sample_flux_in;  // total m_weight of the m_SampleRays that reach the concave side of the mirror
+        double m_sample_flux_out; // total m_weight of the m_SampleRays that are reflected
+        double m_sample_flux_shaded;  // (m_scene) total m_weight of the m_SampleRays whose target mirror is shaded (TracedRay::Obscured)
+        double m_sample_flux_blocked; // (m_scene) total m_weight of the m_SampleRays that are Blocked after reflection
+        std::vector<double> m_screen_flux; // m_flux_bins - the reflected m_SampleRays' m_weight reaching each bin along m_screen
+        double m_screen_flux_total;        // sum of m_screen_flux
+
+        std::vector<double> m_farfield;    // m_farfield_bins - the reflected m_SampleRays' m_out_weight by reflected direction
+        double m_farfield_center;          // the (weighted, circular) mean reflected direction. degrees
+        double m_farfield_start;           // direction of the start of m_farfield[0] - relative to m_farfield_center. degrees
+        double m_farfield_bin_width;       // degrees
+        double m_farfield_w50;             // angular widths containing the central 50%, 90% and 99% of the reflected flux. degrees
+        double m_farfield_w90;
+        double m_farfield_w99;
+
+        std::deque<Point> m_TopIntersectionPts; // (N-1)squared - intersection points of the reflected Top rays
+        std::deque<Point> m_BotIntersectionPts; // (N-1)squared - intersection points of the reflected Bot rays
+
+        BBox m_TopIntersectionBBox; // bounding-box of all m_TopIntersectionPts
+        BBox m_BotIntersectionBBox; // bounding-box of all m_BotIntersectionPts
+
+        double m_reflected_rays_width_ang;
+        double m_reflected_focal_distance;
+        double m_reflected_blur; // a distance across the BBox
+        double m_reflected_spread; // (convex) angular width of the fan of reflected rays (m_FanRays). degrees
+
+        RayBatch m_FanRays; // (convex) forward-traced fan (-nr) across the sunlit part of the arc - the top rays, then the bot rays
+
+		// Tangent (light ray that reaches observer that skims the mirror)
+		double m_ObserverTangentAng;  // from observer to tangent point. 0 is horizontal (>0 is up)
+		double m_NormalTangentAng; // From center of mirror
+		Point m_TangentPt; // On mirror
+
+
+		double m_ObserverReflectedSunBot; // Sun's bottom
 		double m_SunBotAng;
 		Point m_SunBotMirrorPt;
 
@@ -667,6 +2079,21 @@ class TheData { // Please come up with a better name
             m_radius(BadValue),
             m_sun_dir(BadValue),
             m_sun_width_ang(0.5),
+            m_ray_tolerance(0),
+            m_convex_fan(false),
+            m_sun_samples(0),
+            m_sun_shape(),
+            m_seed(1),
+            m_flux_bins(0),
+            m_farfield_bins(0),
+            m_reflectivity(1),
+            m_convolve(false),
+            m_slope_error(0),
+            m_gradient_parameter(),
+            m_single_precision(false),
+            m_lut_cells(0),
+            m_keep_sample_rays(false),
+            m_outputs(OutAll),
 
             m_IsConvex(false),
             m_MirrorCOCPt(),
@@ -679,6 +2106,8 @@ class TheData { // Please come up with a better name
             m_screen(),
             m_stencils(),
             m_target_pts(),
+            m_scene(),
+            m_profile(),
 
             m_distance(BadValue),
             m_ObserverPt(),
@@ -686,6 +2115,26 @@ class TheData { // Please come up with a better name
             m_TopRays(),
             m_BotRays(),
             m_CountOfObscuredRays(0),
+            m_NumRayPositions(0),
+            m_converge_error(BadValue),
+            m_quality_error(0),
+            m_gradient(),
+            m_SampleRays(),
+            m_SampleRaysFloat(),
+            m_num_samples(0),
+            m_sample_flux_in(BadValue),
+            m_sample_flux_out(BadValue),
+            m_sample_flux_shaded(BadValue),
+            m_sample_flux_blocked(BadValue),
+            m_screen_flux(),
+            m_screen_flux_total(BadValue),
+            m_farfield(),
+            m_farfield_center(BadValue),
+            m_farfield_start(BadValue),
+            m_farfield_bin_width(BadValue),
+            m_farfield_w50(BadValue),
+            m_farfield_w90(BadValue),
+            m_farfield_w99(BadValue),
 
             m_TopIntersectionPts(),
             m_BotIntersectionPts(),
@@ -694,6 +2143,8 @@ class TheData { // Please come up with a better name
             m_reflected_rays_width_ang(BadValue),
             m_reflected_focal_distance(BadValue),
             m_reflected_blur(BadValue),
+            m_reflected_spread(BadValue),
+            m_FanRays(),
 
             m_ObserverTangentAng(BadValue),
             m_NormalTangentAng(BadValue),
@@ -719,13 +2170,21 @@ class TheData { // Please come up with a better name
         void Dump(FILE *fout=stdout) const;
 
         void Calculate(int num_rays, int do_pupil);
+        bool CalculateConverged(int start_rays, int max_rays, double tolerance, int do_pupil); // returns true if converged
 
-        bool GenSVG_Concave(FILE *fout, double offset_X, double offset_Y, const std::string& title, bool first_call=1, bool last_call=1, int animate=0, int animate_interval_ms=250, bool do_boxes=1, bool focal_pts=1) const;
+        bool GenSVG_Concave(FILE *fout, double offset_X, double offset_Y, const std::string& title, int& ray_index, bool first_call=1, bool last_call=1, int animate=0, int animate_interval_ms=250, bool do_boxes=1, bool focal_pts=1) const;
 		bool GenSVG_Convex (FILE *fout, double offset_X, double offset_Y, bool first_call=1, bool last_call=1, int animate=0) const;
 
         void RayReport(FILE *fout=stdout, unsigned level=0) const;
 
         double GetValue(const std::string& name) const;
+        double GetValue(const std::string& name, bool& known) const; // known=false (and BadValue) for an unrecognized name - quietly
+        static unsigned OutputsFor(const std::string& name); // the Output stages that GetValue(name) needs
+        bool SetParameter(const std::string& name, double value); // the inverse of GetValue() - for the input data. Returns success
+        static bool CanSetParameter(const std::string& name); // is name one of SetParameter()'s names?
+        void DefaultSunSamples(); // without -sun-samples, the outputs that are built from the sun samples get 100000 of them
+        void ScreenFluxReport(FILE *fout, int case_index, bool header) const; // CSV - one line per m_screen_flux bin (header: and 1st, the header)
+        void FarFieldReport(FILE *fout, int case_index, bool header) const;   // CSV - one line per m_farfield bin (header: as above)
 
         TheData& operator=(const TheData&other);
 
@@ -734,7 +2193,224 @@ class TheData { // Please come up with a better name
     private:
         void Calculate_Concave(int num_rays, int do_pupil); // forward-trace if num_rays>0, reverse-trace if num_rays==0
         void Calculate_Convex(int num_rays, int do_pupil);
+        void Calculate_Scene();
+
+        void TraceForwardPair(double normal_dir, TracedRay& tr_top, TracedRay& tr_bot) const;
+        void TraceFan_Convex(int num_rays);
+        void ReflectedRayMetrics();
+        double GradientSeed(const std::string& input) const; // d(input)/d(m_gradient_parameter)
+        void CalculateGradient_Concave();
+        void CalculateGradient_Convex(int do_pupil);
+        void SunSampleMetrics();
+        void TraceSunSamples();
+        template <typename Real> void TraceSunSamples(BasicRayBatch<Real>& batch);
+        size_t NumSampleRays() const { return m_num_samples; }
+        void ScreenHits(const Segment& target, std::vector<double>& bins, double& sum_weight, double& sum_distance, double& sum_cos) const;
+        template <typename Real> void ScreenHits(const BasicRayBatch<Real>& batch, const Segment& target, std::vector<double>& bins,
+                                                 double& sum_weight, double& sum_distance, double& sum_cos) const;
+        void ScreenFluxHistogram();
+        void FarFieldHistogram();
+        template <typename Real> void FarFieldHistogram(const BasicRayBatch<Real>& batch);
+        void AdaptiveForwardTrace(double normal1, const TracedRay& top1, const TracedRay& bot1,
+                                  double normal2, const TracedRay& top2, const TracedRay& bot2, int depth);
+};
+
+struct ConvexBatch
+    /* Structure-of-arrays inputs and results for reverse-tracing many convex-mirror cases at once (see SolveConvexBatch()).
+     * Each case has its own observer position and sun angle. The mirror (radius, sun width) is shared by all of them - and
+     * its center-of-curvature is at (0,0). Results are BadValue (and m_success is 0) where a search failed - or where the
+     * observer is not outside the mirror.
+     */
+{
+    // Inputs
+    std::vector<double> m_observer_x;
+    std::vector<double> m_observer_y;
+    std::vector<double> m_sun_dir;
+    // Results (as the corresponding TheData members - in the same frame as the inputs)
+    std::vector<unsigned char> m_success;
+    std::vector<double> m_normal_mid;    // direction (from the mirror's COC) of m_SunMidMirrorPt
+    std::vector<double> m_observed_mid;  // m_ObserverReflectedSunMid
+    std::vector<double> m_observed_bot;  // m_ObserverReflectedSunBot
+    std::vector<double> m_observed_top;  // m_ObserverReflectedSunTop
+    std::vector<double> m_mirror_x;      // m_SunMidMirrorPt
+    std::vector<double> m_mirror_y;
+    std::vector<double> m_brightness;    // m_Brightness (pupils: entrance/exit)
+    std::vector<double> m_brightness2;   // m_Brightness2 (apparent width of the reflected sun / sun width)
+    // The mirror - shared by all the cases
+    double m_radius;
+    double m_sun_width_ang;
+
+    ConvexBatch() : m_radius(BadValue), m_sun_width_ang(0.5) {};
+
+    size_t Size() const { return m_observer_x.size(); }
+    void Resize(size_t size) {
+        m_observer_x.resize(size);  m_observer_y.resize(size);  m_sun_dir.resize(size);
+        m_success.resize(size);     m_normal_mid.resize(size);
+        m_observed_mid.resize(size); m_observed_bot.resize(size); m_observed_top.resize(size);
+        m_mirror_x.resize(size);    m_mirror_y.resize(size);    m_brightness.resize(size);  m_brightness2.resize(size);
+    }
+    bool Solve(size_t index, TheData& scratch, double start_normal = BadValue, double start_window = 1.0);
+};
+
+void SolveConvexBatch(const TheData& mirror, ConvexBatch& batch); // Defined with the original Convex code (near the end of this file)
+
+struct EventFinder
+    /* -find-event: finds the values of m_parameter (a SetParameter() name) between m_from and m_to at which m_metric
+     * (a GetValue() name) changes. With m_threshold, a change is m_metric crossing the threshold; without one, any change
+     * of value (intended for counts - such as num_nstrike). In either case, m_metric becoming undefined is also a change.
+     * A coarse scan (of m_intervals) brackets the changes - one per interval - and each is then bisected to about 1e-10
+     * of the range.
+     */
+{
+    struct Event { double m_low, m_high, m_low_value, m_high_value; int m_evaluations; };
+
+    std::string m_parameter;
+    double m_from, m_to;
+    std::string m_metric;
+    double m_threshold; // BadValue if none
+    int m_intervals;
+
+    EventFinder() : m_from(0), m_to(0), m_threshold(BadValue), m_intervals(20) {};
+    bool Defined() const { return !m_parameter.empty(); }
+    std::vector<Event> Find(const TheData& settings, int num_rays, int do_pupil, int& evaluations) const;
+    int Run(const TheData& settings, int num_rays, int do_pupil) const; // Find() and print the events
+
+    private:
+        double Evaluate(const TheData& settings, double parameter_value, int num_rays, int do_pupil) const;
+        double Class(double value) const // values of the same class are 'unchanged'
+            { return (value == BadValue) ? BadValue : (m_threshold == BadValue) ? value : (value >= m_threshold) ? 1 : 0; }
+};
+
+struct AdaptiveSweep
+    /* -adaptive: a sweep over the -iterate parameters (any number of them) that starts with the -iterate grid, then
+     * recursively halves - in every dimension - each cell whose corners' m_metric values differ by more than m_tolerance
+     * (or are only partly defined), up to m_max_depth times. The samples are points on the lattice of the smallest possible
+     * cells - so neighbouring cells share their samples. Each round of new samples is calculated in parallel (see -threads).
+     */
+{
+    typedef std::vector<long> LatticePt; // in units of the smallest possible cell
+    typedef std::pair<int, LatticePt> Cell; // depth and lowest corner
+
+    std::vector<std::string> m_parameters;      // SetParameter() names - one per dimension
+    std::vector< std::vector<double> > m_axes;  // the -iterate (coarse) values - for each dimension
+    std::string m_metric;
+    std::vector<std::string> m_values;          // GetValue() names kept for each sample - m_metric is the first
+    double m_tolerance;
+    int m_max_depth;
+
+    std::map< LatticePt, std::vector<double> > m_samples;
+    std::set<Cell> m_refined;                   // the cells that were halved
+    int m_depth_reached;
+
+    AdaptiveSweep() : m_tolerance(0), m_max_depth(4), m_depth_reached(0) {};
+    bool Defined() const { return !m_metric.empty(); }
+    int Run(const TheData& settings, int num_rays, int do_pupil);
+    double Coordinate(size_t dimension, long lattice) const; // the parameter's value
+    double Resample(const LatticePt& point, size_t value_index) const; // multilinear within the smallest cell containing point
+    void SampleReport(FILE *fout) const; // the scattered samples - as CSV
+    bool PivotReport(const std::string& row_param, const std::string& col_param, const std::string& value_param) const; // for -csv2
+
+    private:
+        long Scale() const { return 1L << m_max_depth; }
+        std::vector<LatticePt> CellPoints(const Cell& cell, int divisions) const; // the (divisions+1)^N points of the cell
+        bool NeedsRefinement(const Cell& cell) const;
+        void Evaluate(const TheData& settings, const std::vector<LatticePt>& points, int num_rays, int do_pupil);
+};
+
+struct ParameterSampler
+    /* -sample: draws m_count points over the ranges of the -iterate parameters (any subset of SetParameter()'s names), either
+     * from the Sobol sequence or as a Latin hypercube (each parameter's range split into m_count strata - one sample in each -
+     * with randomly paired strata and a random position within each, from m_seed). The cases are calculated in chunks - each
+     * chunk's cases in parallel (see -threads) - and each of m_values (GetValue() names) written as a row of a long-format CSV table.
+     */
+{
+    enum Method { Sobol, LatinHypercube };
+
+    Method m_method;
+    size_t m_count;
+    uint64_t m_seed;
+    std::vector<std::string> m_parameters;
+    std::vector< std::pair<double,double> > m_ranges;   // from, to - for each parameter
+    std::vector<std::string> m_values;
+
+    ParameterSampler() : m_method(Sobol), m_count(0), m_seed(1) {};
+    bool Defined() const { return m_count > 0; }
+    int Run(const TheData& settings, int num_rays, int do_pupil, FILE *fout);
+    double UnitCoordinate(size_t sample, size_t dimension) const; // in [0,1) - after Prepare()
+    bool Prepare(); // false if there are too many parameters (Sobol)
+
+    private:
+        std::vector< std::vector<uint32_t> > m_strata; // LatinHypercube: [dimension][sample]
+};
+
+struct Optimizer
+    /* -optimize: minimizes a cost - for Run(), m_metric (a GetValue() name; negated with m_maximize) - over the -iterate parameters,
+     * each bounded by its first and last values. By Nelder-Mead, on the unit cube of the bounds (points outside it are clamped onto
+     * its faces). The evaluations are cached - clamping often repeats a point - and each iteration's candidates along the line
+     * through the worst point (reflection, expansion and the two contractions) are evaluated together, in parallel (see -threads),
+     * as are a shrink's. A candidate evaluated ahead of need joins m_trace (and counts) only once the method uses it - so the
+     * evaluations, and the result, don't depend on -threads. Stops after about m_max_evaluations, or once the simplex is smaller
+     * than m_tolerance (of the bounds).
+     */
+{
+    struct Evaluation {
+        std::vector<double> m_parameters;
+        double m_cost; // HUGE_VAL if undefined
+        int m_iteration;
+    };
+
+    std::string m_metric;
+    bool m_maximize;
+    int m_max_evaluations;
+    double m_tolerance;
+    std::vector<std::string> m_parameters;
+    std::vector< std::pair<double,double> > m_ranges;   // the bounds (from, to) - for each parameter
+    std::vector<Evaluation> m_trace;                     // every evaluation, in order
+    size_t m_best;                                       // in m_trace
+    int m_iterations;
+    int m_cache_hits;
+
+    Optimizer() : m_maximize(false), m_max_evaluations(300), m_tolerance(1e-4), m_best(0), m_iterations(0), m_cache_hits(0) {};
+    bool Defined() const { return !m_metric.empty(); }
+    template <typename Cost> void Minimize(Cost cost); // cost(parameters) must be thread-safe
+    int Run(const TheData& settings, int num_rays, int do_pupil);
+    void TraceReport(FILE *fout) const;
 
+    private:
+        std::map< std::vector<double>, size_t > m_cache; // unit point -> m_trace
+        std::map< std::vector<double>, Evaluation > m_speculated; // unit point -> an evaluation not (yet) used
+        template <typename Cost> void Evaluate(const std::vector< std::vector<double> >& points, std::vector<double>& costs, Cost& cost,
+                                               bool speculative = false); // speculative: into m_speculated (costs unset)
+};
+
+enum ArgStatus { ArgUnknown=0, ArgUsed, ArgBad };
+
+ArgStatus ParseCaseArgument(int argc, const char* argv[], int& ii, TheData& td); // the case options - for main() and -serve
+ArgStatus ParseDimensionArgument(int argc, const char* argv[], int& ii, TheData& td); // -r, -d, -sa, ... - for -serve and -jobs
+ArgStatus ParseRunArgument(int argc, const char* argv[], int& ii, TheData& td, int& num_rays, const QualityTier*& quality); // -nr, -quality
+bool ParseJobs(const char* data, size_t size, const char* source, const TheData& base, std::deque<TheData>& cases); // -jobs
+bool LoadJobs(const char* filename, const TheData& base, std::deque<TheData>& cases);
+
+struct CaseServer
+    /* -serve: a long-lived process for many small cases. Reads jobs from fin - one per line: [<id>] <options> - and writes
+     * one line per job to fout: <id> name=value ... (or <id> ERROR ...). The jobs run on a pool of worker threads (see -threads),
+     * each job single-threaded; the results are written in the jobs' order, each as soon as it (and those before it) are done.
+     * A job's options - the case's options of the command line (-r, -d, -sa, -nr, -sun-samples, ..., and -values <name,...>)
+     * - start from m_base (the command line's case). Blank lines and lines starting with # are skipped. The id defaults to
+     * the line number.
+     */
+{
+    TheData m_base;
+    int m_num_rays;
+    int m_do_pupil;
+    int m_reverse;
+    std::vector<std::string> m_values; // the GetValue() names written for each job (unless the job has -values)
+    size_t m_jobs;   // counts - after Run()
+    size_t m_errors;
+
+    CaseServer() : m_base(), m_num_rays(3), m_do_pupil(0), m_reverse(0), m_values(), m_jobs(0), m_errors(0) {}
+    bool Job(const std::string& line, size_t line_number, std::string& result) const; // calculates one job. Returns success
+    int Run(FILE *fin, FILE *fout);
 };
 
 TheData& TheData::operator=(const TheData& other)
@@ -744,6 +2420,21 @@ TheData& TheData::operator=(const TheData& other)
     m_radius = other.m_radius;
     m_sun_dir = other.m_sun_dir;
     m_sun_width_ang = other.m_sun_width_ang;
+    m_ray_tolerance = other.m_ray_tolerance;
+    m_convex_fan = other.m_convex_fan;
+    m_sun_samples = other.m_sun_samples;
+    m_sun_shape = other.m_sun_shape;
+    m_seed = other.m_seed;
+    m_flux_bins = other.m_flux_bins;
+    m_farfield_bins = other.m_farfield_bins;
+    m_reflectivity = other.m_reflectivity;
+    m_convolve = other.m_convolve;
+    m_slope_error = other.m_slope_error;
+    m_gradient_parameter = other.m_gradient_parameter;
+    m_single_precision = other.m_single_precision;
+    m_lut_cells = other.m_lut_cells;
+    m_keep_sample_rays = other.m_keep_sample_rays;
+    m_outputs = other.m_outputs;
 
     m_IsConvex = other.m_IsConvex;
     m_MirrorCOCPt = other.m_MirrorCOCPt;
@@ -756,6 +2447,8 @@ TheData& TheData::operator=(const TheData& other)
     m_screen = other.m_screen;
     m_stencils = other.m_stencils;
     m_target_pts = other.m_target_pts;
+    m_scene = other.m_scene;
+    m_profile = other.m_profile;
 
     m_distance = other.m_distance;
     m_ObserverPt = other.m_ObserverPt;
@@ -763,6 +2456,24 @@ TheData& TheData::operator=(const TheData& other)
     m_TopRays = other.m_TopRays;
     m_BotRays = other.m_BotRays;
     m_CountOfObscuredRays = other.m_CountOfObscuredRays;
+    m_NumRayPositions = other.m_NumRayPositions;
+    m_converge_error = other.m_converge_error;
+    m_quality_error = other.m_quality_error;
+    m_gradient = other.m_gradient;
+    m_num_samples = other.m_num_samples;
+    m_sample_flux_in = other.m_sample_flux_in;
+    m_sample_flux_out = other.m_sample_flux_out;
+    m_sample_flux_shaded = other.m_sample_flux_shaded;
+    m_sample_flux_blocked = other.m_sample_flux_blocked;
+    m_screen_flux = other.m_screen_flux;
+    m_screen_flux_total = other.m_screen_flux_total;
+    m_farfield = other.m_farfield;
+    m_farfield_center = other.m_farfield_center;
+    m_farfield_start = other.m_farfield_start;
+    m_farfield_bin_width = other.m_farfield_bin_width;
+    m_farfield_w50 = other.m_farfield_w50;
+    m_farfield_w90 = other.m_farfield_w90;
+    m_farfield_w99 = other.m_farfield_w99;
 
     m_TopIntersectionPts = other.m_TopIntersectionPts;
     m_BotIntersectionPts = other.m_BotIntersectionPts;
@@ -771,6 +2482,8 @@ TheData& TheData::operator=(const TheData& other)
     m_reflected_rays_width_ang = other.m_reflected_rays_width_ang;
     m_reflected_focal_distance = other.m_reflected_focal_distance;
     m_reflected_blur = other.m_reflected_blur;
+    m_reflected_spread = other.m_reflected_spread;
+    m_FanRays = other.m_FanRays;
 
     m_ObserverTangentAng = other.m_ObserverTangentAng;
     m_NormalTangentAng = other.m_NormalTangentAng;
@@ -788,6 +2501,7 @@ TheData& TheData::operator=(const TheData& other)
     m_Pupil_Exit = other.m_Pupil_Exit;
     m_Brightness = other.m_Brightness;
     m_Brightness2 = other.m_Brightness2;
+    return *this;
 }
 
 void TheData::InputDump(FILE *fout) const
@@ -816,6 +2530,21 @@ void TheData::DuplicateSettings(const TheData& other)
     m_radius = other.m_radius;
     m_sun_dir = other.m_sun_dir;
     m_sun_width_ang = other.m_sun_width_ang;
+    m_ray_tolerance = other.m_ray_tolerance;
+    m_convex_fan = other.m_convex_fan;
+    m_sun_samples = other.m_sun_samples;
+    m_sun_shape = other.m_sun_shape;
+    m_seed = other.m_seed;
+    m_flux_bins = other.m_flux_bins;
+    m_farfield_bins = other.m_farfield_bins;
+    m_reflectivity = other.m_reflectivity;
+    m_convolve = other.m_convolve;
+    m_slope_error = other.m_slope_error;
+    m_gradient_parameter = other.m_gradient_parameter;
+    m_single_precision = other.m_single_precision;
+    m_lut_cells = other.m_lut_cells;
+    m_keep_sample_rays = other.m_keep_sample_rays;
+    m_outputs = other.m_outputs;
 
     m_IsConvex = other.m_IsConvex;
     m_MirrorCOCPt = other.m_MirrorCOCPt;
@@ -828,6 +2557,8 @@ void TheData::DuplicateSettings(const TheData& other)
     m_screen = other.m_screen;
     m_stencils = other.m_stencils;
     m_target_pts = other.m_target_pts;
+    m_scene = other.m_scene;
+    m_profile = other.m_profile;
     m_distance = other.m_distance;
     m_ObserverPt = other.m_ObserverPt;
 }
@@ -843,6 +2574,16 @@ void TheData::Dump(FILE *fout) const
         fprintf(fout, "Sun's Mid: Ang=%g, Observer (to reflection)=%g, Reflection Point=(%g,%g)\n", m_SunMidAng, m_ObserverReflectedSunMid, m_SunMidMirrorPt.x(), m_SunMidMirrorPt.y() );
         fprintf(fout, "Sun's Top: Ang=%g, Observer (to reflection)=%g, Reflection Point=(%g,%g)\n", m_SunTopAng, m_ObserverReflectedSunTop, m_SunTopMirrorPt.x(), m_SunTopMirrorPt.y() );
         fprintf(fout, "Pupils=%g/%g, Brightness=%g,%g Obsever Angle=%g\n", m_Pupil_Entrance, m_Pupil_Exit, m_Brightness, m_Brightness2, m_ObserverReflectedSunTop-m_ObserverReflectedSunBot);
+        if (m_FanRays.Size())
+            fprintf(fout, "Forward fan: %u rays, spread=%g (deg), width angle=%g (deg), virtual focal distance=%g, envelope blur=%g\n",
+                m_NumRayPositions, m_reflected_spread, m_reflected_rays_width_ang, m_reflected_focal_distance, m_reflected_blur );
+    } else if (!m_scene.Empty() || !m_profile.Empty()) { // Mirror-field or profile mirror
+        if (!m_scene.Empty())
+            fprintf(fout, "Mirror-field: %u mirrors, %u stencils\n", unsigned(m_scene.m_arcs.size()), unsigned(m_stencils.size()) );
+        else
+            fprintf(fout, "Profile mirror: %u points, length=%g\n", m_profile.NumPoints(), m_profile.Length() );
+        fprintf(fout,"Sun samples: %u (%s sun%s, seed=%llu), flux in=%g, shaded=%g, blocked=%g, flux reflected=%g\n", unsigned(NumSampleRays()),
+            Name(m_sun_shape.m_type), m_convolve ? " by convolution" : "", (unsigned long long) m_seed, m_sample_flux_in, m_sample_flux_shaded, m_sample_flux_blocked, m_sample_flux_out );
     } else { // Concave
         fprintf(fout, "ConcaveMirror: (%g,%g)\n", m_MirrorCOCPt.x(), m_MirrorCOCPt.y() );
         for (auto it=m_TopRays.begin(); it != m_TopRays.end(); ++it) {
@@ -867,12 +2608,31 @@ void TheData::Dump(FILE *fout) const
             );
         fprintf(fout,"Reflected Rays width angle=%g (deg), focal distance=%g, blur=%g, #obscured rays=%d\n",
             m_reflected_rays_width_ang, m_reflected_focal_distance, m_reflected_blur, m_CountOfObscuredRays );
+        if (NumSampleRays())
+            fprintf(fout,"Sun samples: %u (%s sun%s, seed=%llu), flux in=%g, flux reflected=%g\n", unsigned(NumSampleRays()),
+                Name(m_sun_shape.m_type), m_convolve ? " by convolution" : "", (unsigned long long) m_seed, m_sample_flux_in, m_sample_flux_out );
     }
+    if (m_screen_flux.size())
+        fprintf(fout,"Screen flux: %u bins, total=%g, peak concentration=%g\n", unsigned(m_screen_flux.size()),
+            m_screen_flux_total, GetValue("screen_peak") );
+    if (m_farfield.size())
+        fprintf(fout,"Far-field: %u bins of %g degrees, center=%g, widths: 50%%=%g, 90%%=%g, 99%%=%g degrees\n", unsigned(m_farfield.size()),
+            m_farfield_bin_width, m_farfield_center, m_farfield_w50, m_farfield_w90, m_farfield_w99 );
 }
 
 double TheData::GetValue(const std::string& name) const
+{
+    bool known;
+    double value = GetValue( name, known );
+    if (known) return value;
+fprintf(stderr,"ERROR: %s(%s): Unrecognized parameter name.\n", __func__, name.c_str());
+    return 0;
+}
+
+double TheData::GetValue(const std::string& name, bool& known) const
     // DVO HELP - needs to be updated for m_TopRays and m_BotRays.
 {
+    known = true;
     if (name == "radius")           return m_radius;
     if (name == "distance")         return m_distance;
     if (name == "sun_width")        return m_sun_width_ang;
@@ -883,9 +2643,33 @@ double TheData::GetValue(const std::string& name) const
     if (name == "ref_focal_d")      return m_reflected_focal_distance;
     if (name == "ref_focal_p")      return 100 * (m_reflected_focal_distance / (m_radius/2)) ;
     if (name == "ref_blur")         return m_reflected_blur;
+    if (name == "ref_spread")       return m_reflected_spread;
     if (name == "min_normal")       return m_min_normal_dir;
     if (name == "max_normal")       return m_max_normal_dir;
     if (name == "mirror_width")     return m_max_normal_dir - m_min_normal_dir;
+    if (name == "num_rays")         return m_NumRayPositions;
+    if (name == "converge_err")     return m_converge_error;
+    if (name == "quality_err")      return m_quality_error;
+    if (name.compare(0, 2, "d_") == 0) { // -gradient
+                                      auto found = m_gradient.find( name.substr(2) );
+                                      return (found == m_gradient.end()) ? BadValue : found->second;
+                                    }
+    if (name == "num_samples")      return NumSampleRays();
+    if (name == "flux_in")          return m_sample_flux_in;
+    if (name == "flux_out")         return m_sample_flux_out;
+    if (name == "num_mirrors")      return m_scene.m_arcs.size();
+    if (name == "shading")          return ((m_sample_flux_shaded == BadValue) || !(m_sample_flux_in > 0)) ? BadValue : m_sample_flux_shaded / m_sample_flux_in;
+    if (name == "blocking")         return ((m_sample_flux_blocked == BadValue) || !(m_sample_flux_in > 0)) ? BadValue : m_sample_flux_blocked / m_sample_flux_in;
+    if (name == "screen_flux")      return m_screen_flux_total;
+    if (name == "ff_center")        return m_farfield_center;
+    if (name == "ff_w50")           return m_farfield_w50;
+    if (name == "ff_w90")           return m_farfield_w90;
+    if (name == "ff_w99")           return m_farfield_w99;
+    if (name == "screen_peak")      { // the highest flux density along the screen - relative to the direct sun's
+                                      if (m_screen_flux.empty()) return BadValue;
+                                      double bin_length = Distance(m_screen.first, m_screen.second) / m_screen_flux.size();
+                                      return *std::max_element(m_screen_flux.begin(), m_screen_flux.end()) / bin_length;
+                                    }
 
 	if (name == "pupil")			return m_Pupil_Entrance;
 	if (name == "pupil1")			return m_Pupil_Entrance;
@@ -893,8 +2677,61 @@ double TheData::GetValue(const std::string& name) const
 	if (name == "brightness")		return m_Brightness;
 	if (name == "brightness2")		return m_Brightness2;
 
-fprintf(stderr,"ERROR: %s(%s): Unrecognized parameter name.\n", __func__, name.c_str());
-    return 0;
+    if ((name == "num_reflected") || (name == "num_nstrike")) { // counts of the forward-traced rays (-nr)
+        bool nstrike_only = (name == "num_nstrike");
+        unsigned count = 0;
+        const std::deque<TracedRay>* traced_rays[] = { &m_TopRays, &m_BotRays };
+        for (int tri = 0; tri < 2; tri++)
+            for (auto it = traced_rays[tri]->begin(); it != traced_rays[tri]->end(); ++it)
+                if (nstrike_only ? (it->m_ray_status == TracedRay::NStrike || it->m_ray_status == TracedRay::NStrikeOut)
+                                 : (it->m_ray_status >= TracedRay::NStrike)) count++;
+        for (size_t ii=0; ii<m_FanRays.Size(); ii++)
+            if (nstrike_only ? (m_FanRays.m_strikes[ii] > 1) : m_FanRays.Reflected(ii)) count++;
+        return count;
+    }
+
+    known = false;
+    return BadValue;
+}
+
+unsigned TheData::OutputsFor(const std::string& name)
+{
+    if ((name == "radius") || (name == "distance") || (name == "sun_width") || (name == "sun_a") || (name == "sun_A")
+        || (name == "min_normal") || (name == "max_normal") || (name == "mirror_width") || (name == "num_mirrors")) return 0; // inputs
+    if ((name == "ref_width") || (name == "ref_width_p") || (name == "ref_focal_d") || (name == "ref_focal_p") || (name == "ref_blur")
+        || (name == "converge_err")) return OutRays | OutFocal;
+    if ((name == "ref_spread") || (name == "num_rays") || (name == "num_reflected") || (name == "num_nstrike")) return OutRays;
+    if ((name == "num_samples") || (name == "flux_in") || (name == "flux_out") || (name == "shading") || (name == "blocking")
+        || (name == "screen_flux") || (name == "screen_peak") || (name.compare(0, 3, "ff_") == 0)) return OutSamples;
+    if ((name.compare(0, 5, "pupil") == 0) || (name.compare(0, 10, "brightness") == 0)) return OutSolved;
+    return OutAll; // quality_err (from every stage), d_ (-gradient), ...
+}
+
+bool TheData::SetParameter(const std::string& name, double value)
+{
+         if (name == "radius")          m_radius = value;
+    else if (name == "distance")        m_distance = value;
+    else if (name == "sun_width")       m_sun_width_ang = value;
+    else if (name == "sun_a")           m_sun_dir = value;
+    else if (name == "sun_A")           m_sun_dir = value + 180;
+    else if (name == "min_normal")      m_min_normal_dir = value;
+    else if (name == "max_normal")      m_max_normal_dir = value;
+    else if (name == "mirror_width")    { m_max_normal_dir = 270 + value/2; m_min_normal_dir = 270 - value/2; }
+    else return false;
+    return true;
+}
+
+bool TheData::CanSetParameter(const std::string& name)
+{
+    TheData probe;
+    return probe.SetParameter( name, 0 );
+}
+
+void TheData::DefaultSunSamples()
+    // The screen and far-field histograms, and the mirror-fields and profile mirrors, are all built from the sun samples
+{
+    if ((m_flux_bins || m_farfield_bins || !m_scene.Empty() || !m_profile.Empty()) && !m_sun_samples)
+        m_sun_samples = 100000;
 }
 
 bool TheData::CheckInputs() const
@@ -920,7 +2757,7 @@ int Recursive_ConcaveRaySearch(const Point& MirrorCOCPt, double radius, double m
                                 double min_normal_dir, double max_normal_dir,
                                 std::deque<TracedRay> & found_rays,
                                 int nest_level=0,
-                                const int num_steps = 51
+                                const int num_steps = dvo_quality->m_search_steps
                                 )
 /* Performs a search to identify the location on the mirror (MirrorCOCPt, radius min/max_arc_normal_dir) such that a ray starting at RayTraceStartPt
  * is reflected to the sun (target_sun_dir). min/max_normal_dir are within min/max_arc_normal_dir, and are tightened/refined as the search proceeds.
@@ -949,7 +2786,7 @@ int Recursive_ConcaveRaySearch(const Point& MirrorCOCPt, double radius, double m
         if (tr.m_ray_status >= TracedRay::NStrike) {
             found_suns[jj] = reflect_angle;
 
-            if ( NearlyEqual( target_sun_dir, found_suns[jj] ) ) {
+            if ( NearlyEqual( target_sun_dir, found_suns[jj], SmallValue, dvo_quality->m_tolerance ) ) {
                 tr.m_sun_dir = NormalizeAngle( found_suns[jj] + 180 );
                 tr.m_MirrorPt = target_pt;
                 tr.m_reflect_dir = NormalizeAngle(incident_angle+180); // We're doing this in reverse - so what we start with as incident is actually the reflected.
@@ -968,8 +2805,8 @@ int Recursive_ConcaveRaySearch(const Point& MirrorCOCPt, double radius, double m
              ( (found_suns[jj-1] != BadValue) && (found_suns[jj-0] != BadValue)) &&
             ( ( ( found_suns[jj-1] < target_sun_dir) && (found_suns[jj-0] > target_sun_dir) ) ||
               ( ( found_suns[jj-1] > target_sun_dir) && (found_suns[jj-0] < target_sun_dir) ) ) &&
-            ( ! NearlyEqual( found_suns[jj-1], found_suns[jj-0] ) ) &&
-            ( ! NearlyEqual( normals[jj-1], normals[jj-0] ) )
+            ( ! NearlyEqual( found_suns[jj-1], found_suns[jj-0], SmallValue, dvo_quality->m_tolerance ) ) &&
+            ( ! NearlyEqual( normals[jj-1], normals[jj-0], SmallValue, dvo_quality->m_tolerance ) )
              ) {
                 int result = Recursive_ConcaveRaySearch(MirrorCOCPt,radius,min_arc_normal_dir,max_arc_normal_dir,RayTraceStartPt,target_sun_dir,normals[jj-1],normals[jj-0], found_rays, nest_level+1, num_steps);
                 if (result) {
@@ -985,98 +2822,742 @@ int Recursive_ConcaveRaySearch(const Point& MirrorCOCPt, double radius, double m
 
 void TheData::Calculate(int num_rays, int do_pupil)
 {
-    if (m_IsConvex) Calculate_Convex (num_rays, do_pupil);
-    else            Calculate_Concave(num_rays, do_pupil);
+    m_quality_error = (dvo_quality->m_fast_trig && m_sun_samples) ? to_degrees( FastTrigError ) : 0;
+    if (m_IsConvex)            Calculate_Convex (num_rays, do_pupil);
+    else if (!m_scene.Empty() || !m_profile.Empty()) Calculate_Scene();
+    else                       Calculate_Concave(num_rays, do_pupil);
+
+    m_gradient.clear();
+    if (m_gradient_parameter.empty()) return;
+    if (m_IsConvex)            CalculateGradient_Convex(do_pupil);
+    else if (m_scene.Empty() && m_profile.Empty() && (num_rays > 0)) CalculateGradient_Concave();
 }
 
-void TheData::Calculate_Concave(int num_rays, int do_pupil)
-    /* The object a few 'input' parameters, and numerous 'derived' values - that are determined from the
-     * 'input' parameters. This routine determines those derived values.
-     */
+double TheData::GradientSeed(const std::string& input) const
+    // The derivative of an input (radius, distance, sun_dir, sun_width, min_normal or max_normal) - see SetParameter()
 {
-    const int steps = num_rays-1;
-    if (CheckInputs()) {
-        // Parameters of the mirror
-        Set( m_MirrorCOCPt, 0, 0 );
-        double m_mid_normal_dir = (m_max_normal_dir + m_min_normal_dir)/2;
-        m_MidArcPt= Find2ndPoint(Point(0,0), m_mid_normal_dir, m_radius );
+    const std::string& parameter = m_gradient_parameter;
+    if (input == "sun_dir")    return ((parameter == "sun_a") || (parameter == "sun_A")) ? 1 : 0;
+    if (input == "min_normal") return (parameter == "min_normal") ? 1 : (parameter == "mirror_width") ? -0.5 : 0;
+    if (input == "max_normal") return (parameter == "max_normal") ? 1 : (parameter == "mirror_width") ?  0.5 : 0;
+    return (parameter == input) ? 1 : 0;
+}
 
-        m_min_normal_pt = Find2ndPoint( Point(0,0), m_min_normal_dir, m_radius );
-        m_max_normal_pt = Find2ndPoint( Point(0,0), m_max_normal_dir, m_radius );
+void TheData::TraceForwardPair(double normal_dir, TracedRay& tr_top, TracedRay& tr_bot) const
+    // Forward-traces the two incident rays (from the top and bottom of the sun) that target the point
+    // on the mirror at normal_dir (from the mirror's COC).
+{
+    // Terminology...
+    // top/bot - refer to whether the incident ray originates at the top (12oc) or bottom (6oc) of the sun
+    //
+    tr_top.m_sun_dir = m_sun_dir + m_sun_width_ang/2;
+    tr_bot.m_sun_dir = m_sun_dir - m_sun_width_ang/2;
+
+    tr_top.m_MirrorPt = tr_bot.m_MirrorPt = Find2ndPoint(Point(0,0), normal_dir, m_radius );
+
+    TracedRay* traced_rays[] = { &tr_top, &tr_bot };
+    for (size_t tri = 0; tri < sizeof(traced_rays)/sizeof(traced_rays[0]); tri++) {
+        TracedRay& tr = *traced_rays[tri];
+        double reflect_dir = ConcaveRayCalculate(Point(0,0), m_radius, m_min_normal_dir, m_max_normal_dir,
+                                tr.m_sun_dir, Point(BadValue,BadValue), tr.m_MirrorPt, tr.m_StrikePts, tr.m_ray_status );
+        tr.m_reflect_dir = (reflect_dir == BadValue) ? BadValue : NormalizeAngle( reflect_dir ); // NormalizeAngle(BadValue) would loop ~28 million times
+    }
+}
 
-        if (num_rays == 0) {    /* Reverse ray-tracing
-                                 * The sun's angle in the sky is an input. Project a ray from stencil back to mirror
-                                 * and then back to sun (and finally extend stencil to mirror segment to reach the
-                                 * screen). Requires successive-approximation (search).
-                                 * 1-Project a ray from a point on the stencil back to a point on the mirror.
-                                 *      (Determine the angle from the stencil to the point. This is the initial
-                                 *      angle - and will be adjusted in this search).
-                                 * 2-The above determines an incident angle. From that, and the mirror's properties,
-                                 *      determine the reflected angle.
-                                 * 3-Adjust if/as necessary depending on whether the reflected-angle is greater than or
-                                 *      less than the known sun-angle.
-                                 */
-            std::list<Point> target_points;
-            for (auto it = m_stencils.begin(); it != m_stencils.end(); ++it) {
-                    target_points.push_back(it->first);
-                    target_points.push_back(it->second);
-            }
-            for (std::list<Point>::const_iterator it = m_target_pts.begin(); it != m_target_pts.end(); ++it) 
-                    target_points.push_back( *it );
-            
-            for (int bot_top = 0; bot_top <= 1; bot_top++) { // bot_top=0 for bottom, =1 for top
-                double sun_dir = m_sun_dir + ((bot_top == 0) ? -m_sun_width_ang : m_sun_width_ang)/2;
-                double sun_dir_reversed = NormalizeAngle(sun_dir + 180);
+static bool NeedsRefinement(const TracedRay& tr1, const TracedRay& tr2, double tolerance)
+    // Used by the adaptive forward trace - do two neighboring rays differ enough that there should be another ray between them?
+{
+    if (tr1.m_ray_status != tr2.m_ray_status) return true;
+    if (tr1.m_ray_status < TracedRay::NStrike) return false; // Neither is reflected
+    if (tr1.m_StrikePts.size() != tr2.m_StrikePts.size()) return true;
+    double difference = NormalizeAngle( tr1.m_reflect_dir - tr2.m_reflect_dir );
+    if (difference > 180) difference = 360 - difference;
+    return difference > tolerance;
+}
 
-                for (std::list<Point>::const_iterator it = target_points.begin(); it != target_points.end(); ++it) {
-                    const Point &the_point = *it;
+void TheData::AdaptiveForwardTrace(double normal1, const TracedRay& top1, const TracedRay& bot1,
+                                   double normal2, const TracedRay& top2, const TracedRay& bot2, int depth)
+    // Recursively bisects the arc between normal1 and normal2 (whose rays are already traced), appending the
+    // additional rays (those strictly between normal1 and normal2) in order.
+{
+    const int max_depth = 16; // limits each of the initial intervals to 2^16 sub-intervals
+    if (depth >= max_depth) return;
+    if (NearlyEqual( normal1, normal2 )) return;
+    if ( !NeedsRefinement(top1, top2, m_ray_tolerance) && !NeedsRefinement(bot1, bot2, m_ray_tolerance) ) return;
 
-                    double sun_m_90 = sun_dir-90;
-                    double sun_p_90 = sun_dir+90;
+    double mid_normal = (normal1 + normal2) / 2;
+    TracedRay mid_top, mid_bot;
+    TraceForwardPair( mid_normal, mid_top, mid_bot );
 
-                    double min_normal_dir = Max( m_min_normal_dir, sun_m_90);
-                    double max_normal_dir = Min( m_max_normal_dir, sun_p_90);
+    AdaptiveForwardTrace( normal1, top1, bot1, mid_normal, mid_top, mid_bot, depth+1 );
 
-                    std::deque<TracedRay>& tr_deque = bot_top ? m_TopRays : m_BotRays;
-                    int result = Recursive_ConcaveRaySearch(m_MirrorCOCPt, m_radius, m_min_normal_dir, m_max_normal_dir,
-                            the_point,
-                            sun_dir_reversed,
-                            min_normal_dir, max_normal_dir,
-                            tr_deque );
-                } // for points
-            } // for bot_top
+    if (mid_top.m_ray_status >= TracedRay::NStrike) m_TopRays.push_back( mid_top );
+    if (mid_bot.m_ray_status >= TracedRay::NStrike) m_BotRays.push_back( mid_bot );
+    m_NumRayPositions++;
+
+    AdaptiveForwardTrace( mid_normal, mid_top, mid_bot, normal2, top2, bot2, depth+1 );
+}
+
+static double RelativeChange(double previous, double current)
+    // Used in convergence studies. BadValue is treated as a value in its own right (e.g. a metric that is undefined
+    // because rays are obscured) - so is converged only if both are BadValue.
+{
+    if ((previous == BadValue) || (current == BadValue)) return (previous == current) ? 0 : BadValue;
+    double larger = Max( fabs(previous), fabs(current) );
+    if (larger < SmallValue) return 0;
+    return fabs(current - previous) / larger;
+}
+
+bool TheData::CalculateConverged(int start_rays, int max_rays, double tolerance, int do_pupil)
+    /* Convergence study (-converge): forward-traces with start_rays, then repeatedly doubles the number of rays (2N-1, so
+     * that each set of points along the mirror includes the previous set) until ref_focal_d, ref_blur and ref_width each change
+     * by less than tolerance (relative). The results of the final calculation are kept, with m_NumRayPositions as the ray
+     * count chosen and m_converge_error as the estimated error (the largest relative change at the final doubling).
+     * Returns false if max_rays was reached before converging.
+     */
+{
+    static const char* metrics[] = { "ref_focal_d", "ref_blur", "ref_width" };
+    const int num_metrics = sizeof(metrics)/sizeof(metrics[0]);
+
+    if (m_IsConvex) { // No rays to vary
+        Calculate( start_rays, do_pupil );
+        m_converge_error = 0;
+        return true;
+    }
+
+    TheData previous;
+    previous.DuplicateSettings( *this );
+    previous.m_ray_tolerance = 0; // uniform steps only - so each doubling nests the previous points
+    previous.Calculate( Max(start_rays,2), do_pupil );
+
+    for (int num_rays = 2*Max(start_rays,2)-1; ; num_rays = 2*num_rays-1) {
+        TheData current;
+        current.DuplicateSettings( previous );
+        current.Calculate( num_rays, do_pupil );
+
+        double largest_change = 0;
+        for (int mm=0; mm<num_metrics; mm++) {
+            double change = RelativeChange( previous.GetValue(metrics[mm]), current.GetValue(metrics[mm]) );
+            largest_change = Max( largest_change, change );
+        }
+        if (dvo_debug >= 2)
+            printf("%s(): num_rays=%d, largest relative change=%g\n", __func__, num_rays, largest_change);
+
+        if ( (largest_change <= tolerance) || ((2*num_rays-1) > max_rays) ) {
+            double ray_tolerance = m_ray_tolerance;
+            *this = current;
+            m_ray_tolerance = ray_tolerance;
+            m_converge_error = largest_change;
+            return largest_change <= tolerance;
+        }
+        previous = current;
+    }
+}
+
+void TheData::SunSampleMetrics()
+    /* Traces the m_sun_samples, then builds the screen and far-field histograms from them. A case keeps just these (and the
+     * flux totals) - unless m_keep_sample_rays, the rays are freed, as a sweep holds every case until the end of the run.
+     */
+{
+    TraceSunSamples();
+    if ((m_flux_bins > 0) && (Distance(m_screen.first, m_screen.second) > 0)) ScreenFluxHistogram();
+    if (m_farfield_bins > 0) FarFieldHistogram();
+    if (!m_keep_sample_rays) {
+        m_SampleRays = RayBatch();
+        m_SampleRaysFloat = FloatRayBatch();
+    }
+}
+
+void TheData::TraceSunSamples()
+    // Into m_SampleRays - or, with m_single_precision, m_SampleRaysFloat (the other is emptied)
+{
+    if (m_single_precision) {
+        m_SampleRays.Resize( 0 );
+        TraceSunSamples( m_SampleRaysFloat );
+    } else {
+        m_SampleRaysFloat.Resize( 0 );
+        TraceSunSamples( m_SampleRays );
+    }
+}
+
+template <typename Real> void TheData::TraceSunSamples(BasicRayBatch<Real>& batch)
+    /* Monte-Carlo forward trace (-sun-samples): m_sun_samples rays, each aimed at a (stratified) random point along the
+     * mirror, from a random direction across the sun's disk (distributed per m_sun_shape). Each ray's weight is the flux it
+     * carries: the length of mirror it represents times the cosine of its angle of incidence (so in units of the direct
+     * sun's irradiance times length).
+     * With a mirror-field (m_scene), the points are spread along all of the mirrors (end to end). With a profile mirror
+     * (m_profile), the points are spread along its spline.
+     * Sample #ii always gets the same random numbers (see CounterRandom()), so the results do not depend on the number of threads.
+     * With Real=float, the single mirror is traced by the float kernel (a mirror-field or profile mirror only stores float).
+     */
+{
+    const size_t num_samples = m_sun_samples;
+    const bool is_scene = !m_scene.Empty();
+    const bool is_profile = !is_scene && !m_profile.Empty();
+
+    // Cumulative length along the mirror(s)
+    std::vector<double> start_length( 1, 0.0 );
+    if (is_scene)
+        for (auto it = m_scene.m_arcs.begin(); it != m_scene.m_arcs.end(); ++it) start_length.push_back( start_length.back() + it->Length() );
+    else if (is_profile)
+        start_length.push_back( m_profile.Length() );
+    else
+        start_length.push_back( m_radius * to_radians( fabs( m_max_normal_dir - m_min_normal_dir ) ) );
+    const double length_per_sample = start_length.back() / num_samples;
+
+    const double sample_width_ang = m_convolve ? 0 : m_sun_width_ang; // with m_convolve, the sun's width is applied afterwards (by convolution)
+
+    m_sun_shape.Build();
+    batch.Resize( num_samples );
+
+    // Pass 1 - generate the samples. Simple loops over arrays - the positions and (for the single mirror) the normals are
+    // branch-free, so vectorizable; the sun directions aren't (SunShape::Sample() is a binary search of its table per ray).
+    Real* normal_dir   = &batch.m_normal_dir[0];
+    Real* sun_dir      = &batch.m_sun_dir[0];
+    double* weight     = &batch.m_weight[0];
+    unsigned* mirror   = &batch.m_mirror[0];
+    Real* position     = &batch.m_position[0];
+    for (size_t ii=0; ii<num_samples; ii++) {
+        position[ii] = start_length.back() * (ii + CounterRandom(m_seed, ii, 0)) / num_samples;
+    }
+    if (is_scene) {
+        for (size_t ii=0; ii<num_samples; ii++) {
+            unsigned arc = Min( unsigned( std::upper_bound( start_length.begin(), start_length.end(), position[ii] ) - start_length.begin() ) - 1,
+                                unsigned( m_scene.m_arcs.size() - 1 ) );
+            mirror[ii] = arc;
+            normal_dir[ii] = m_scene.m_arcs[arc].m_min_normal_dir + to_degrees( (position[ii] - start_length[arc]) / m_scene.m_arcs[arc].m_radius );
+        }
+    } else if (is_profile) {
+        for (size_t ii=0; ii<num_samples; ii++) {
+            double x, y, nx, ny;
+            m_profile.Evaluate( position[ii], x, y, nx, ny );
+            mirror[ii] = 0;
+            normal_dir[ii] = NormalizeAngle( to_degrees( atan2( ny, nx ) ) );
+        }
+    } else {
+        const double arc_dir = m_max_normal_dir - m_min_normal_dir;
+        for (size_t ii=0; ii<num_samples; ii++) {
+            mirror[ii] = 0;
+            normal_dir[ii] = m_min_normal_dir + arc_dir * position[ii] / start_length.back();
+        }
+    }
+    for (size_t ii=0; ii<num_samples; ii++) {
+        sun_dir[ii]    = m_sun_dir + m_sun_shape.Sample( CounterRandom(m_seed, ii, 1), sample_width_ang );
+    }
+    if (dvo_quality->m_fast_trig) {
+        for (size_t ii=0; ii<num_samples; ii++) {
+            double sin_incidence, cos_incidence;
+            FastSinCos( sun_dir[ii] - normal_dir[ii], sin_incidence, cos_incidence );
+            weight[ii] = length_per_sample * Max( 0.0, cos_incidence );
+        }
+    } else {
+        for (size_t ii=0; ii<num_samples; ii++) {
+            weight[ii] = length_per_sample * Max( 0.0, double( cos( to_radians( sun_dir[ii] - normal_dir[ii] ) ) ) );
+        }
+    }
+
+    // Pass 2 - trace (in parallel)
+    typedef bg::model::d2::point_xy<Real> RealPoint;
+    const MirrorScene& scene = m_scene;
+    const ProfileMirror& profile = m_profile;
+    const RealPoint MirrorCOC(0,0);
+    const Real radius = m_radius;
+    const double min_normal_dir = m_min_normal_dir, max_normal_dir = m_max_normal_dir, reflectivity = m_reflectivity;
+    const bool fast_trig = dvo_quality->m_fast_trig;
+    std::shared_ptr<const ReflectionLUT> lut;
+    if (m_lut_cells && !is_scene && !is_profile) lut = ReflectionLUT::Get( m_radius, m_min_normal_dir, m_max_normal_dir, m_lut_cells );
+    const ReflectionLUT* table = lut.get();
+    ParallelFor( num_samples, [&batch, &scene, is_scene, &profile, is_profile, &MirrorCOC, radius, min_normal_dir, max_normal_dir, reflectivity, fast_trig, table](size_t begin, size_t end, unsigned) {
+        for (size_t ii=begin; ii<end; ii++) {
+            Real reflect_dir;
+            RealPoint exit_pt;
+            unsigned strikes;
+            if (is_scene || is_profile) {
+                double traced_reflect_dir;
+                Point traced_exit_pt;
+                if (is_scene)
+                    batch.m_ray_status[ii] = scene.Trace( batch.m_mirror[ii], batch.m_normal_dir[ii], batch.m_sun_dir[ii], traced_reflect_dir, traced_exit_pt, strikes );
+                else
+                    batch.m_ray_status[ii] = profile.Trace( batch.m_position[ii], batch.m_sun_dir[ii], traced_reflect_dir, traced_exit_pt, strikes );
+                reflect_dir = traced_reflect_dir;
+                exit_pt = RealPoint( traced_exit_pt.x(), traced_exit_pt.y() );
+            } else if (table) {
+                double traced_reflect_dir, exit_normal_dir, sin_normal, cos_normal;
+                batch.m_ray_status[ii] = table->Trace( batch.m_sun_dir[ii], batch.m_normal_dir[ii], traced_reflect_dir, exit_normal_dir, strikes );
+                if (fast_trig) FastSinCos( exit_normal_dir, sin_normal, cos_normal );
+                else { sin_normal = sin( to_radians( exit_normal_dir ) ); cos_normal = cos( to_radians( exit_normal_dir ) ); }
+                reflect_dir = traced_reflect_dir;
+                exit_pt = RealPoint( radius * cos_normal, radius * sin_normal );
+            } else if (fast_trig) {
+                double traced_reflect_dir, exit_x, exit_y;
+                batch.m_ray_status[ii] = ConcaveRayKernel_Angular( radius, min_normal_dir, max_normal_dir, batch.m_sun_dir[ii], batch.m_normal_dir[ii],
+                                            traced_reflect_dir, exit_x, exit_y, strikes );
+                reflect_dir = traced_reflect_dir;
+                exit_pt = RealPoint( exit_x, exit_y );
+            } else
+                batch.m_ray_status[ii] = ConcaveRayKernel( MirrorCOC, radius, min_normal_dir, max_normal_dir,
+                                            batch.m_sun_dir[ii], batch.m_normal_dir[ii], reflect_dir, exit_pt, strikes );
+            batch.m_reflect_dir[ii] = reflect_dir;
+            batch.m_exit_x[ii] = exit_pt.x();
+            batch.m_exit_y[ii] = exit_pt.y();
+            batch.m_strikes[ii] = Min( strikes, 255u );
+            batch.m_out_weight[ii] = batch.Reflected(ii) ? batch.m_weight[ii] * ((reflectivity == 1) ? 1 : pow( reflectivity, strikes )) : 0;
+        }
+    });
+
+    // Pass 3 - totals (serial, so the sum is the same for any number of threads)
+    m_num_samples = unsigned(num_samples);
+    m_sample_flux_in = m_sample_flux_out = 0;
+    m_sample_flux_shaded = m_sample_flux_blocked = (is_scene || is_profile) ? 0 : BadValue;
+    for (size_t ii=0; ii<num_samples; ii++) {
+        if (batch.m_ray_status[ii] == TracedRay::Convex) continue;
+        m_sample_flux_in += weight[ii];
+        m_sample_flux_out += batch.m_out_weight[ii];
+        if ((is_scene || is_profile) && (batch.m_ray_status[ii] == TracedRay::Obscured)) m_sample_flux_shaded  += weight[ii];
+        if ((is_scene || is_profile) && (batch.m_ray_status[ii] == TracedRay::Blocked )) m_sample_flux_blocked += weight[ii];
+    }
+}
+
+void TheData::Calculate_Scene()
+    /* A mirror-field (m_scene) or a profile mirror (m_profile) - there's no per-mirror geometry (focal points, etc.) - just
+     * the m_sun_samples forward trace (with shading and blocking), and the screen/far-field histograms built from it.
+     */
+{
+    if (!m_scene.Empty()) {
+        m_scene.m_stencils.assign( m_stencils.begin(), m_stencils.end() );
+        m_scene.Build();
+    }
+    if ((m_sun_samples == 0) || !(m_outputs & OutSamples)) return;
+    SunSampleMetrics();
+}
+
+void TheData::ScreenHits(const Segment& target, std::vector<double>& bins, double& sum_weight, double& sum_distance, double& sum_cos) const
+{
+    if (m_single_precision) ScreenHits( m_SampleRaysFloat, target, bins, sum_weight, sum_distance, sum_cos );
+    else                    ScreenHits( m_SampleRays,      target, bins, sum_weight, sum_distance, sum_cos );
+}
+
+template <typename Real> void TheData::ScreenHits(const BasicRayBatch<Real>& batch, const Segment& target, std::vector<double>& bins,
+                                                  double& sum_weight, double& sum_distance, double& sum_cos) const
+    /* Intersects each reflected m_SampleRays ray with target (unless a stencil blocks it first) and accumulates its m_out_weight
+     * into bins (equal bins along target). Also sums (weighted by m_out_weight) the distance from the mirror to target and
+     * the cosine of the angle between the ray and target's normal.
+     * Each thread has its own bins (no locking) - merged at the end.
+     */
+{
+    const size_t num_samples = batch.Size();
+    const unsigned num_bins = bins.size();
+    const unsigned num_threads = NumThreads(num_samples);
+    std::vector< std::vector<double> > thread_bins( num_threads, std::vector<double>(num_bins, 0.0) );
+    std::vector<double> thread_sums( 3 * num_threads, 0.0 );
+
+    const double length = Distance(target.first, target.second);
+    const double normal_x = -(target.second.y() - target.first.y()) / length;
+    const double normal_y =  (target.second.x() - target.first.x()) / length;
+    const std::deque<Segment>& stencils = m_stencils;
+    const bool fast_trig = dvo_quality->m_fast_trig;
+    ParallelFor( num_samples, [&](size_t begin, size_t end, unsigned thread_index) {
+        std::vector<double>& my_bins = thread_bins[thread_index];
+        double* sums = &thread_sums[3 * thread_index];
+        for (size_t ii=begin; ii<end; ii++) {
+            if (batch.m_out_weight[ii] <= 0) continue;
+            double dx, dy;
+            if (fast_trig) FastSinCos( batch.m_reflect_dir[ii], dy, dx );
+            else {
+                dx = cos( to_radians( batch.m_reflect_dir[ii] ) );
+                dy = sin( to_radians( batch.m_reflect_dir[ii] ) );
+            }
+            double distance, fraction;
+            if (! RaySegmentHit( batch.m_exit_x[ii], batch.m_exit_y[ii], dx, dy, target, distance, fraction )) continue;
+            bool blocked = false;
+            for (auto it = stencils.begin(); (it != stencils.end()) && !blocked; ++it) {
+                double stencil_distance, stencil_fraction;
+                blocked = RaySegmentHit( batch.m_exit_x[ii], batch.m_exit_y[ii], dx, dy, *it, stencil_distance, stencil_fraction )
+                            && (stencil_distance < distance);
+            }
+            if (blocked) continue;
+            if (num_bins) my_bins[ Min( unsigned(fraction * num_bins), num_bins-1 ) ] += batch.m_out_weight[ii];
+            sums[0] += batch.m_out_weight[ii];
+            sums[1] += batch.m_out_weight[ii] * distance;
+            sums[2] += batch.m_out_weight[ii] * fabs( dx*normal_x + dy*normal_y );
+        }
+    });
+
+    bins.assign( num_bins, 0.0 );
+    sum_weight = sum_distance = sum_cos = 0;
+    for (unsigned tt=0; tt<num_threads; tt++) {
+        for (unsigned bb=0; bb<num_bins; bb++)
+            bins[bb] += thread_bins[tt][bb];
+        sum_weight   += thread_sums[3*tt+0];
+        sum_distance += thread_sums[3*tt+1];
+        sum_cos      += thread_sums[3*tt+2];
+    }
+}
+
+void TheData::ScreenFluxHistogram()
+    /* The flux profile along m_screen, in m_flux_bins equal bins (see ScreenHits()).
+     * With m_convolve, the m_SampleRays were traced from a point sun - so the profile is the ideal response, which is then
+     * convolved with the sun's shape and the slope-error (see AngularKernel()). The kernel is angular - it's converted to a
+     * distance along the screen using the mean path length (and obliquity) from the mirror to the screen. To catch the
+     * light that spreads onto the screen from beyond its ends, the ideal response is binned along an extended screen.
+     */
+{
+    const unsigned num_bins = m_flux_bins;
+    const double screen_length = Distance(m_screen.first, m_screen.second);
+    const double bin_length = screen_length / num_bins;
+    std::vector<double> bins( num_bins );
+    double sum_weight, sum_distance, sum_cos;
+    ScreenHits( m_screen, bins, sum_weight, sum_distance, sum_cos );
+    if (m_convolve && !(sum_weight > 0)) // (so no mean path length to scale the kernel by)
+        fprintf(stderr, "Warning: None of the %u -sun-samples rays reach the -screen - its flux profile is all 0 (not convolved).\n",
+                m_num_samples);
+
+    if (m_convolve && (sum_weight > 0)) {
+        double mean_distance = sum_distance / sum_weight;
+        double mean_cos = Max( sum_cos / sum_weight, SmallValue );
+        std::vector<double> kernel = AngularKernel( m_sun_shape, m_sun_width_ang, m_slope_error, to_degrees( bin_length * mean_cos / mean_distance ) );
+        const unsigned pad_bins = kernel.size() / 2;
+        double dx = (m_screen.second.x() - m_screen.first.x()) / screen_length * pad_bins * bin_length;
+        double dy = (m_screen.second.y() - m_screen.first.y()) / screen_length * pad_bins * bin_length;
+        Segment extended( Point( m_screen.first.x() - dx, m_screen.first.y() - dy ), Point( m_screen.second.x() + dx, m_screen.second.y() + dy ) );
+        std::vector<double> extended_bins( num_bins + 2 * pad_bins );
+        ScreenHits( extended, extended_bins, sum_weight, sum_distance, sum_cos );
+        extended_bins = Convolve( extended_bins, kernel );
+        bins.assign( extended_bins.begin() + pad_bins, extended_bins.begin() + pad_bins + num_bins );
+    }
+
+    m_screen_flux = bins;
+    m_screen_flux_total = 0;
+    for (unsigned bb=0; bb<num_bins; bb++)
+        m_screen_flux_total += m_screen_flux[bb];
+}
+
+void TheData::FarFieldHistogram()
+{
+    if (m_single_precision) FarFieldHistogram( m_SampleRaysFloat );
+    else                    FarFieldHistogram( m_SampleRays );
+}
+
+template <typename Real> void TheData::FarFieldHistogram(const BasicRayBatch<Real>& batch)
+    /* The distribution of the reflected directions of the m_SampleRays (weighted by their m_out_weight) - i.e. the far-field
+     * intensity. Linear in the number of rays. Directions are measured from their circular mean (so a spread that crosses
+     * 0/360 degrees is not split), and the bins span just the range of reflected directions found.
+     * With m_convolve, this ideal (point sun) response is convolved with the sun's shape and slope-error (see AngularKernel()),
+     * and the bins are extended to hold the spread.
+     */
+{
+    const size_t num_samples = batch.Size();
+    const unsigned num_bins = m_farfield_bins;
+    const unsigned num_threads = NumThreads(num_samples);
+
+    // Pass 1 - the (weighted) mean direction
+    double sum_cos = 0, sum_sin = 0;
+    for (size_t ii=0; ii<num_samples; ii++) {
+        if (batch.m_out_weight[ii] <= 0) continue;
+        double sin_dir, cos_dir;
+        if (dvo_quality->m_fast_trig) FastSinCos( batch.m_reflect_dir[ii], sin_dir, cos_dir );
+        else { cos_dir = cos( to_radians( batch.m_reflect_dir[ii] ) ); sin_dir = sin( to_radians( batch.m_reflect_dir[ii] ) ); }
+        sum_cos += batch.m_out_weight[ii] * cos_dir;
+        sum_sin += batch.m_out_weight[ii] * sin_dir;
+    }
+    m_farfield.clear();
+    if ((sum_cos == 0) && (sum_sin == 0)) return; // nothing reflected
+    const double center = NormalizeAngle( to_degrees( atan2( sum_sin, sum_cos ) ) );
+
+    // Pass 2 - the range of directions (relative to center)
+    std::vector<double> thread_min( num_threads, 180 ), thread_max( num_threads, -180 );
+    ParallelFor( num_samples, [&batch, &thread_min, &thread_max, center](size_t begin, size_t end, unsigned thread_index) {
+        for (size_t ii=begin; ii<end; ii++) {
+            if (batch.m_out_weight[ii] <= 0) continue;
+            double offset = NormalizeAngle( batch.m_reflect_dir[ii] - center + 180 ) - 180;
+            thread_min[thread_index] = Min( thread_min[thread_index], offset );
+            thread_max[thread_index] = Max( thread_max[thread_index], offset );
+        }
+    });
+    double min_offset = *std::min_element( thread_min.begin(), thread_min.end() );
+    double max_offset = *std::max_element( thread_max.begin(), thread_max.end() );
+    std::vector<double> kernel;
+    unsigned pad_bins = 0;
+    if (m_convolve) {
+        // Bins no narrower than needed to resolve the kernel's full width (an ideal response may be nearly a single direction)
+        double kernel_width = m_sun_width_ang + 8 * 2 * m_slope_error;
+        double extra = Max( 0.0, kernel_width - (max_offset - min_offset) ) / 2;
+        max_offset += extra;
+        min_offset -= extra;
+        double bin_width = Max( (max_offset - min_offset) / num_bins, SmallValue );
+        kernel = AngularKernel( m_sun_shape, m_sun_width_ang, m_slope_error, bin_width );
+        pad_bins = kernel.size() / 2;
+        max_offset += pad_bins * bin_width;
+        min_offset -= pad_bins * bin_width;
+    }
+    const unsigned total_bins = num_bins + 2 * pad_bins;
+    double bin_width = (max_offset - min_offset) / total_bins;
+    if (bin_width <= 0) bin_width = SmallValue; // all in one direction
+
+    // Pass 3 - the histogram (per-thread bins, then merged)
+    std::vector< std::vector<double> > thread_bins( num_threads, std::vector<double>(total_bins, 0.0) );
+    ParallelFor( num_samples, [&batch, &thread_bins, center, min_offset, bin_width, total_bins](size_t begin, size_t end, unsigned thread_index) {
+        std::vector<double>& bins = thread_bins[thread_index];
+        for (size_t ii=begin; ii<end; ii++) {
+            if (batch.m_out_weight[ii] <= 0) continue;
+            double offset = NormalizeAngle( batch.m_reflect_dir[ii] - center + 180 ) - 180;
+            bins[ Min( unsigned( (offset - min_offset) / bin_width ), total_bins-1 ) ] += batch.m_out_weight[ii];
+        }
+    });
+    m_farfield.assign( total_bins, 0.0 );
+    for (unsigned tt=0; tt<num_threads; tt++)
+        for (unsigned bb=0; bb<total_bins; bb++)
+            m_farfield[bb] += thread_bins[tt][bb];
+    if (m_convolve) m_farfield = Convolve( m_farfield, kernel );
+
+    m_farfield_center = center;
+    m_farfield_start = min_offset;
+    m_farfield_bin_width = bin_width;
+    double* widths[] = { &m_farfield_w50, &m_farfield_w90, &m_farfield_w99 };
+    const double fractions[] = { 0.50, 0.90, 0.99 };
+    for (int ww=0; ww<3; ww++)
+        *widths[ww] = HistogramQuantile( m_farfield, min_offset, bin_width, 0.5 + fractions[ww]/2 )
+                    - HistogramQuantile( m_farfield, min_offset, bin_width, 0.5 - fractions[ww]/2 );
+}
+
+void TheData::FarFieldReport(FILE *fout, int case_index, bool header) const
+    /* The far-field intensity (see -farfield). direction is the center of each bin. intensity is the flux per degree
+     * (flux in units of the direct sun's irradiance times length).
+     */
+{
+    if (header)
+        fprintf(fout, "case,sun_a,bin,direction,offset,flux,intensity\n");
+    for (unsigned bb=0; bb<m_farfield.size(); bb++) {
+        double offset = m_farfield_start + (bb + 0.5) * m_farfield_bin_width;
+        fprintf(fout, "%d,%g,%u,%g,%g,%g,%g\n", case_index, m_sun_dir, bb, NormalizeAngle(m_farfield_center + offset), offset,
+                m_farfield[bb], m_farfield[bb] / m_farfield_bin_width );
+    }
+}
+
+void TheData::ScreenFluxReport(FILE *fout, int case_index, bool header) const
+    /* The irradiance profile along the screen (see -flux-bins). position is the distance from the screen's first end point.
+     * concentration is the flux per unit length of screen - relative to the direct sun's irradiance.
+     */
+{
+    if (header)
+        fprintf(fout, "case,sun_a,bin,position,x,y,flux,concentration\n");
+    const unsigned num_bins = m_screen_flux.size();
+    const double bin_length = Distance(m_screen.first, m_screen.second) / num_bins;
+    for (unsigned bb=0; bb<num_bins; bb++) {
+        double fraction = (bb + 0.5) / num_bins;
+        double x = m_screen.first.x() + fraction * (m_screen.second.x() - m_screen.first.x());
+        double y = m_screen.first.y() + fraction * (m_screen.second.y() - m_screen.first.y());
+        fprintf(fout, "%d,%g,%u,%g,%g,%g,%g,%g\n", case_index, m_sun_dir, bb, (bb + 0.5) * bin_length, x, y,
+                m_screen_flux[bb], m_screen_flux[bb] / bin_length );
+    }
+}
+
+template<class PointType>
+bool ReflectedRayMetrics(const PointType& MidArcPt, const BasicBBox<PointType>& TopIntersectionBBox, const BasicBBox<PointType>& BotIntersectionBBox,
+                         typename ScalarOf<PointType>::type& reflected_rays_width_ang, typename ScalarOf<PointType>::type& reflected_focal_distance,
+                         typename ScalarOf<PointType>::type& reflected_blur) // returns success
+{
+    typedef typename ScalarOf<PointType>::type Scalar;
+    if ( TopIntersectionBBox.Defined() && BotIntersectionBBox.Defined() ) { // reflected rays 'blur' width angle
+        // using the middle points of the bounding boxes as the intersection points - this is first implementation - there may be a better way
+        PointType top_intersection( TopIntersectionBBox.MidX(), TopIntersectionBBox.MidY() );
+        PointType bot_intersection( BotIntersectionBBox.MidX(), BotIntersectionBBox.MidY() );
+
+
+        Scalar dir1 = to_degrees( atan2( top_intersection.y()-MidArcPt.y(), top_intersection.x()-MidArcPt.x() ));
+        Scalar dir2 = to_degrees( atan2( bot_intersection.y()-MidArcPt.y(), bot_intersection.x()-MidArcPt.x() ));
+        reflected_rays_width_ang = fabs( NormalizeAngle( dir1 - dir2 + 180 ) - 180 ); // (dir1 and dir2 may straddle +/-180)
+
+        assert( Defined(MidArcPt) );
+        assert( Defined(top_intersection) );
+        assert( Defined(bot_intersection) );
+        Scalar distance1 = Distance( MidArcPt, top_intersection );
+        Scalar distance2 = Distance( MidArcPt, bot_intersection );
+        reflected_focal_distance = (distance1 + distance2)/2;
+
+        Scalar blur1 = TopIntersectionBBox.Diagonal();
+        Scalar blur2 = BotIntersectionBBox.Diagonal();
+        reflected_blur = (blur1 + blur2)/2;
+        return true;
+    }
+    return false;
+}
+
+void TheData::ReflectedRayMetrics()
+    // ref_width, ref_focal_d and ref_blur - from the bounding boxes of the intersections of the reflected Top (and Bot) rays.
+{
+    ::ReflectedRayMetrics( m_MidArcPt, m_TopIntersectionBBox, m_BotIntersectionBBox, m_reflected_rays_width_ang, m_reflected_focal_distance, m_reflected_blur );
+}
+
+void TheData::CalculateGradient_Concave()
+    /* Replays the forward trace of the (reflected) m_TopRays and m_BotRays - and their intersections - on Dual, for the
+     * derivatives of ref_width, ref_focal_d and ref_blur. Each ray keeps its relative position along the arc (so it moves
+     * with min_normal and max_normal) - and its ray status (so the derivatives are those of the current set of rays).
+     */
+{
+    const Dual radius( m_radius, GradientSeed("radius") );
+    const Dual sun_dir( m_sun_dir, GradientSeed("sun_dir") );
+    const Dual sun_width( m_sun_width_ang, GradientSeed("sun_width") );
+    const Dual min_normal( m_min_normal_dir, GradientSeed("min_normal") );
+    const Dual max_normal( m_max_normal_dir, GradientSeed("max_normal") );
+    const DualPoint coc( 0, 0 );
+    const double arc_length = m_max_normal_dir - m_min_normal_dir;
+    if (arc_length <= 0) return;
+
+    BasicBBox<DualPoint> bboxes[2];
+    const std::deque<TracedRay>* traced_rays[] = { &m_TopRays, &m_BotRays };
+    for (int tri = 0; tri < 2; tri++) {
+        Dual incident_dir = (tri == 0) ? sun_dir + sun_width/2 : sun_dir - sun_width/2;
+        std::vector<DualPoint> exit_pts;
+        std::vector<Dual> reflect_dirs;
+        for (auto it = traced_rays[tri]->begin(); it != traced_rays[tri]->end(); ++it) {
+            double fraction = NormalizeAngle( Direction( Point(0,0), it->m_MirrorPt ) - m_min_normal_dir ) / arc_length;
+            Dual reflect_dir;
+            DualPoint exit_pt;
+            unsigned strikes;
+            TracedRay::RayStatus status = ConcaveRayKernel( coc, radius, m_min_normal_dir, m_max_normal_dir, incident_dir,
+                                                            min_normal + fraction * (max_normal - min_normal), reflect_dir, exit_pt, strikes );
+            if (status < TracedRay::NStrike) continue;
+            exit_pts.push_back( exit_pt );
+            reflect_dirs.push_back( NormalizeAngle( reflect_dir ) );
+        }
+        for (size_t outer=0; outer<exit_pts.size(); outer++) // (as Calculate_Concave())
+            for (size_t inner=0; inner<outer; inner++) {
+                DualPoint intersection_pt;
+                if (Intersection( exit_pts[outer], reflect_dirs[outer], exit_pts[inner], reflect_dirs[inner], intersection_pt ))
+                    bboxes[tri].Update( intersection_pt );
+            }
+    }
+
+    Dual width_ang, focal_distance, blur;
+    if (! ::ReflectedRayMetrics( Find2ndPoint( coc, (max_normal + min_normal)/2, radius ), bboxes[0], bboxes[1], width_ang, focal_distance, blur ))
+        return;
+    m_gradient["ref_width"] = NormalizeAngle( width_ang ).d;
+    m_gradient["ref_width_p"] = (100 * NormalizeAngle( width_ang ) / sun_width).d;
+    m_gradient["ref_focal_d"] = focal_distance.d;
+    m_gradient["ref_focal_p"] = (100 * (focal_distance / (radius/2))).d;
+    m_gradient["ref_blur"] = blur.d;
+}
+
+void TheData::Calculate_Concave(int num_rays, int do_pupil)
+    /* The object a few 'input' parameters, and numerous 'derived' values - that are determined from the
+     * 'input' parameters. This routine determines those derived values.
+     */
+{
+    const int steps = num_rays-1;
+    if (CheckInputs()) {
+        // Parameters of the mirror
+        Set( m_MirrorCOCPt, 0, 0 );
+        double m_mid_normal_dir = (m_max_normal_dir + m_min_normal_dir)/2;
+        m_MidArcPt= Find2ndPoint(Point(0,0), m_mid_normal_dir, m_radius );
+
+        m_min_normal_pt = Find2ndPoint( Point(0,0), m_min_normal_dir, m_radius );
+        m_max_normal_pt = Find2ndPoint( Point(0,0), m_max_normal_dir, m_radius );
+
+        if (! (m_outputs & (OutRays | OutFocal | OutFocalPts))) {
+            // none of the rays' results are wanted
+        } else if (num_rays == 0) {    /* Reverse ray-tracing
+                                 * The sun's angle in the sky is an input. Project a ray from stencil back to mirror
+                                 * and then back to sun (and finally extend stencil to mirror segment to reach the
+                                 * screen). Requires successive-approximation (search).
+                                 * 1-Project a ray from a point on the stencil back to a point on the mirror.
+                                 *      (Determine the angle from the stencil to the point. This is the initial
+                                 *      angle - and will be adjusted in this search).
+                                 * 2-The above determines an incident angle. From that, and the mirror's properties,
+                                 *      determine the reflected angle.
+                                 * 3-Adjust if/as necessary depending on whether the reflected-angle is greater than or
+                                 *      less than the known sun-angle.
+                                 */
+            std::list<Point> target_points;
+            for (auto it = m_stencils.begin(); it != m_stencils.end(); ++it) {
+                    target_points.push_back(it->first);
+                    target_points.push_back(it->second);
+            }
+            for (std::list<Point>::const_iterator it = m_target_pts.begin(); it != m_target_pts.end(); ++it) 
+                    target_points.push_back( *it );
+            
+            for (int bot_top = 0; bot_top <= 1; bot_top++) { // bot_top=0 for bottom, =1 for top
+                double sun_dir = m_sun_dir + ((bot_top == 0) ? -m_sun_width_ang : m_sun_width_ang)/2;
+                double sun_dir_reversed = NormalizeAngle(sun_dir + 180);
+
+                for (std::list<Point>::const_iterator it = target_points.begin(); it != target_points.end(); ++it) {
+                    const Point &the_point = *it;
+
+                    double sun_m_90 = sun_dir-90;
+                    double sun_p_90 = sun_dir+90;
+
+                    double min_normal_dir = Max( m_min_normal_dir, sun_m_90);
+                    double max_normal_dir = Min( m_max_normal_dir, sun_p_90);
+
+                    std::deque<TracedRay>& tr_deque = bot_top ? m_TopRays : m_BotRays;
+                    size_t first_found = tr_deque.size();
+                    int result = Recursive_ConcaveRaySearch(m_MirrorCOCPt, m_radius, m_min_normal_dir, m_max_normal_dir,
+                            the_point,
+                            sun_dir_reversed,
+                            min_normal_dir, max_normal_dir,
+                            tr_deque );
+                    for (size_t ff=first_found; ff<tr_deque.size(); ff++) // how far each found ray's sun is from the target
+                        m_quality_error = Max( m_quality_error, fabs( NormalizeAngle( tr_deque[ff].m_sun_dir - sun_dir + 180 ) - 180 ) );
+                } // for points
+            } // for bot_top
+        } else if (m_ray_tolerance > 0) { // forward ray-trace, adaptively sampled along the arc (-nr auto)
+            /* Start with a coarse uniform set of points along the arc, then recursively bisect each interval
+             * whose end-points disagree (status, number of strikes, or reflected direction differing by more
+             * than m_ray_tolerance degrees). Rays are appended in order of increasing normal_dir - same as
+             * the uniform forward trace below.
+             */
+            const int initial_steps = 8;
+            double step_size = (m_max_normal_dir - m_min_normal_dir) / initial_steps;
+
+            double prev_normal_dir = m_min_normal_dir;
+            TracedRay prev_top, prev_bot;
+            TraceForwardPair( prev_normal_dir, prev_top, prev_bot );
+            if (prev_top.m_ray_status >= TracedRay::NStrike) m_TopRays.push_back( prev_top );
+            if (prev_bot.m_ray_status >= TracedRay::NStrike) m_BotRays.push_back( prev_bot );
+            m_NumRayPositions++;
+
+            for (int step=1; step <= initial_steps; step++) {
+                double normal_dir = m_min_normal_dir + step * step_size;
+                TracedRay tr_top, tr_bot;
+                TraceForwardPair( normal_dir, tr_top, tr_bot );
+
+                AdaptiveForwardTrace( prev_normal_dir, prev_top, prev_bot, normal_dir, tr_top, tr_bot, 0 );
+
+                if (tr_top.m_ray_status >= TracedRay::NStrike) m_TopRays.push_back( tr_top );
+                if (tr_bot.m_ray_status >= TracedRay::NStrike) m_BotRays.push_back( tr_bot );
+                m_NumRayPositions++;
+
+                prev_normal_dir = normal_dir;
+                prev_top = tr_top;
+                prev_bot = tr_bot;
+            } // for step
         } else { // forward ray-trace - from Sun to mirror. First identify a target point on the mirror, then calculate the reflection.
 
             double step_size = (m_max_normal_dir - m_min_normal_dir) / steps;
 
             for (int step=0; step <= steps; step++) { // steps along points on the mirror
-                // Terminology...
-                // top/bot - refer to whether the incident ray originates at the top (12oc) or bottom (6oc) of the sun
-                //
                 TracedRay tr_top, tr_bot;
-                tr_top.m_sun_dir = m_sun_dir + m_sun_width_ang/2;
-                tr_bot.m_sun_dir = m_sun_dir - m_sun_width_ang/2;
-
                 double normal_dir = m_min_normal_dir + step * step_size;
-                tr_top.m_MirrorPt = tr_bot.m_MirrorPt = Find2ndPoint(Point(0,0), normal_dir, m_radius );
-
-                tr_top.m_reflect_dir = NormalizeAngle(ConcaveRayCalculate(Point(0,0), m_radius, m_min_normal_dir, m_max_normal_dir,
-                                tr_top.m_sun_dir, Point(BadValue,BadValue), tr_top.m_MirrorPt, tr_top.m_StrikePts, tr_top.m_ray_status ));
-                tr_bot.m_reflect_dir = NormalizeAngle(ConcaveRayCalculate(Point(0,0), m_radius, m_min_normal_dir, m_max_normal_dir,
-                                tr_bot.m_sun_dir, Point(BadValue,BadValue), tr_bot.m_MirrorPt, tr_bot.m_StrikePts, tr_bot.m_ray_status ));
+                TraceForwardPair( normal_dir, tr_top, tr_bot );
 
                 if (tr_top.m_ray_status >= TracedRay::NStrike) m_TopRays.push_back( tr_top );
                 if (tr_bot.m_ray_status >= TracedRay::NStrike) m_BotRays.push_back( tr_bot );
+                m_NumRayPositions++;
 
 //                m_CountOfObscuredRays += tr_top.CountObscuredRays();
 //                m_CountOfObscuredRays += tr_bot.CountObscuredRays();
             } // for step
         } // if else forward ray trace
 
+        if ((num_rays != 0) && (m_sun_samples > 0) && (m_outputs & OutSamples)) {
+            SunSampleMetrics();
+        }
+
 
         // An N-squared algorithm (originally, but not much better now) - looking for all intersections of Top
         // rays (and then again, all intersections of Bot rays)
-        {
+        if (m_outputs & (OutFocal | OutFocalPts)) {
+            const bool keep_pts = (m_outputs & OutFocalPts);
             int outer = 0;
             std::deque<TracedRay>* traced_rays[] = { &m_TopRays, &m_BotRays };
             for (int tri = 0; tri < sizeof(traced_rays)/sizeof(traced_rays[0]); tri++) {
@@ -1107,10 +3588,10 @@ void TheData::Calculate_Concave(int num_rays, int do_pupil)
 
                             if (tri == 0) { // This is an ugly hack
                                 m_TopIntersectionBBox.Update( intersection_pt );
-                                m_TopIntersectionPts.push_back( intersection_pt );
+                                if (keep_pts) m_TopIntersectionPts.push_back( intersection_pt );
                             } else {
                                 m_BotIntersectionBBox.Update( intersection_pt );
-                                m_BotIntersectionPts.push_back( intersection_pt );
+                                if (keep_pts) m_BotIntersectionPts.push_back( intersection_pt );
                             }
                         }
                     } // for it_inner
@@ -1118,27 +3599,7 @@ void TheData::Calculate_Concave(int num_rays, int do_pupil)
             }
         }
 
-        if ( m_TopIntersectionBBox.Defined() && m_BotIntersectionBBox.Defined() ) { // reflected rays 'blur' width angle
-            // using the middle points of the bounding boxes as the intersection points - this is first implementation - there may be a better way
-            Point top_intersection( m_TopIntersectionBBox.MidX(), m_TopIntersectionBBox.MidY() );
-            Point bot_intersection( m_BotIntersectionBBox.MidX(), m_BotIntersectionBBox.MidY() );
-
-
-            double dir1 = to_degrees( atan2( top_intersection.y()-m_MidArcPt.y(), top_intersection.x()-m_MidArcPt.x() ));
-            double dir2 = to_degrees( atan2( bot_intersection.y()-m_MidArcPt.y(), bot_intersection.x()-m_MidArcPt.x() ));
-            m_reflected_rays_width_ang = fabs(dir1-dir2);
-
-            assert( Defined(m_MidArcPt) );
-            assert( Defined(top_intersection) );
-            assert( Defined(bot_intersection) );
-            double distance1 = Distance( m_MidArcPt, top_intersection );
-            double distance2 = Distance( m_MidArcPt, bot_intersection );
-            m_reflected_focal_distance = (distance1 + distance2)/2;
-
-            double blur1 = m_TopIntersectionBBox.Diagonal();
-            double blur2 = m_BotIntersectionBBox.Diagonal();
-            m_reflected_blur = (blur1 + blur2)/2;
-        }
+        ReflectedRayMetrics();
 
         if (0) { // experimental - bounding ellipse
             // https://stackoverflow.com/questions/1768197/bounding-ellipse
@@ -1574,42 +4035,789 @@ __LINE__,                10,0,   10,99,      0,0, to_degrees(atan2(99.0,10)),
 
 
 
-    if (fail_count)
-        printf("%s(): FAILED %d of %d test-steps.\n", __func__, fail_count, test_count );
-    else
-        printf("%s(): PASSED all %d test-steps.\n", __func__, test_count );
+    { // SunShape::Sample() - each shape is symmetric and spans the sun's width
+        static const SunShape::Type types[] = { SunShape::Uniform, SunShape::Disk, SunShape::LimbDarkened };
+        static const double test_points[] = { // In sets of 2: uniform random number, expected offset (multiple of width) - for all shapes
+            0.0, -0.5,      0.5, 0.0,       1.0, 0.5
+        };
+        for (int tt=0; tt<sizeof(types)/sizeof(types[0]); tt++) {
+            SunShape shape;
+            shape.m_type = types[tt];
+            shape.Build();
+            for (int ii=0; ii<sizeof(test_points)/sizeof(test_points[0]); ii+=2) {
+                double result = shape.Sample( test_points[ii], 0.5 );
+                if ( ! NearlyEqual( result, test_points[ii+1] * 0.5, SmallValue, 0.0001 ) ) {
+                    printf("Test failure: SunShape(%s).Sample(%g, 0.5)=%g, expected %g. ii=%d at %d of %s\n",
+                            Name(types[tt]), test_points[ii], result, test_points[ii+1] * 0.5, ii, __LINE__, __FILE__ );
+                    fail_count++;
+                }
+                test_count++;
+            }
+        }
+        SunShape uniform; // Uniform is linear
+        uniform.m_type = SunShape::Uniform;
+        uniform.Build();
+        if ( ! NearlyEqual( uniform.Sample(0.25, 2.0), -0.5 ) ) {
+            printf("Test failure: SunShape(uniform).Sample(0.25, 2)=%g, expected -0.5 at %d of %s\n", uniform.Sample(0.25, 2.0), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
 
-    return fail_count;
-}
+    { // Convolve() - compare with direct convolution
+        std::vector<double> signal, kernel;
+        for (int ii=0; ii<37; ii++) signal.push_back( (ii*7 % 11) + 0.5*ii );
+        for (int ii=0; ii<9; ii++) kernel.push_back( 1 + (ii % 4) );
+        std::vector<double> result = Convolve( signal, kernel );
+        for (int ii=0; ii<signal.size(); ii++) {
+            double expected = 0;
+            for (int kk=0; kk<kernel.size(); kk++) {
+                int from = ii - (kk - int(kernel.size())/2);
+                if ((from >= 0) && (from < signal.size())) expected += signal[from] * kernel[kk];
+            }
+            if ( ! NearlyEqual( result[ii], expected, SmallValue, 0.000001 ) ) {
+                printf("Test failure: Convolve()[%d]=%g, expected %g at %d of %s\n", ii, result[ii], expected, __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+        // AngularKernel() - spreads the light, but conserves it
+        SunShape shape;
+        shape.Build();
+        std::vector<double> ak = AngularKernel( shape, 0.5, 0.1, 0.01 );
+        double total = 0;
+        for (auto it = ak.begin(); it != ak.end(); ++it) total += *it;
+        if ( ! NearlyEqual( total, 1.0, SmallValue, 0.0001 ) || ((ak.size() % 2) != 1) ) {
+            printf("Test failure: AngularKernel() total=%g (expected 1), size=%d at %d of %s\n", total, int(ak.size()), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
 
+    { // MirrorScene - a single mirror traces as ConcaveRayKernel() (the Obscured case included), and neighbors shade
+        MirrorScene scene;
+        scene.m_arcs.push_back( MirrorArc( Point(0,0), 30, 230, 310 ) );
+        scene.Build();
+        static const double test_points[] = { // In sets of 2: target normal direction, incident direction
+            270, 270,   240, 270,   300, 280,   235, 300,   305, 230,   250, 90,    231, 350
+        };
+        for (int ii=0; ii<sizeof(test_points)/sizeof(test_points[0]); ii+=2) {
+            double reflect1, reflect2;
+            Point exit1, exit2;
+            unsigned strikes1, strikes2;
+            TracedRay::RayStatus status1 = ConcaveRayKernel( Point(0,0), 30, 230, 310, test_points[ii+1], test_points[ii], reflect1, exit1, strikes1 );
+            TracedRay::RayStatus status2 = scene.Trace( 0, test_points[ii], test_points[ii+1], reflect2, exit2, strikes2 );
+            bool reflected = (status1 >= TracedRay::NStrike);
+            if ( (status1 != status2) || (reflected && ( !NearlyEqual( reflect1, reflect2, SmallValue, 0.0001 ) || (strikes1 != strikes2) )) ) {
+                printf("Test failure: MirrorScene::Trace(%g,%g)=%s,%g,%u - expected %s,%g,%u at %d of %s\n", test_points[ii], test_points[ii+1],
+                        Name(status2), reflect2, strikes2, Name(status1), reflect1, strikes1, __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+        MirrorScene stack; // a 2nd mirror above and to the right of the 1st - shades (some of) it, and blocks (some of) its reflections
+        stack.m_arcs.push_back( MirrorArc( Point(0,10), 10, 240, 300 ) );
+        stack.m_arcs.push_back( MirrorArc( Point(6,15), 10, 240, 300 ) );
+        stack.Build();
+        static const double stack_points[] = { // In sets of 4: mirror, target normal direction, incident direction, expected status
+            0, 290, 270, TracedRay::Obscured,       0, 240, 230, TracedRay::Unobscured,
+            1, 270, 270, TracedRay::Unobscured,     0, 260, 280, TracedRay::Blocked
+        };
+        for (int ii=0; ii<sizeof(stack_points)/sizeof(stack_points[0]); ii+=4) {
+            double reflect;
+            Point exit;
+            unsigned strikes;
+            TracedRay::RayStatus status = stack.Trace( unsigned(stack_points[ii]), stack_points[ii+1], stack_points[ii+2], reflect, exit, strikes );
+            if (status != TracedRay::RayStatus(stack_points[ii+3])) {
+                printf("Test failure: MirrorScene::Trace(%g,%g,%g)=%s, expected %s at %d of %s\n", stack_points[ii], stack_points[ii+1], stack_points[ii+2],
+                        Name(status), Name(TracedRay::RayStatus(stack_points[ii+3])), __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+        TheData field; // the sun below the mirrors - no flux in, so the shading and blocking fractions are undefined (not NaN)
+        for (int mm=0; mm<6; mm++) field.m_scene.m_arcs.push_back( MirrorArc( Point(mm*5, 6), 1000, 240, 300 ) );
+        field.m_sun_dir = 90;
+        field.m_sun_samples = 1000;
+        field.Calculate(3, 0);
+        if ((field.GetValue("flux_in") != 0) || (field.GetValue("shading") != BadValue) || (field.GetValue("blocking") != BadValue)) {
+            printf("Test failure: mirror-field flux_in=%g, shading=%g, blocking=%g - expected 0 and undefined at %d of %s\n",
+                    field.GetValue("flux_in"), field.GetValue("shading"), field.GetValue("blocking"), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
 
-void CoordConverter::CacheCalc() const
-{
-    if (m_cache_is_stale) {
-        m_X_scale = (m_X_top_right_to - m_X_bot_left_to) / (m_X_top_right_from - m_X_bot_left_from);
-        m_Y_scale = (m_Y_top_right_to - m_Y_bot_left_to) / (m_Y_top_right_from - m_Y_bot_left_from);
+    { // ProfileMirror - fitted to points on a circle, traces (nearly) as ConcaveRayKernel()
+        std::vector<Point> points;
+        for (int ii=0; ii<=100; ii++) points.push_back( Find2ndPoint( Point(0,0), 230 + 80.0*ii/100, 30 ) );
+        ProfileMirror profile;
+        profile.Fit( points );
+        static const double test_points[] = { // In sets of 2: target normal direction, incident direction
+            270, 270,   240, 270,   300, 280,   235, 300,   305, 230,   250, 90,    250, 350
+        };
+        for (int ii=0; ii<sizeof(test_points)/sizeof(test_points[0]); ii+=2) {
+            double reflect1, reflect2;
+            Point exit1, exit2;
+            unsigned strikes1, strikes2;
+            TracedRay::RayStatus status1 = ConcaveRayKernel( Point(0,0), 30, 230, 310, test_points[ii+1], test_points[ii], reflect1, exit1, strikes1 );
+            TracedRay::RayStatus status2 = profile.Trace( 30 * to_radians( test_points[ii] - 230 ), test_points[ii+1], reflect2, exit2, strikes2 );
+            bool reflected = (status1 >= TracedRay::NStrike);
+            if ( (status1 != status2) || (reflected && ( !NearlyEqual( reflect1, reflect2, 0.0001, 0.01 ) || (strikes1 != strikes2) )) ) { // the spline is least accurate near its ends
+                printf("Test failure: ProfileMirror::Trace(%g,%g)=%s,%g,%u - expected %s,%g,%u at %d of %s\n", test_points[ii], test_points[ii+1],
+                        Name(status2), reflect2, strikes2, Name(status1), reflect1, strikes1, __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+    }
 
-        m_cache_is_stale = 0;
+    { // SolveConvexBatch() - matches Calculate_Convex() on the X axis, and rotates with the observer elsewhere
+        static const double test_points[] = { // In sets of 3: radius, distance, sun angle
+            1, 3, 181,      1, 1.7, 185,    1, 1.01, 200,   100, 1100, 270,     1, 10, 182.5
+        };
+        const int num_cases = sizeof(test_points)/sizeof(test_points[0])/3;
+        auto angle_error = [](double ang1, double ang2) { return fabs( NormalizeAngle( ang1 - ang2 + 180 ) - 180 ); };
+        for (int ii=0; ii<num_cases; ii++) {
+            TheData td;
+            td.m_IsConvex = 1;
+            td.m_radius   = test_points[3*ii];
+            td.m_distance = test_points[3*ii+1];
+            td.m_sun_dir  = test_points[3*ii+2];
+            td.Calculate(3, 1);
+
+            const double rotations[] = { 0, 30, -75, 180 };
+            ConvexBatch batch;
+            batch.Resize(4);
+            for (int rr=0; rr<4; rr++) {
+                batch.m_observer_x[rr] = td.m_distance * cos( to_radians(rotations[rr]) );
+                batch.m_observer_y[rr] = td.m_distance * sin( to_radians(rotations[rr]) );
+                batch.m_sun_dir[rr] = td.m_sun_dir + rotations[rr];
+            }
+            SolveConvexBatch(td, batch);
+            for (int rr=0; rr<4; rr++) {
+                Point mirror_pt = Find2ndPoint( Point(0,0), Direction( Point(0,0), td.m_SunMidMirrorPt ) + rotations[rr], td.m_radius );
+                if ( !batch.m_success[rr]
+                  || (angle_error( batch.m_observed_mid[rr], td.m_ObserverReflectedSunMid + rotations[rr] ) > 1e-6)
+                  || (angle_error( batch.m_observed_top[rr], td.m_ObserverReflectedSunTop + rotations[rr] ) > 1e-6)
+                  || !NearlyEqual( batch.m_mirror_x[rr], mirror_pt.x(), 0.0001, 1e-6 * td.m_radius )
+                  || !NearlyEqual( batch.m_mirror_y[rr], mirror_pt.y(), 0.0001, 1e-6 * td.m_radius )
+                  || !NearlyEqual( batch.m_brightness2[rr], td.m_Brightness2, 0.0001 ) ) {
+                    printf("Test failure: SolveConvexBatch(r=%g, d=%g, sa=%g, rotation=%g)=%d: observed=%g, mirror=(%g,%g), brightness2=%g - expected observed=%g, mirror=(%g,%g), brightness2=%g at %d of %s\n",
+                            td.m_radius, td.m_distance, td.m_sun_dir, rotations[rr], batch.m_success[rr], batch.m_observed_mid[rr], batch.m_mirror_x[rr], batch.m_mirror_y[rr], batch.m_brightness2[rr],
+                            NormalizeAngle( td.m_ObserverReflectedSunMid + rotations[rr] ), mirror_pt.x(), mirror_pt.y(), td.m_Brightness2, __LINE__, __FILE__ );
+                    fail_count++;
+                }
+                test_count++;
+            }
+        }
+        ConvexBatch inside; // an observer inside the mirror can't be solved
+        inside.Resize(1);
+        inside.m_observer_x[0] = 0.5; inside.m_observer_y[0] = 0; inside.m_sun_dir[0] = 181;
+        TheData td;
+        td.m_radius = 1;
+        SolveConvexBatch(td, inside);
+        if (inside.m_success[0] || (inside.m_brightness2[0] != BadValue)) {
+            printf("Test failure: SolveConvexBatch() succeeded for an observer inside the mirror at %d of %s\n", __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+
+        ConvexBatch warm; // ConvexBatch::Solve() warm-started from a neighbor's solution - exactly as from scratch
+        warm.m_radius = 100;
+        warm.Resize(2);
+        for (int ii=0; ii<2; ii++) { warm.m_observer_x[ii] = 150; warm.m_observer_y[ii] = 0; warm.m_sun_dir[ii] = 120; }
+        TheData scratch;
+        warm.Solve(0, scratch);
+        warm.Solve(1, scratch, warm.m_normal_mid[0] - 4, 0.5); // (a poor guess - the window has to be widened)
+        if ( !warm.m_success[1] || (warm.m_normal_mid[1] != warm.m_normal_mid[0]) || (warm.m_brightness2[1] != warm.m_brightness2[0]) ) {
+            printf("Test failure: ConvexBatch::Solve() warm-started=%d,%g,%g - expected %g,%g at %d of %s\n", warm.m_success[1],
+                    warm.m_normal_mid[1], warm.m_brightness2[1], warm.m_normal_mid[0], warm.m_brightness2[0], __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
     }
-}
 
-void CoordConverter::DefineFrom(double x_bot_left, double y_bot_left, double x_top_right, double y_top_right)
-{
-    m_X_bot_left_from = x_bot_left;
-           m_Y_bot_left_from = y_bot_left;
-    m_X_top_right_from = x_top_right;
-    m_Y_top_right_from = y_top_right;
-    m_cache_is_stale = 1;
-}
+    { // TraceFan_Convex() - a narrow fan about the axis focuses (virtually) half the radius behind the mirror
+        TheData td;
+        td.m_IsConvex = 1;
+        td.m_convex_fan = true;
+        td.m_radius = 1;
+        td.m_distance = 3;
+        td.m_sun_dir = 180;
+        td.m_min_normal_dir = 359;
+        td.m_max_normal_dir = 361;
+        td.Calculate(101, 0);
+        double flux_in = 0;
+        for (size_t ii=0; ii<td.m_FanRays.Size(); ii++) flux_in += td.m_FanRays.m_weight[ii];
+        if ( (td.m_FanRays.Size() != 202) || !NearlyEqual( td.GetValue("ref_focal_d"), 0.5, 0.001, 0.001 )
+          || !NearlyEqual( td.GetValue("ref_spread"), 4 + td.m_sun_width_ang, 0.02, 0.1 ) || !NearlyEqual( flux_in, 4 * sin( to_radians(1) ) ) ) {
+            printf("Test failure: TraceFan_Convex(): %u rays, ref_focal_d=%g (expected 0.5), ref_spread=%g (expected ~%g), flux=%g (expected %g) at %d of %s\n",
+                    unsigned(td.m_FanRays.Size()), td.GetValue("ref_focal_d"), td.GetValue("ref_spread"), 4 + td.m_sun_width_ang,
+                    flux_in, 4 * sin( to_radians(1) ), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // ReflectionLUT - as ConcaveRayKernel() (interpolated within the uniform cells, traced across the boundaries)
+        ReflectionLUT lut( 30, 200, 340, 64 ); // (coarse - so many rays interpolate across a cell)
+        int status_differs = 0;
+        double max_error = 0;
+        for (size_t ii=0; ii<20000; ii++) {
+            double normal_dir = 200 + 140 * CounterRandom( 7, ii, 0 );
+            double incident_dir = normal_dir - 90 + 180 * CounterRandom( 7, ii, 1 );
+            double reflect1, reflect2, exit_normal_dir;
+            Point exit1;
+            unsigned strikes1, strikes2;
+            TracedRay::RayStatus status1 = ConcaveRayKernel( Point(0,0), 30, 200, 340, incident_dir, normal_dir, reflect1, exit1, strikes1 );
+            TracedRay::RayStatus status2 = lut.Trace( incident_dir, normal_dir, reflect2, exit_normal_dir, strikes2 );
+            if ((status1 != status2) || (strikes1 != strikes2)) { status_differs++; continue; }
+            if (status1 < TracedRay::NStrike) continue;
+            max_error = Max( max_error, fabs( NormalizeAngle( reflect1 - reflect2 + 180 ) - 180 ) );
+            max_error = Max( max_error, fabs( NormalizeAngle( Direction( Point(0,0), exit1 ) - exit_normal_dir + 180 ) - 180 ) );
+        }
+        if ((status_differs > 0) || (max_error > 1e-6)) {
+            printf("Test failure: ReflectionLUT - %d of 20000 rays' status differs, directions by up to %g at %d of %s\n",
+                    status_differs, max_error, __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // ParallelFor() - the workers are single-threaded, so a nested ParallelFor() runs inline (rather than N*N threads)
+        const int saved_threads = dvo_threads;
+        dvo_threads = 3;
+        std::vector<int> worker_threads(3, 0);
+        ParallelFor( worker_threads.size(), [&worker_threads](size_t begin, size_t end, unsigned) {
+            for (size_t ii=begin; ii<end; ii++) worker_threads[ii] = int( NumThreads(100) );
+        });
+        dvo_threads = saved_threads;
+        for (size_t ii=0; ii<worker_threads.size(); ii++) {
+            if (worker_threads[ii] != 1) {
+                printf("Test failure: ParallelFor() worker %d would use %d threads - expected 1 at %d of %s\n",
+                        int(ii), worker_threads[ii], __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+    }
+
+    { // smraytrc::Context - concurrent Contexts (with different -quality and -threads) get the same results as one-at-a-time
+        const char* qualities[] = { "fast", "default", "exact" };
+        std::vector<smraytrc::Config> configs( 6 );
+        for (size_t ii=0; ii<configs.size(); ii++) {
+            configs[ii].m_radius = 30;
+            configs[ii].m_sun_dir = 270 + 4 * ii;
+            configs[ii].m_min_normal_dir = 230;
+            configs[ii].m_max_normal_dir = 310;
+            configs[ii].m_num_rays = 11;
+            configs[ii].m_sun_samples = 20000;
+            configs[ii].m_farfield_bins = 50;
+            configs[ii].m_quality = qualities[ii % 3];
+            configs[ii].m_threads = 1 + ii % 2;
+        }
+        const char* names[] = { "ref_width", "ref_blur", "ff_w90", "quality_err" };
+        const size_t num_names = sizeof(names)/sizeof(names[0]);
+        std::vector<double> serial( configs.size() * num_names ), concurrent( configs.size() * num_names );
+        for (size_t ii=0; ii<configs.size(); ii++) {
+            smraytrc::Context context( configs[ii] );
+            context.Calculate();
+            for (size_t nn=0; nn<num_names; nn++) serial[ii*num_names + nn] = context.Value( names[nn] );
+        }
+        std::vector<std::thread> threads;
+        for (size_t ii=0; ii<configs.size(); ii++)
+            threads.push_back( std::thread( [&configs, &concurrent, &names, num_names, ii]() {
+                smraytrc::Context context( configs[ii] );
+                context.Calculate();
+                for (size_t nn=0; nn<num_names; nn++) concurrent[ii*num_names + nn] = context.Value( names[nn] );
+            } ) );
+        for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+        if ((serial != concurrent) || (serial[0*num_names + 3] == serial[1*num_names + 3]) || (dvo_quality != &quality_tiers[1])) {
+            printf("Test failure: smraytrc::Context - concurrent results differ from serial (or the quality tiers weren't applied) at %d of %s\n",
+                    __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // -serve - the results in the jobs' order (ids, or the line numbers), as a case calculated directly; and errors
+        FILE *fin = tmpfile(), *fout = tmpfile();
+        fprintf(fin, "-r 30 -sa 290 -nr 11\n# a comment\n\nsecond -r 30 -sa 270 -values ref_width,num_rays\n-r 30 -sa 280 -bogus\nbad -r 30 -sa 280 -values ref_width,bogus\n");
+        for (int ii=0; ii<50; ii++) fprintf(fin, "j%d -r 20 -sa %g\n", ii, 260 + 0.4 * ii);
+        rewind(fin);
+        CaseServer server;
+        server.m_base.m_min_normal_dir = 250;
+        server.m_base.m_max_normal_dir = 290;
+        server.m_values.push_back( "ref_width" );
+        int result = server.Run(fin, fout);
+        TheData td;
+        td.m_radius = 30; td.m_sun_dir = 290; td.m_min_normal_dir = 250; td.m_max_normal_dir = 290;
+        td.Calculate(11, 0);
+        char expect[200];
+        snprintf(expect, sizeof(expect), "1 ref_width=%.10g\n", td.GetValue("ref_width"));
+        std::vector<std::string> lines;
+        char buffer[200];
+        rewind(fout);
+        while (fgets(buffer, sizeof(buffer), fout)) lines.push_back( buffer );
+        bool in_order = (lines.size() == 54);
+        for (int ii=0; in_order && (ii<50); ii++) in_order = (lines[4+ii].find( "j" + std::to_string(ii) + " ref_width=" ) == 0);
+        if ((result != 1) || (server.m_jobs != 54) || (server.m_errors != 2) || !in_order || (lines[0] != expect)
+            || (lines[1].find("second ref_width=") != 0) || (lines[1].find(" num_rays=3") == std::string::npos) || (lines[2].find("5 ERROR") != 0)
+            || (lines[3] != "bad ERROR unknown value bogus\n")) {
+            printf("Test failure: -serve - %d jobs (%d errors), %d lines (1st: %s) at %d of %s\n",
+                    int(server.m_jobs), int(server.m_errors), int(lines.size()), lines.empty() ? "" : lines[0].c_str(), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        fclose(fin);
+        fclose(fout);
+        test_count++;
+    }
+
+    { // -jobs - a case per line, ranges expanded (the 1st fastest), and the settings before -jobs as each line's defaults
+        const char jobs[] = "# comment\n-r 30 -sa 290\r\n\n  -sa 250:260:5 -r 10:20:10 -target 1 2\n-mw 20 -sA 95";
+        TheData base;
+        base.m_min_normal_dir = 250;
+        base.m_sun_width_ang = 0.25;
+        std::deque<TheData> cases;
+        bool success = ParseJobs(jobs, sizeof(jobs)-1, "test", base, cases);
+        const double expect[] = { // radius, sun_dir, min_normal_dir, # target points
+            30, 290, 250, 0,   10, 250, 250, 1,   10, 255, 250, 1,   10, 260, 250, 1,
+            20, 250, 250, 1,   20, 255, 250, 1,   20, 260, 250, 1,   BadValue, 275, 250, 0 };
+        bool as_expected = success && (cases.size() == sizeof(expect)/sizeof(expect[0])/4);
+        for (size_t ii=0; as_expected && (ii<cases.size()); ii++)
+            as_expected = (cases[ii].m_radius == expect[ii*4]) && NearlyEqual(cases[ii].m_sun_dir, expect[ii*4+1], 0, 1e-9)
+                       && (cases[ii].m_min_normal_dir == expect[ii*4+2]) && (cases[ii].m_target_pts.size() == expect[ii*4+3])
+                       && (cases[ii].m_sun_width_ang == 0.25);
+        as_expected = as_expected && (cases.back().m_max_normal_dir == 290);
+        std::deque<TheData> bad_cases;
+        const char bad_jobs[] = "-r 30 -sa 290 -bogus 1\n";
+        const char bad_range[] = "-r 30 -sa 290 -mw 1:5:1\n"; // (-mw can't take a range)
+        const char huge_range[] = "-r 1:2000:1 -sa 0:360:0.5\n"; // (too many cases)
+        if (!as_expected || ParseJobs(bad_jobs, sizeof(bad_jobs)-1, "(an expected error)", base, bad_cases)
+         || ParseJobs(bad_range, sizeof(bad_range)-1, "(an expected error)", base, bad_cases)
+         || ParseJobs(huge_range, sizeof(huge_range)-1, "(an expected error)", base, bad_cases)) {
+            printf("Test failure: -jobs - %d cases (of %d) not as expected at %d of %s\n",
+                    int(cases.size()), int(sizeof(expect)/sizeof(expect[0])/4), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // -stencil-file and -target-file - text and packed binary records
+        const char text[] = "# X1 Y1 X2 Y2\n1 2 3 4\r\n\n  -5.5,6e1\t7 ,8\n9 10 11 12";
+        const double packed[] = { 1, 2, 3, 4, -5.5, 60, 7, 8, 9, 10, 11, 12 };
+        std::vector<double> from_text, from_packed, bad;
+        bool success = ParseNumbers(text, sizeof(text)-1, false, "test", 4, from_text)
+                    && ParseNumbers(reinterpret_cast<const char*>(packed), sizeof(packed), true, "test", 4, from_packed);
+        std::vector<double> expect( packed, packed + sizeof(packed)/sizeof(packed[0]) );
+        if (!success || (from_text != expect) || (from_packed != expect)
+            || ParseNumbers("1 2 3\n", 6, false, "(an expected error)", 2, bad) || ParseNumbers("1234567", 7, true, "(an expected error)", 2, bad)) {
+            printf("Test failure: ParseNumbers() - %d text and %d packed values at %d of %s\n", int(from_text.size()), int(from_packed.size()), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+
+        // A short record, and a partial record after the whole ones, are errors - and add none of their line's values
+        std::string partial( reinterpret_cast<const char*>(packed), sizeof(packed) );
+        partial.append( 4, '\0' );
+        if ( ParseNumbers("1 2 3 4\n5,6,7\n", 14, false, "(an expected error)", 4, bad) || (bad.size() != 4) || (bad[3] != 4)
+          || ParseNumbers(partial.data(), partial.size(), true, "(an expected error)", 4, bad) || (bad.size() != 4) ) {
+            printf("Test failure: ParseNumbers() - a short or partial record gave %d values at %d of %s\n", int(bad.size()), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+
+        // LoadNumbers() - a .bin file is packed doubles, any other text
+        const char record[] = "1 2 3 4\n";
+        const char* names[] = { "output_test_numbers.txt", "output_test_numbers.bin" };
+        std::vector<double> loaded[2];
+        for (int ff=0; ff<2; ff++) {
+            FILE* fout = fopen(names[ff], "wb");
+            if (fout) { fwrite(record, 1, sizeof(record)-1, fout); fclose(fout); }
+            LoadNumbers(names[ff], ff ? 1 : 4, loaded[ff]);
+            remove(names[ff]);
+        }
+        double as_double;
+        memcpy(&as_double, record, sizeof(as_double));
+        if ( (loaded[0] != std::vector<double>( expect.begin(), expect.begin()+4 )) || (loaded[1].size() != 1)
+          || memcmp(&loaded[1][0], &as_double, sizeof(as_double)) ) {
+            printf("Test failure: LoadNumbers() - %d text and %d packed values at %d of %s\n", int(loaded[0].size()), int(loaded[1].size()), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // TheData::m_outputs - the stages a value needs give it unchanged; the others are skipped
+        TheData full;
+        full.m_radius = 30; full.m_sun_dir = 270; full.m_min_normal_dir = 230; full.m_max_normal_dir = 310;
+        full.m_sun_samples = 20000; full.m_farfield_bins = 50;
+        TheData width_only, farfield_only;
+        width_only.DuplicateSettings( full );
+        farfield_only.DuplicateSettings( full );
+        width_only.m_outputs = TheData::OutputsFor( "ref_width" );
+        farfield_only.m_outputs = TheData::OutputsFor( "ff_w90" );
+        full.Calculate(21, 0);
+        width_only.Calculate(21, 0);
+        farfield_only.Calculate(21, 0);
+        TheData convex;
+        convex.m_IsConvex = true; convex.m_convex_fan = true; convex.m_radius = 1; convex.m_distance = 1.7; convex.m_sun_dir = 200;
+        TheData convex_fan;
+        convex_fan.DuplicateSettings( convex );
+        convex_fan.m_outputs = TheData::OutputsFor( "ref_width" );
+        convex.Calculate(11, 1);
+        convex_fan.Calculate(11, 1);
+        if ((width_only.GetValue("ref_width") != full.GetValue("ref_width")) || (farfield_only.GetValue("ff_w90") != full.GetValue("ff_w90"))
+            || (width_only.GetValue("num_samples") != 0) || (full.GetValue("num_samples") != 20000) || (full.m_SampleRays.Size() != 0) || !width_only.m_TopIntersectionPts.empty() || full.m_TopIntersectionPts.empty()
+            || !farfield_only.m_TopRays.empty() || (TheData::OutputsFor("sun_a") != 0) || (TheData::OutputsFor("d_ref_width") != OutAll)
+            || (convex_fan.GetValue("ref_width") != convex.GetValue("ref_width")) || (convex_fan.GetValue("pupil") != BadValue)
+            || (convex.GetValue("pupil") == BadValue)) {
+            printf("Test failure: m_outputs - ref_width %g (all %g), ff_w90 %g (all %g) at %d of %s\n", width_only.GetValue("ref_width"),
+                    full.GetValue("ref_width"), farfield_only.GetValue("ff_w90"), full.GetValue("ff_w90"), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // -quality - FastSinCos() within FastTrigError, ConcaveRayKernel_Angular() as ConcaveRayKernel(), and each tier's searches within its tolerance
+        double max_trig_error = 0;
+        for (double degrees=-720; degrees<=720; degrees += 0.37) {
+            double sin_value, cos_value;
+            FastSinCos( degrees, sin_value, cos_value );
+            max_trig_error = Max( max_trig_error, Max( fabs( sin_value - sin( to_radians( degrees ) ) ), fabs( cos_value - cos( to_radians( degrees ) ) ) ) );
+        }
+        int kernel_differs = 0;
+        for (double incident_dir=180; incident_dir<360; incident_dir += 7.3)
+            for (double normal_dir=200; normal_dir<=340; normal_dir += 3.1) {
+                double reflect1, reflect2, exit_x, exit_y;
+                Point exit1;
+                unsigned strikes1, strikes2;
+                TracedRay::RayStatus status1 = ConcaveRayKernel( Point(0,0), 30, 200, 340, incident_dir, normal_dir, reflect1, exit1, strikes1 );
+                TracedRay::RayStatus status2 = ConcaveRayKernel_Angular( 30, 200, 340, incident_dir, normal_dir, reflect2, exit_x, exit_y, strikes2 );
+                if ((status1 != status2) || ((status1 >= TracedRay::NStrike)
+                    && ((strikes1 != strikes2) || !NearlyEqual( reflect1, reflect2, 0, 1e-6 ) || !NearlyEqual( exit1, Point(exit_x, exit_y), 0, 1e-6 ))))
+                    kernel_differs++;
+            }
+        if ((max_trig_error > FastTrigError) || kernel_differs) {
+            printf("Test failure: FastSinCos() error=%g (expected <%g), ConcaveRayKernel_Angular() differs for %d rays at %d of %s\n",
+                    max_trig_error, FastTrigError, kernel_differs, __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+
+        const QualityTier* saved_quality = dvo_quality;
+        for (size_t qq=0; qq<sizeof(quality_tiers)/sizeof(quality_tiers[0]); qq++) {
+            dvo_quality = &quality_tiers[qq];
+            TheData concave;
+            concave.m_radius = 30;
+            concave.m_min_normal_dir = 230;
+            concave.m_max_normal_dir = 310;
+            concave.m_sun_dir = 259.9;
+            concave.m_target_pts.push_back( Point(0,-10) );
+            concave.Calculate(0, 0);
+            TheData convex;
+            convex.m_IsConvex = 1;
+            convex.m_radius = 1;
+            convex.m_distance = 3;
+            convex.m_sun_dir = 190;
+            convex.Calculate(0, 0);
+            if ( concave.m_TopRays.empty() || (concave.GetValue("quality_err") > dvo_quality->m_tolerance)
+              || (convex.GetValue("quality_err") > dvo_quality->m_tolerance) ) {
+                printf("Test failure: -quality %s - %d rays found, quality_err=%g (concave), %g (convex) - expected <=%g at %d of %s\n",
+                        dvo_quality->m_name, int(concave.m_TopRays.size()), concave.GetValue("quality_err"), convex.GetValue("quality_err"),
+                        dvo_quality->m_tolerance, __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+        dvo_quality = saved_quality;
+    }
+
+    { // -precision float - the sun-sample rays as traced in double (reflected directions to ~1e-4 degrees for a few strikes)
+        TheData td;
+        td.m_radius = 30;
+        td.m_sun_dir = 265;
+        td.m_min_normal_dir = 230;
+        td.m_max_normal_dir = 310;
+        td.m_sun_samples = 100000;
+        td.m_keep_sample_rays = true;
+        td.Calculate(3, 0);
+        TheData single;
+        single.DuplicateSettings( td );
+        single.m_single_precision = true;
+        single.Calculate(3, 0);
+        const RayBatch& rays = td.m_SampleRays;
+        const FloatRayBatch& float_rays = single.m_SampleRaysFloat;
+        int status_differs = 0;
+        double max_dir_error = 0, max_exit_error = 0;
+        for (size_t ii=0; ii<rays.Size() && ii<float_rays.Size(); ii++) {
+            if (rays.m_ray_status[ii] != float_rays.m_ray_status[ii]) { status_differs++; continue; }
+            if (!rays.Reflected(ii)) continue;
+            max_dir_error = Max( max_dir_error, fabs( MinAngle( rays.m_reflect_dir[ii] - float_rays.m_reflect_dir[ii] + 90 ) - 90 ) );
+            max_exit_error = Max( max_exit_error, Distance( Point( rays.m_exit_x[ii], rays.m_exit_y[ii] ), Point( float_rays.m_exit_x[ii], float_rays.m_exit_y[ii] ) ) );
+        }
+        if ( (single.GetValue("num_samples") != 100000) || (td.m_SampleRaysFloat.Size() != 0) || (status_differs > 10)
+          || (max_dir_error > 1e-3) || (max_exit_error > 1e-3) || !NearlyEqual( single.GetValue("flux_out"), td.GetValue("flux_out"), 1e-4 ) ) {
+            printf("Test failure: -precision float - %d statuses differ, reflected directions by up to %g, exits by %g, flux_out=%g (expected %g) at %d of %s\n",
+                    status_differs, max_dir_error, max_exit_error, single.GetValue("flux_out"), td.GetValue("flux_out"), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // SolarDeclinationEoT() and SunElevationAzimuth() - against published values (NOAA's solar calculator)
+        static const double test_points[] = { // In sets of 3: Julian day (0h UT), declination, equation of time (minutes)
+            2460482.5, 23.44, -1.8,     2460665.5, -23.44, 1.9,     2460617.5, -15.15, 16.45,   2460352.5, -13.93, -14.2
+        };
+        for (int ii=0; ii<sizeof(test_points)/sizeof(test_points[0]); ii+=3) {
+            double declination, eot_minutes;
+            SolarDeclinationEoT( test_points[ii], declination, eot_minutes );
+            if ( !NearlyEqual( declination, test_points[ii+1], 0.01, 0.1 ) || !NearlyEqual( eot_minutes, test_points[ii+2], 0.1, 0.2 ) ) {
+                printf("Test failure: SolarDeclinationEoT(%g)=%g,%g, expected %g,%g. ii=%d at %d of %s\n", test_points[ii],
+                        declination, eot_minutes, test_points[ii+1], test_points[ii+2], ii, __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+        double elevation, azimuth;
+        SunElevationAzimuth( 40, 23.44, 0, elevation, azimuth ); // noon at the June solstice - due south
+        double morning_dir = SunDirInPlane( 30, 90, 90 ); // sun in the east, plane's +X to the east - rays to the left and down
+        if ( !NearlyEqual( elevation, 73.44 ) || !NearlyEqual( azimuth, 180 ) || !NearlyEqual( SunDirInPlane( elevation, azimuth, 90 ), 270 )
+          || !NearlyEqual( morning_dir, 210 ) ) {
+            printf("Test failure: SunElevationAzimuth()=%g,%g (expected 73.44,180), SunDirInPlane()=%g (expected 210) at %d of %s\n",
+                    elevation, azimuth, morning_dir, __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // EventFinder - the convex reflection of the sun's upper limb vanishes past the tangent, i.e. at sun_A = 180 - asin(r/d) - sw/2
+        TheData settings;
+        settings.m_IsConvex = true;
+        settings.m_radius = 1;
+        settings.m_distance = 3;
+        EventFinder finder;
+        finder.m_parameter = "sun_A";
+        finder.m_from = 90;
+        finder.m_to = 270;
+        finder.m_metric = "brightness2";
+        finder.m_threshold = 0; // only undefined is a change
+        int evaluations;
+        std::vector<EventFinder::Event> events = finder.Find( settings, 0, 1, evaluations );
+        double expected = 180 - to_degrees( asin(1.0/3) ) - settings.m_sun_width_ang/2;
+        if ( (events.size() != 1) || !NearlyEqual( (events[0].m_low + events[0].m_high) / 2, expected, 1e-9, 1e-6 )
+          || (events[0].m_low_value == BadValue) || (events[0].m_high_value != BadValue) ) {
+            printf("Test failure: EventFinder::Find() found %d events, the first at %g, expected 1 at %g at %d of %s\n", int(events.size()),
+                    events.empty() ? BadValue : events[0].m_low, expected, __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // -gradient (Dual) - against central differences
+        struct { bool convex; const char* parameter; const char* metric; double step; } test_points[] = {
+            { false, "radius", "ref_blur", 0.01 },          { false, "sun_a", "ref_blur", 0.001 },
+            { false, "mirror_width", "ref_focal_d", 0.001 }, { false, "min_normal", "ref_width", 0.001 },
+            { true,  "distance", "brightness2", 0.001 },     { true,  "sun_A", "brightness2", 0.001 },
+            { true,  "radius", "pupil2", 0.001 }
+        };
+        for (int ii=0; ii<sizeof(test_points)/sizeof(test_points[0]); ii++) {
+            TheData cases[3];
+            for (int cc=0; cc<3; cc++) {
+                TheData& td = cases[cc];
+                td.m_IsConvex = test_points[ii].convex;
+                td.m_radius = td.m_IsConvex ? 1 : 30;
+                td.m_distance = td.m_IsConvex ? 3 : BadValue;
+                td.m_sun_dir = td.m_IsConvex ? 225 : 280;
+                td.m_min_normal_dir = 250;
+                td.m_max_normal_dir = 290;
+                if (cc) {
+                    td.SetParameter( test_points[ii].parameter, td.GetValue( test_points[ii].parameter ) + ((cc == 1) ? -1 : 1) * test_points[ii].step );
+                } else td.m_gradient_parameter = test_points[ii].parameter;
+                td.Calculate( 21, 1 );
+            }
+            double difference = (cases[2].GetValue( test_points[ii].metric ) - cases[1].GetValue( test_points[ii].metric )) / (2 * test_points[ii].step);
+            double derivative = cases[0].GetValue( std::string("d_") + test_points[ii].metric );
+            if (!NearlyEqual( derivative, difference, 0.01, 0.01 * fabs(difference) + 1e-5 )) {
+                printf("Test failure: -gradient d(%s)/d(%s)=%g, expected ~%g (central difference) at %d of %s\n",
+                        test_points[ii].metric, test_points[ii].parameter, derivative, difference, __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+    }
+
+    { // SobolPoint() and ParameterSampler - each parameter's first 2^k samples have one in each of 2^k equal intervals (strata)
+        const size_t count = 64;
+        ParameterSampler sampler;
+        for (int dd=0; dd<10; dd++) sampler.m_parameters.push_back( "radius" );
+        sampler.m_count = count;
+        for (int method=0; method<2; method++) {
+            sampler.m_method = method ? ParameterSampler::LatinHypercube : ParameterSampler::Sobol;
+            sampler.Prepare();
+            int unstratified = 0;
+            for (size_t dd=0; dd<sampler.m_parameters.size(); dd++) {
+                std::vector<int> strata( count, 0 );
+                for (size_t ii=0; ii<count; ii++) strata[ size_t( sampler.UnitCoordinate(ii, dd) * count ) ]++;
+                if (std::count( strata.begin(), strata.end(), 1 ) != int(count)) unstratified++;
+            }
+            if (unstratified) {
+                printf("Test failure: ParameterSampler(%s) - %d dimensions not stratified at %d of %s\n",
+                        method ? "lhs" : "sobol", unstratified, __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+        if ( !NearlyEqual( SobolPoint(1, 3), 0.5 ) || !NearlyEqual( SobolPoint(2, 0), 0.75 ) || !NearlyEqual( SobolPoint(2, 1), 0.25 )
+          || (SobolPoint(0, 10) != BadValue) ) {
+            printf("Test failure: SobolPoint() = %g, %g, %g (expected 0.5, 0.75, 0.25) at %d of %s\n",
+                    SobolPoint(1, 3), SobolPoint(2, 0), SobolPoint(2, 1), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // Optimizer - a bounded quadratic with its minimum inside the bounds, then (in the 2nd parameter) beyond them
+        for (int beyond=0; beyond<2; beyond++) {
+            Optimizer optimizer;
+            optimizer.m_parameters.push_back( "radius" );   optimizer.m_ranges.push_back( std::make_pair( 10.0, 50.0 ) );
+            optimizer.m_parameters.push_back( "distance" ); optimizer.m_ranges.push_back( std::make_pair( -5.0, 5.0 ) );
+            const double expected_y = beyond ? 5 : -2;
+            optimizer.Minimize( [&](const std::vector<double>& pp) -> double {
+                return (pp[0]-17) * (pp[0]-17) + 3 * (pp[1] - (beyond ? 8 : -2)) * (pp[1] - (beyond ? 8 : -2)) + (pp[0]-17) * pp[1] / 10;
+            });
+            const std::vector<double>& best = optimizer.m_trace[optimizer.m_best].m_parameters;
+            std::set< std::vector<double> > distinct;
+            for (auto it = optimizer.m_trace.begin(); it != optimizer.m_trace.end(); ++it) distinct.insert( it->m_parameters );
+            // the minimum (with the cross term): x = 17 - y/20
+            if ( !NearlyEqual( best[0], 17 - expected_y/20, 0, 0.01 ) || !NearlyEqual( best[1], expected_y, 0, 0.01 )
+              || (distinct.size() != optimizer.m_trace.size()) || (optimizer.m_trace.size() > 200) ) {
+                printf("Test failure: Optimizer = (%g, %g) (expected (%g, %g)) - %d evaluations (%d distinct) at %d of %s\n",
+                        best[0], best[1], 17 - expected_y/20, expected_y, int(optimizer.m_trace.size()), int(distinct.size()), __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+        // The same evaluations (and trace) with one thread as with several - the speculative ones count only if used
+        std::vector<double> traces[2];
+        const int saved_threads = dvo_threads;
+        for (int tt=0; tt<2; tt++) {
+            dvo_threads = tt ? 4 : 1;
+            Optimizer optimizer;
+            optimizer.m_parameters.push_back( "radius" );   optimizer.m_ranges.push_back( std::make_pair( 10.0, 50.0 ) );
+            optimizer.m_parameters.push_back( "distance" ); optimizer.m_ranges.push_back( std::make_pair( -5.0, 5.0 ) );
+            optimizer.m_max_evaluations = 40;
+            optimizer.Minimize( [](const std::vector<double>& pp) -> double { return fabs(pp[0]-23) + (pp[1]-1) * (pp[1]-1); } );
+            for (auto it = optimizer.m_trace.begin(); it != optimizer.m_trace.end(); ++it)
+                traces[tt].insert( traces[tt].end(), it->m_parameters.begin(), it->m_parameters.end() );
+        }
+        dvo_threads = saved_threads;
+        if (traces[0] != traces[1]) {
+            printf("Test failure: Optimizer - %d evaluations with 1 thread, %d with 4 (or a different order) at %d of %s\n",
+                    int(traces[0].size()/2), int(traces[1].size()/2), __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // AdaptiveSweep - refines only around the convex tangent event (see EventFinder above), and interpolates a linear metric exactly
+        TheData settings;
+        settings.m_IsConvex = true;
+        settings.m_radius = 1;
+        settings.m_distance = 3;
+        AdaptiveSweep sweep;
+        sweep.m_parameters.push_back( "sun_A" );
+        sweep.m_axes.push_back( std::vector<double>() );
+        for (int aa=90; aa<=270; aa+=30) sweep.m_axes[0].push_back( aa );
+        sweep.m_metric = "brightness2";
+        sweep.m_tolerance = 0.05;
+        sweep.m_max_depth = 6;
+        sweep.Run( settings, 0, 1 );
+        double expected = 180 - to_degrees( asin(1.0/3) ) - settings.m_sun_width_ang/2;
+        bool bracketed = false;
+        for (auto it = sweep.m_samples.begin(); it != sweep.m_samples.end(); ++it) {
+            auto next = it; ++next;
+            if ((next != sweep.m_samples.end()) && (next->first[0] == it->first[0] + 1)
+              && (it->second[0] != BadValue) && (next->second[0] == BadValue)
+              && (sweep.Coordinate( 0, it->first[0] ) <= expected) && (sweep.Coordinate( 0, next->first[0] ) >= expected)) bracketed = true;
+        }
+        if (!bracketed || (sweep.m_samples.size() > 30)) {
+            printf("Test failure: AdaptiveSweep::Run() - %d samples, event at %g %sbracketed at %d of %s\n",
+                    int(sweep.m_samples.size()), expected, bracketed ? "" : "NOT ", __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+
+        AdaptiveSweep linear;
+        linear.m_parameters.push_back( "radius" );
+        linear.m_parameters.push_back( "distance" );
+        linear.m_axes.push_back( std::vector<double>( { 1, 2, 3 } ) );
+        linear.m_axes.push_back( std::vector<double>( { 3, 5 } ) );
+        linear.m_metric = "distance";
+        linear.m_tolerance = 100;
+        linear.m_max_depth = 2;
+        linear.Run( settings, 0, 0 );
+        double resampled = linear.Resample( AdaptiveSweep::LatticePt( { 2, 2 } ), 0 ); // radius=1.5, distance=4
+        if ((linear.m_samples.size() != 6) || (linear.m_depth_reached != 0) || !NearlyEqual( resampled, 4 )) {
+            printf("Test failure: AdaptiveSweep - %d samples (expected 6), depth %d (expected 0), resampled %g (expected 4) at %d of %s\n",
+                    int(linear.m_samples.size()), linear.m_depth_reached, resampled, __LINE__, __FILE__ );
+            fail_count++;
+        }
+        test_count++;
+    }
+
+    { // HistogramQuantile() - from a flat histogram of 4 bins from 10 to 14
+        std::vector<double> bins(4, 2.0);
+        static const double test_points[] = { // In sets of 2: fraction, expected position
+            0.0, 10.0,      0.25, 11.0,     0.5, 12.0,      0.9, 13.6,      1.0, 14.0
+        };
+        for (int ii=0; ii<sizeof(test_points)/sizeof(test_points[0]); ii+=2) {
+            double result = HistogramQuantile( bins, 10.0, 1.0, test_points[ii] );
+            if ( ! NearlyEqual( result, test_points[ii+1] ) ) {
+                printf("Test failure: HistogramQuantile(%g)=%g, expected %g. ii=%d at %d of %s\n",
+                        test_points[ii], result, test_points[ii+1], ii, __LINE__, __FILE__ );
+                fail_count++;
+            }
+            test_count++;
+        }
+    }
+
+    if (fail_count)
+        printf("%s(): FAILED %d of %d test-steps.\n", __func__, fail_count, test_count );
+    else
+        printf("%s(): PASSED all %d test-steps.\n", __func__, test_count );
+
+    return fail_count;
+}
 
-void CoordConverter::DefineTo(double x_bot_left, double y_bot_left, double x_top_right, double y_top_right)
-{
-    m_X_bot_left_to = x_bot_left;
-           m_Y_bot_left_to = y_bot_left;
-    m_X_top_right_to = x_top_right;
-    m_Y_top_right_to = y_top_right;
-    m_cache_is_stale = 1;
-}
+
+void CoordConverter::CacheCalc() const
+{
+    if (m_cache_is_stale) {
+        m_X_scale = (m_X_top_right_to - m_X_bot_left_to) / (m_X_top_right_from - m_X_bot_left_from);
+        m_Y_scale = (m_Y_top_right_to - m_Y_bot_left_to) / (m_Y_top_right_from - m_Y_bot_left_from);
+
+        m_cache_is_stale = 0;
+    }
+}
+
+void CoordConverter::DefineFrom(double x_bot_left, double y_bot_left, double x_top_right, double y_top_right)
+{
+    m_X_bot_left_from = x_bot_left;
+           m_Y_bot_left_from = y_bot_left;
+    m_X_top_right_from = x_top_right;
+    m_Y_top_right_from = y_top_right;
+    m_cache_is_stale = 1;
+}
+
+void CoordConverter::DefineTo(double x_bot_left, double y_bot_left, double x_top_right, double y_top_right)
+{
+    m_X_bot_left_to = x_bot_left;
+           m_Y_bot_left_to = y_bot_left;
+    m_X_top_right_to = x_top_right;
+    m_Y_top_right_to = y_top_right;
+    m_cache_is_stale = 1;
+}
 
 
 double CoordConverter::X(double from_X) const
@@ -1672,7 +4880,7 @@ void TheData::RayReport(FILE *fout, unsigned level) const
     }
 }
 
-bool TheData::GenSVG_Concave(FILE *fout, double offset_X, double offset_Y, const std::string& title, bool first_call, bool last_call, int animate, int animate_interval_ms, bool do_boxes, bool focal_pts) const
+bool TheData::GenSVG_Concave(FILE *fout, double offset_X, double offset_Y, const std::string& title, int& ray_index, bool first_call, bool last_call, int animate, int animate_interval_ms, bool do_boxes, bool focal_pts) const
 {
     // Intend for a 10% margin/borders.
     // As always with SVG, increasing X is to the right, and increase Y is DOWN the screen.
@@ -1813,7 +5021,6 @@ bool TheData::GenSVG_Concave(FILE *fout, double offset_X, double offset_Y, const
          * id(tag): something like ray_sun_7, ray_7_2, ray_final_7 - used to allow javascript to locate the segment in the DOM to support animation. The
          *      2nd form (ray_7_2), means the 2nd reflected ray of traced-ray #7.
          */
-        static int ray_index = 0; // For class creation
         for (int tri=0; tri<sizeof(traced_rays)/sizeof(traced_rays[0]); tri++) { 
             for (auto it = traced_rays[tri]->begin(); it != traced_rays[tri]->end(); ++it) {
                 if ( ! it->m_StrikePts.empty() ) {
@@ -2097,7 +5304,7 @@ bool TheData::GenSVG_Concave(FILE *fout, double offset_X, double offset_Y, const
         fprintf(fout, "</svg>\n");
     }
 
-
+    return true;
 }
 
 
@@ -2108,7 +5315,19 @@ struct arg_iterator
     std::deque<double> value_list;
 
     double GetValue(int index, int &bad_index) const;
+    std::vector<double> Values() const; // all of them
 };
+std::vector<double> arg_iterator::Values() const
+{
+    std::vector<double> values;
+    int bad_index = 0;
+    for (int index=0; ; index++) {
+        double value = GetValue(index, bad_index);
+        if (bad_index) break;
+        values.push_back( value );
+    }
+    return values;
+}
 double arg_iterator::GetValue(int index, int &bad_index) const
 {
     bad_index = 0;
@@ -2123,112 +5342,1274 @@ double arg_iterator::GetValue(int index, int &bad_index) const
         else if ((from > to) && (value < to)) bad_index=1;
         return value;
     }
-    // Else
-    if (index < value_list.size()) return value_list[index];
-    bad_index = 1;
-    return 0;
+    // Else
+    if (index < value_list.size()) return value_list[index];
+    bad_index = 1;
+    return 0;
+}
+
+void GrabIteratorArgs( int &arg_index, int argc, const char* argv[], const char* param_name, arg_iterator &arg_it)
+{
+    arg_it.parameter_name = param_name;
+
+    if (isdigit(argv[arg_index+1][0]) || ((argv[arg_index+1][0] == '-') && isdigit(argv[arg_index+1][1]))) {
+        arg_index++;
+        arg_it.increment = 0;
+        arg_it.from  = arg_it.to = atof(argv[arg_index]);
+    }
+    if (isdigit(argv[arg_index+1][0]) || ((argv[arg_index+1][0] == '-') && isdigit(argv[arg_index+1][1]))) {
+        arg_index++;
+        arg_it.to = atof(argv[arg_index]);
+    }
+    if (isdigit(argv[arg_index+1][0]) || ((argv[arg_index+1][0] == '-') && isdigit(argv[arg_index+1][1]))) {
+        arg_index++;
+        double value = atof(argv[arg_index]);
+        if (value < arg_it.to) {
+            arg_it.increment = value;
+            return;
+        }
+        // else take as a list of values
+        arg_it.value_list.push_back(arg_it.from);
+        arg_it.value_list.push_back(arg_it.to);
+        arg_it.value_list.push_back(value);
+        arg_it.from = arg_it.to = 0.0;
+        while (    argv[arg_index+1] &&
+              (argv[arg_index+1][0] != '\0') &&
+              (isdigit(argv[arg_index+1][0]) || ((argv[arg_index+1][0] == '-') && isdigit(argv[arg_index+1][1]))) ) {
+            arg_index++;
+            arg_it.value_list.push_back( atof(argv[arg_index]) );
+        }
+    }
+}
+
+
+void PrintPivot(const std::string& row_param, const std::string& value_param,
+                const std::vector<double>& rows, const std::vector<double>& cols, const std::vector<double>& values)
+    // Prints the (row, col, value) triples as a table (CSV) - a row for each distinct row value, a column for each distinct col value.
+{
+    std::set<double> row_values_set( rows.begin(), rows.end() );
+    std::set<double> col_values_set( cols.begin(), cols.end() );
+
+    int row_index = 0;
+    std::map<double,int> row_indices;
+    std::deque<double> row_values( row_values_set.size() );
+    for (auto it = row_values_set.begin(); it != row_values_set.end(); ++it) {
+        row_indices.insert( std::pair<double,int>( *it, row_index ) );
+        row_values[row_index] = *it;
+        row_index++;
+    }
+
+    int col_index = 0;
+    std::map<double,int> col_indices;
+    std::deque<double> col_values( col_values_set.size() );
+    for (auto it = col_values_set.begin(); it != col_values_set.end(); ++it) {
+        col_indices.insert( std::pair<double,int>( *it, col_index ) );
+        col_values[col_index] = *it;
+        col_index++;
+    }
+
+
+    std::deque< std::deque<double> > two_d(row_index);
+    for (auto it = two_d.begin(); it != two_d.end(); ++it)
+        it->resize(col_index);
+
+    for (size_t ii=0; ii<values.size(); ii++)
+        two_d[ row_indices.find( rows[ii] )->second ][ col_indices.find( cols[ii] )->second ] = values[ii];
+
+
+
+    printf("%s", row_param.c_str());
+    for (int ii=0; ii<col_index; ii++) {
+        printf(",%s_%g",value_param.c_str(), col_values[ii]);
+    }
+    printf("\n");
+    for (int rr=0; rr<row_index; rr++) {
+        printf("%g", row_values[rr] );
+        for (int cc=0; cc<col_index; cc++) {
+            if (two_d[rr][cc] == BadValue)    printf(",");
+            else                printf(",%g",  two_d[rr][cc]);
+        }
+        printf("\n");
+    }
+}
+
+void GenerateReport(const std::deque<TheData> &td,const std::string& row_param, const std::string& col_param, const std::string& value_param)
+{
+    std::vector<double> rows, cols, values;
+    for (auto it = td.begin(); it != td.end(); ++it) {
+        rows.push_back( it->GetValue(row_param) );
+        cols.push_back( it->GetValue(col_param) );
+        values.push_back( it->GetValue(value_param) );
+    }
+    PrintPivot( row_param, value_param, rows, cols, values );
+}
+
+
+struct SunPathSweep
+    /* -sun-path: runs a case for each time step from m_start to m_end - with the sun's direction from its position
+     * in the sky (SolarDeclinationEoT()) - and writes m_values (GetValue() names) for each, as CSV. Times are local mean
+     * solar time (i.e. UT at longitude 0, with no time-zone). Steps with the sun below the horizon are skipped.
+     * The steps are calculated in chunks - each chunk's cases in parallel (see -threads) - and written as each chunk completes.
+     */
+{
+    double m_latitude;
+    double m_plane_azimuth; // the model's +X axis points this way (degrees clockwise from north)
+    time_t m_start, m_end;
+    double m_step_minutes;
+    std::vector<std::string> m_values;
+
+    SunPathSweep() : m_latitude(BadValue), m_plane_azimuth(0), m_start(0), m_end(0), m_step_minutes(0) {};
+    bool Defined() const { return m_latitude != BadValue; }
+    int Run(const TheData& settings, int num_rays, int do_pupil, FILE *fout) const;
+};
+
+int SunPathSweep::Run(const TheData& settings, int num_rays, int do_pupil, FILE *fout) const
+{
+    if ((m_step_minutes <= 0) || (m_end < m_start)) {
+        fprintf(stderr, "Error: -sun-path needs a time step >0 and an end time no earlier than the start.\n");
+        return 1;
+    }
+    TheData base;
+    for (auto it = m_values.begin(); it != m_values.end(); ++it) {
+        bool known;
+        base.GetValue( *it, known );
+        if (! known) {
+            fprintf(stderr, "Error: -sun-path doesn't know the value %s.\n", it->c_str() );
+            return 1;
+        }
+    }
+    base.DuplicateSettings(settings);
+    base.DefaultSunSamples();
+
+    fprintf(fout, "time,elevation,azimuth,sun_a");
+    for (auto it = m_values.begin(); it != m_values.end(); ++it) fprintf(fout, ",%s", it->c_str());
+    fprintf(fout, "\n");
+
+    const size_t chunk_size = 4096;
+    const size_t num_values = m_values.size();
+    const size_t num_steps = size_t( (m_end - m_start) / (60 * m_step_minutes) ) + 1;
+    std::vector<time_t> times;
+    std::vector<double> elevations, azimuths, sun_dirs, results;
+    long cached_day = -1; // the declination and equation of time are interpolated across each day
+    double dec0 = 0, dec1 = 0, eot0 = 0, eot1 = 0;
+    for (size_t first=0; first<num_steps; first += chunk_size) {
+        // The sun's position - for the steps (of this chunk) that are in daylight
+        times.clear(); elevations.clear(); azimuths.clear(); sun_dirs.clear();
+        for (size_t step=first; (step < num_steps) && (step < first + chunk_size); step++) {
+            time_t when = m_start + time_t( step * m_step_minutes * 60 );
+            long day = long( when / 86400 );
+            double day_minutes = (when - day * 86400.0) / 60;
+            if (day != cached_day) {
+                double julian_day = 2440587.5 + day; // at 0h
+                SolarDeclinationEoT( julian_day,     dec0, eot0 );
+                SolarDeclinationEoT( julian_day + 1, dec1, eot1 );
+                cached_day = day;
+            }
+            double fraction = day_minutes / 1440;
+            double declination = dec0 + fraction * (dec1 - dec0);
+            double eot_minutes = eot0 + fraction * (eot1 - eot0);
+            double hour_angle = (day_minutes + eot_minutes) / 4 - 180; // true solar time - as an angle from noon
+            double elevation, azimuth;
+            SunElevationAzimuth( m_latitude, declination, hour_angle, elevation, azimuth );
+            if (elevation <= 0) continue; // night
+            times.push_back( when );
+            elevations.push_back( elevation );
+            azimuths.push_back( azimuth );
+            sun_dirs.push_back( SunDirInPlane( elevation, azimuth, m_plane_azimuth ) );
+        }
+
+        // The cases - in parallel
+        results.resize( times.size() * num_values );
+        ParallelFor( times.size(), [&](size_t begin, size_t end, unsigned) {
+            for (size_t ii=begin; ii<end; ii++) {
+                TheData work;
+                work.DuplicateSettings( base );
+                work.m_sun_dir = sun_dirs[ii];
+                work.Calculate( num_rays, do_pupil );
+                for (size_t vv=0; vv<num_values; vv++) results[ii * num_values + vv] = work.GetValue( m_values[vv] );
+            }
+        });
+
+        for (size_t ii=0; ii<times.size(); ii++) {
+            char buffer[40];
+            struct tm tm_value;
+            gmtime_r( &times[ii], &tm_value );
+            strftime( buffer, sizeof(buffer), "%Y-%m-%d %H:%M", &tm_value );
+            fprintf(fout, "%s,%g,%g,%g", buffer, elevations[ii], azimuths[ii], sun_dirs[ii] );
+            for (size_t vv=0; vv<num_values; vv++) {
+                double value = results[ii * num_values + vv];
+                if (value == BadValue) fprintf(fout, ",");
+                else                   fprintf(fout, ",%g", value);
+            }
+            fprintf(fout, "\n");
+        }
+    }
+    return 0;
+}
+
+
+bool ParameterSampler::Prepare()
+{
+    if ((m_method == Sobol) && (SobolPoint( 0, m_parameters.size()-1 ) == BadValue)) return false;
+    m_strata.clear();
+    if (m_method == LatinHypercube) {
+        std::vector< std::pair<double,uint32_t> > keys( m_count );
+        m_strata.resize( m_parameters.size(), std::vector<uint32_t>( m_count ) );
+        for (size_t dd=0; dd<m_parameters.size(); dd++) { // a random permutation of the strata - for each dimension
+            for (size_t ii=0; ii<m_count; ii++) keys[ii] = std::make_pair( CounterRandom( m_seed, ii, 2*dd ), uint32_t(ii) );
+            std::sort( keys.begin(), keys.end() );
+            for (size_t ii=0; ii<m_count; ii++) m_strata[dd][ keys[ii].second ] = ii;
+        }
+    }
+    return true;
+}
+
+double ParameterSampler::UnitCoordinate(size_t sample, size_t dimension) const
+{
+    if (m_method == Sobol) return SobolPoint( sample, dimension );
+    return (m_strata[dimension][sample] + CounterRandom( m_seed, sample, 2*dimension+1 )) / m_count;
+}
+
+int ParameterSampler::Run(const TheData& settings, int num_rays, int do_pupil, FILE *fout)
+{
+    for (auto it = m_parameters.begin(); it != m_parameters.end(); ++it)
+        if (! TheData::CanSetParameter( *it )) {
+            fprintf(stderr, "Error: -sample can't vary %s.\n", it->c_str() );
+            return 1;
+        }
+    for (auto it = m_values.begin(); it != m_values.end(); ++it) {
+        bool known;
+        TheData().GetValue( *it, known );
+        if (! known) {
+            fprintf(stderr, "Error: -sample doesn't know the value %s.\n", it->c_str() );
+            return 1;
+        }
+    }
+    if (m_parameters.empty() || !Prepare()) {
+        fprintf(stderr, "Error: -sample needs from 1 to 10 -iterate parameters (each with a from and to value).\n");
+        return 1;
+    }
+    TheData base;
+    base.DuplicateSettings(settings);
+    base.DefaultSunSamples();
+
+    fprintf(fout, "sample");
+    for (auto it = m_parameters.begin(); it != m_parameters.end(); ++it) fprintf(fout, ",%s", it->c_str());
+    fprintf(fout, ",name,value\n");
+
+    const size_t chunk_size = 4096;
+    const size_t num_parameters = m_parameters.size();
+    const size_t num_values = m_values.size();
+    std::vector<double> parameters, results;
+    for (size_t first=0; first<m_count; first += chunk_size) {
+        size_t count = Min( chunk_size, m_count - first );
+        parameters.resize( count * num_parameters );
+        for (size_t ii=0; ii<count; ii++)
+            for (size_t dd=0; dd<num_parameters; dd++)
+                parameters[ii * num_parameters + dd] = m_ranges[dd].first
+                    + (m_ranges[dd].second - m_ranges[dd].first) * UnitCoordinate( first + ii, dd );
+
+        // The cases - in parallel
+        results.resize( count * num_values );
+        ParallelFor( count, [&](size_t begin, size_t end, unsigned) {
+            for (size_t ii=begin; ii<end; ii++) {
+                TheData work;
+                work.DuplicateSettings( base );
+                for (size_t dd=0; dd<num_parameters; dd++) work.SetParameter( m_parameters[dd], parameters[ii * num_parameters + dd] );
+                work.Calculate( num_rays, do_pupil );
+                for (size_t vv=0; vv<num_values; vv++) results[ii * num_values + vv] = work.GetValue( m_values[vv] );
+            }
+        });
+
+        for (size_t ii=0; ii<count; ii++)
+            for (size_t vv=0; vv<num_values; vv++) {
+                fprintf(fout, "%u", unsigned(first + ii) );
+                for (size_t dd=0; dd<num_parameters; dd++) fprintf(fout, ",%.10g", parameters[ii * num_parameters + dd] );
+                double value = results[ii * num_values + vv];
+                if (value == BadValue) fprintf(fout, ",%s,\n", m_values[vv].c_str() );
+                else                   fprintf(fout, ",%s,%g\n", m_values[vv].c_str(), value );
+            }
+    }
+    return 0;
+}
+
+
+template <typename Cost> void Optimizer::Evaluate(const std::vector< std::vector<double> >& points, std::vector<double>& costs, Cost& cost,
+                                                  bool speculative)
+{
+    // The points not yet evaluated (each once) - in parallel
+    std::vector<size_t> missing;
+    std::set< std::vector<double> > pending;
+    for (size_t ii=0; ii<points.size(); ii++) {
+        if (m_cache.count( points[ii] ) || pending.count( points[ii] )) {
+            if (! speculative) m_cache_hits++;
+            continue;
+        }
+        pending.insert( points[ii] );
+        if (! m_speculated.count( points[ii] )) missing.push_back( ii );
+    }
+
+    const size_t num_parameters = m_parameters.size();
+    std::vector<Evaluation> evaluations( missing.size() );
+    ParallelFor( missing.size(), [&](size_t begin, size_t end, unsigned) {
+        for (size_t ii=begin; ii<end; ii++) {
+            Evaluation& evaluation = evaluations[ii];
+            evaluation.m_parameters.resize( num_parameters );
+            for (size_t dd=0; dd<num_parameters; dd++)
+                evaluation.m_parameters[dd] = m_ranges[dd].first + (m_ranges[dd].second - m_ranges[dd].first) * points[ missing[ii] ][dd];
+            evaluation.m_cost = cost( evaluation.m_parameters );
+            evaluation.m_iteration = m_iterations;
+        }
+    });
+
+    for (size_t ii=0; ii<missing.size(); ii++) m_speculated[ points[ missing[ii] ] ] = evaluations[ii];
+    if (speculative) return;
+
+    // Into m_trace - in the points' order
+    for (size_t ii=0; ii<points.size(); ii++) {
+        auto it = m_speculated.find( points[ii] );
+        if (it == m_speculated.end()) continue; // (cached)
+        it->second.m_iteration = m_iterations;
+        if (m_trace.empty() || (it->second.m_cost < m_trace[m_best].m_cost)) m_best = m_trace.size();
+        m_cache[ points[ii] ] = m_trace.size();
+        m_trace.push_back( it->second );
+        m_speculated.erase( it );
+    }
+    costs.resize( points.size() );
+    for (size_t ii=0; ii<points.size(); ii++) costs[ii] = m_trace[ m_cache[ points[ii] ] ].m_cost;
+}
+
+template <typename Cost> void Optimizer::Minimize(Cost cost)
+{
+    const size_t num_parameters = m_parameters.size();
+    m_trace.clear();
+    m_cache.clear();
+    m_speculated.clear();
+    m_best = 0;
+    m_iterations = m_cache_hits = 0;
+
+    // The initial simplex - about the middle of the bounds
+    std::vector< std::vector<double> > simplex( num_parameters+1, std::vector<double>( num_parameters, 0.5 ) );
+    for (size_t dd=0; dd<num_parameters; dd++) simplex[dd+1][dd] = 0.75;
+    std::vector<double> costs;
+    Evaluate( simplex, costs, cost );
+
+    const bool speculate = NumThreads(4) > 1; // evaluate all the candidates together - rather than only those needed
+    std::vector<size_t> order( num_parameters+1 );
+    std::vector<double> centroid( num_parameters );
+    std::vector< std::vector<double> > candidates( 4, centroid ), one( 1 );
+    std::vector<double> candidate_costs, one_cost;
+    auto Candidate = [&](int cc) -> double { // cc: reflection, expansion, outside contraction, inside contraction
+        one[0] = candidates[cc];
+        Evaluate( one, one_cost, cost );
+        return one_cost[0];
+    };
+    while (int(m_trace.size()) < m_max_evaluations) {
+        for (size_t ii=0; ii<order.size(); ii++) order[ii] = ii;
+        std::stable_sort( order.begin(), order.end(), [&](size_t aa, size_t bb) { return costs[aa] < costs[bb]; } );
+        const size_t best = order.front(), worst = order.back(), second_worst = order[num_parameters-1 + (num_parameters == 0)];
+
+        double size = 0;
+        for (size_t ii=0; ii<simplex.size(); ii++)
+            for (size_t dd=0; dd<num_parameters; dd++) size = Max( size, fabs( simplex[ii][dd] - simplex[best][dd] ) );
+        if (size < m_tolerance) break;
+
+        // The candidates - along the line from the worst point through the centroid of the others
+        std::fill( centroid.begin(), centroid.end(), 0.0 );
+        for (size_t ii=0; ii<simplex.size(); ii++)
+            if (ii != worst)
+                for (size_t dd=0; dd<num_parameters; dd++) centroid[dd] += simplex[ii][dd] / num_parameters;
+        static const double steps[4] = { 1, 2, 0.5, -0.5 };
+        for (int cc=0; cc<4; cc++)
+            for (size_t dd=0; dd<num_parameters; dd++)
+                candidates[cc][dd] = Max( 0.0, Min( 1.0, centroid[dd] + steps[cc] * (centroid[dd] - simplex[worst][dd]) ) );
+        if (speculate) Evaluate( candidates, candidate_costs, cost, true );
+
+        const double reflected = Candidate(0);
+        int replacement = -1; // a candidate - or shrink
+        if (reflected < costs[best]) replacement = (Candidate(1) < reflected) ? 1 : 0;
+        else if (reflected < costs[second_worst]) replacement = 0;
+        else if (reflected < costs[worst]) replacement = (Candidate(2) <= reflected) ? 2 : -1;
+        else replacement = (Candidate(3) < costs[worst]) ? 3 : -1;
+
+        if (replacement >= 0) {
+            simplex[worst] = candidates[replacement];
+            costs[worst] = Candidate(replacement); // (cached)
+        } else { // shrink towards the best point
+            for (size_t ii=0; ii<simplex.size(); ii++)
+                for (size_t dd=0; dd<num_parameters; dd++) simplex[ii][dd] = simplex[best][dd] + 0.5 * (simplex[ii][dd] - simplex[best][dd]);
+            Evaluate( simplex, costs, cost );
+        }
+        m_iterations++;
+    }
+}
+
+int Optimizer::Run(const TheData& settings, int num_rays, int do_pupil)
+{
+    for (auto it = m_parameters.begin(); it != m_parameters.end(); ++it)
+        if (! TheData::CanSetParameter( *it )) {
+            fprintf(stderr, "Error: -optimize can't vary %s.\n", it->c_str() );
+            return 1;
+        }
+    if (m_parameters.empty()) {
+        fprintf(stderr, "Error: -optimize needs -iterate parameters (each with a from and to value).\n");
+        return 1;
+    }
+    TheData base;
+    base.DuplicateSettings(settings);
+    base.DefaultSunSamples();
+
+    Minimize( [&](const std::vector<double>& parameters) -> double {
+        TheData work;
+        work.DuplicateSettings( base );
+        for (size_t dd=0; dd<parameters.size(); dd++) work.SetParameter( m_parameters[dd], parameters[dd] );
+        work.Calculate( num_rays, do_pupil );
+        double value = work.GetValue( m_metric );
+        if (value == BadValue) return HUGE_VAL;
+        return m_maximize ? -value : value;
+    });
+
+    const Evaluation& best = m_trace[m_best];
+    if (best.m_cost == HUGE_VAL) {
+        fprintf(stderr, "Error: -optimize - %s isn't defined for any of the %d cases.\n", m_metric.c_str(), int(m_trace.size()) );
+        return 1;
+    }
+    printf("optimize: %s %s=%g at", m_metric.c_str(), m_maximize ? "maximum" : "minimum", m_maximize ? -best.m_cost : best.m_cost );
+    for (size_t dd=0; dd<m_parameters.size(); dd++) printf("%s %s=%.10g", dd ? "," : "", m_parameters[dd].c_str(), best.m_parameters[dd] );
+    printf(" (%d evaluations, %d iterations, %d cached)\n", int(m_trace.size()), m_iterations, m_cache_hits );
+    return 0;
+}
+
+void Optimizer::TraceReport(FILE *fout) const
+{
+    fprintf(fout, "evaluation,iteration");
+    for (auto it = m_parameters.begin(); it != m_parameters.end(); ++it) fprintf(fout, ",%s", it->c_str());
+    fprintf(fout, ",%s\n", m_metric.c_str());
+    for (size_t ii=0; ii<m_trace.size(); ii++) {
+        fprintf(fout, "%d,%d", int(ii), m_trace[ii].m_iteration );
+        for (size_t dd=0; dd<m_parameters.size(); dd++) fprintf(fout, ",%.10g", m_trace[ii].m_parameters[dd] );
+        if (m_trace[ii].m_cost == HUGE_VAL) fprintf(fout, ",\n");
+        else fprintf(fout, ",%g\n", m_maximize ? -m_trace[ii].m_cost : m_trace[ii].m_cost );
+    }
+}
+
+
+double EventFinder::Evaluate(const TheData& settings, double parameter_value, int num_rays, int do_pupil) const
+{
+    TheData work;
+    work.DuplicateSettings( settings );
+    work.SetParameter( m_parameter, parameter_value );
+    work.DefaultSunSamples();
+    work.Calculate( num_rays, do_pupil );
+    return work.GetValue( m_metric );
+}
+
+std::vector<EventFinder::Event> EventFinder::Find(const TheData& settings, int num_rays, int do_pupil, int& evaluations) const
+{
+    const int intervals = Max( m_intervals, 1 );
+
+    // The coarse scan
+    std::vector<double> scan( intervals+1 );
+    ParallelFor( scan.size(), [&](size_t begin, size_t end, unsigned) {
+        for (size_t ii=begin; ii<end; ii++) scan[ii] = Evaluate( settings, m_from + (m_to - m_from) * ii / intervals, num_rays, do_pupil );
+    });
+
+    // Bisect each bracketed change
+    std::vector<Event> events;
+    for (int ii=0; ii<intervals; ii++) {
+        if (Class(scan[ii]) == Class(scan[ii+1])) continue;
+        Event event = { m_from + (m_to - m_from) * ii / intervals, m_from + (m_to - m_from) * (ii+1) / intervals, scan[ii], scan[ii+1], 0 };
+        events.push_back( event );
+    }
+    const double tolerance = 1e-10 * fabs(m_to - m_from);
+    ParallelFor( events.size(), [&](size_t begin, size_t end, unsigned) {
+        for (size_t ee=begin; ee<end; ee++) {
+            Event& event = events[ee];
+            while ((fabs(event.m_high - event.m_low) > tolerance) && (event.m_evaluations < 100)) {
+                double middle = (event.m_low + event.m_high) / 2;
+                double value = Evaluate( settings, middle, num_rays, do_pupil );
+                event.m_evaluations++;
+                if (Class(value) == Class(event.m_low_value)) { event.m_low = middle; event.m_low_value = value; }
+                else { event.m_high = middle; event.m_high_value = value; } // (if a 3rd class - the 1st change is below middle)
+            }
+        }
+    });
+
+    evaluations = scan.size();
+    for (auto it = events.begin(); it != events.end(); ++it) evaluations += it->m_evaluations;
+    return events;
+}
+
+int EventFinder::Run(const TheData& settings, int num_rays, int do_pupil) const
+{
+    if (! TheData::CanSetParameter( m_parameter )) {
+        fprintf(stderr, "Error: -find-event can't vary %s. Expecting radius, distance, sun_a, sun_A, sun_width, min_normal, max_normal or mirror_width.\n",
+                m_parameter.c_str() );
+        return 1;
+    }
+
+    int evaluations;
+    std::vector<Event> events = Find( settings, num_rays, do_pupil, evaluations );
+
+    printf("find-event: %s from %g to %g, %s", m_parameter.c_str(), m_from, m_to, m_metric.c_str() );
+    if (m_threshold != BadValue) printf(" crossing %g", m_threshold );
+    printf(": %d event%s in %d evaluations\n", int(events.size()), (events.size() == 1) ? "" : "s", evaluations );
+    for (auto it = events.begin(); it != events.end(); ++it) {
+        char low_text[40], high_text[40];
+        if (it->m_low_value  == BadValue) strcpy(low_text,  "undefined"); else sprintf(low_text,  "%.10g", it->m_low_value );
+        if (it->m_high_value == BadValue) strcpy(high_text, "undefined"); else sprintf(high_text, "%.10g", it->m_high_value );
+        printf("%s=%.12g (+/-%.2g): %s=%s -> %s\n", m_parameter.c_str(), (it->m_low + it->m_high) / 2, fabs(it->m_high - it->m_low) / 2,
+               m_metric.c_str(), low_text, high_text );
+    }
+    return 0;
+}
+
+double AdaptiveSweep::Coordinate(size_t dimension, long lattice) const
+{
+    const std::vector<double>& axis = m_axes[dimension];
+    size_t index = lattice / Scale();
+    if (index + 1 >= axis.size()) return axis.back();
+    return axis[index] + (axis[index+1] - axis[index]) * double(lattice % Scale()) / Scale();
+}
+
+std::vector<AdaptiveSweep::LatticePt> AdaptiveSweep::CellPoints(const Cell& cell, int divisions) const
+{
+    // Dimensions with a single value don't subdivide - the cell is flat in those dimensions.
+    const long step = (Scale() >> cell.first) / divisions;
+    std::vector<LatticePt> points( 1, cell.second );
+    for (size_t dd=0; dd<m_axes.size(); dd++) {
+        if (m_axes[dd].size() < 2) continue;
+        size_t count = points.size();
+        for (int kk=1; kk<=divisions; kk++)
+            for (size_t pp=0; pp<count; pp++) {
+                LatticePt point = points[pp];
+                point[dd] += kk * step;
+                points.push_back( point );
+            }
+    }
+    return points;
+}
+
+bool AdaptiveSweep::NeedsRefinement(const Cell& cell) const
+{
+    std::vector<LatticePt> corners = CellPoints( cell, 1 );
+    double low = BadValue, high = BadValue;
+    int undefined = 0;
+    for (auto it = corners.begin(); it != corners.end(); ++it) {
+        double value = m_samples.find( *it )->second[0];
+        if (value == BadValue) { undefined++; continue; }
+        if ((low == BadValue) || (value < low)) low = value;
+        if ((high == BadValue) || (value > high)) high = value;
+    }
+    if (undefined) return undefined < int(corners.size());
+    return (high - low) > m_tolerance;
+}
+
+void AdaptiveSweep::Evaluate(const TheData& settings, const std::vector<LatticePt>& points, int num_rays, int do_pupil)
+{
+    std::vector< std::vector<double> > results( points.size() );
+    ParallelFor( points.size(), [&](size_t begin, size_t end, unsigned) {
+        for (size_t pp=begin; pp<end; pp++) {
+            TheData work;
+            work.DuplicateSettings( settings );
+            for (size_t dd=0; dd<m_parameters.size(); dd++) work.SetParameter( m_parameters[dd], Coordinate( dd, points[pp][dd] ) );
+            work.DefaultSunSamples();
+            work.Calculate( num_rays, do_pupil );
+            for (auto it = m_values.begin(); it != m_values.end(); ++it) results[pp].push_back( work.GetValue( *it ) );
+        }
+    });
+    for (size_t pp=0; pp<points.size(); pp++) m_samples[ points[pp] ] = results[pp];
+}
+
+int AdaptiveSweep::Run(const TheData& settings, int num_rays, int do_pupil)
+{
+    for (auto it = m_parameters.begin(); it != m_parameters.end(); ++it)
+        if (! TheData::CanSetParameter( *it )) {
+            fprintf(stderr, "Error: -adaptive can't vary %s.\n", it->c_str() );
+            return 1;
+        }
+    if (m_parameters.empty() || (m_max_depth < 0) || (m_max_depth > 20)) {
+        fprintf(stderr, "Error: -adaptive needs -iterate parameters, and a depth from 0 to 20.\n");
+        return 1;
+    }
+    if ((m_values.empty()) || (m_values[0] != m_metric)) m_values.insert( m_values.begin(), m_metric );
+    m_samples.clear();
+    m_refined.clear();
+    m_depth_reached = 0;
+
+    // The coarse grid - as one 'cell' whose points are spaced by the coarsest cell (for the dimensions with >1 value)
+    std::vector<Cell> cells( 1, Cell( 0, LatticePt( m_axes.size(), 0 ) ) );
+    for (size_t dd=0; dd<m_axes.size(); dd++) {
+        if (m_axes[dd].size() < 2) continue;
+        size_t count = cells.size();
+        for (size_t kk=1; kk+1<m_axes[dd].size(); kk++)
+            for (size_t cc=0; cc<count; cc++) {
+                Cell cell = cells[cc];
+                cell.second[dd] = kk * Scale();
+                cells.push_back( cell );
+            }
+    }
+    std::vector<LatticePt> points;
+    for (auto it = cells.begin(); it != cells.end(); ++it) {
+        std::vector<LatticePt> corners = CellPoints( *it, 1 );
+        for (auto pt = corners.begin(); pt != corners.end(); ++pt)
+            if (m_samples.insert( std::make_pair( *pt, std::vector<double>() ) ).second) points.push_back( *pt );
+    }
+    Evaluate( settings, points, num_rays, do_pupil );
+
+    for (int depth=0; (depth < m_max_depth) && !cells.empty(); depth++) {
+        std::vector<Cell> next_cells;
+        points.clear();
+        for (auto it = cells.begin(); it != cells.end(); ++it) {
+            if (! NeedsRefinement( *it )) continue;
+            m_refined.insert( *it );
+            std::vector<LatticePt> cell_points = CellPoints( *it, 2 );
+            for (auto pt = cell_points.begin(); pt != cell_points.end(); ++pt)
+                if (m_samples.insert( std::make_pair( *pt, std::vector<double>() ) ).second) points.push_back( *pt );
+            std::vector<LatticePt> children = CellPoints( Cell( depth+1, it->second ), 1 ); // the children's lowest corners
+            for (auto child = children.begin(); child != children.end(); ++child) next_cells.push_back( Cell( depth+1, *child ) );
+        }
+        Evaluate( settings, points, num_rays, do_pupil );
+        if (!next_cells.empty()) m_depth_reached = depth+1;
+        cells.swap( next_cells );
+    }
+    return 0;
+}
+
+double AdaptiveSweep::Resample(const LatticePt& point, size_t value_index) const
+{
+    auto found = m_samples.find( point );
+    if (found != m_samples.end()) return found->second[value_index];
+
+    // Descend from the coarse cell to the smallest cell containing point
+    Cell cell( 0, LatticePt( m_axes.size(), 0 ) );
+    for (size_t dd=0; dd<m_axes.size(); dd++)
+        if (m_axes[dd].size() >= 2) cell.second[dd] = Min( point[dd] / Scale(), long(m_axes[dd].size()) - 2 ) * Scale();
+    while (m_refined.count( cell )) {
+        long half = (Scale() >> cell.first) / 2;
+        for (size_t dd=0; dd<m_axes.size(); dd++)
+            if ((m_axes[dd].size() >= 2) && (point[dd] - cell.second[dd] >= half)) cell.second[dd] += half;
+        cell.first++;
+    }
+
+    const double size = Scale() >> cell.first;
+    double result = 0;
+    std::vector<LatticePt> corners = CellPoints( cell, 1 );
+    for (auto it = corners.begin(); it != corners.end(); ++it) {
+        double weight = 1;
+        for (size_t dd=0; dd<m_axes.size(); dd++) {
+            if (m_axes[dd].size() < 2) continue;
+            double fraction = (point[dd] - cell.second[dd]) / size;
+            weight *= ((*it)[dd] > cell.second[dd]) ? fraction : 1 - fraction;
+        }
+        if (weight == 0) continue;
+        double value = m_samples.find( *it )->second[value_index];
+        if (value == BadValue) return BadValue;
+        result += weight * value;
+    }
+    return result;
+}
+
+void AdaptiveSweep::SampleReport(FILE *fout) const
+{
+    for (auto it = m_parameters.begin(); it != m_parameters.end(); ++it) fprintf(fout, "%s,", it->c_str() );
+    for (size_t vv=0; vv<m_values.size(); vv++) fprintf(fout, vv ? ",%s" : "%s", m_values[vv].c_str() );
+    fprintf(fout, "\n");
+    for (auto it = m_samples.begin(); it != m_samples.end(); ++it) {
+        for (size_t dd=0; dd<m_parameters.size(); dd++) fprintf(fout, "%.10g,", Coordinate( dd, it->first[dd] ) );
+        for (size_t vv=0; vv<it->second.size(); vv++) {
+            if (vv) fprintf(fout, ",");
+            if (it->second[vv] != BadValue) fprintf(fout, "%.10g", it->second[vv] );
+        }
+        fprintf(fout, "\n");
+    }
+}
+
+bool AdaptiveSweep::PivotReport(const std::string& row_param, const std::string& col_param, const std::string& value_param) const
+    /* Resamples onto the regular grid of the smallest cells reached - for the row and column parameters. Any other
+     * parameters are at their last -iterate value (as -csv2 would show them).
+     */
+{
+    size_t row_dim = std::find( m_parameters.begin(), m_parameters.end(), row_param ) - m_parameters.begin();
+    size_t col_dim = std::find( m_parameters.begin(), m_parameters.end(), col_param ) - m_parameters.begin();
+    size_t value_index = std::find( m_values.begin(), m_values.end(), value_param ) - m_values.begin();
+    if ((row_dim == m_parameters.size()) || (col_dim == m_parameters.size()) || (value_index == m_values.size())) {
+        fprintf(stderr, "Error: with -adaptive, -csv2's row and column must be -iterate parameters (and its value a sampled name).\n");
+        return false;
+    }
+
+    LatticePt point( m_axes.size() );
+    for (size_t dd=0; dd<m_axes.size(); dd++) point[dd] = (m_axes[dd].size() - 1) * Scale();
+    const long step = Scale() >> m_depth_reached;
+    std::vector<double> rows, cols, values;
+    for (long rr=0; rr <= long(m_axes[row_dim].size() - 1) * Scale(); rr += step) {
+        point[row_dim] = rr;
+        for (long cc=0; cc <= long(m_axes[col_dim].size() - 1) * Scale(); cc += step) {
+            point[col_dim] = cc;
+            rows.push_back( Coordinate( row_dim, rr ) );
+            cols.push_back( Coordinate( col_dim, cc ) );
+            values.push_back( Resample( point, value_index ) );
+        }
+    }
+    PrintPivot( row_param, value_param, rows, cols, values );
+    return true;
+}
+
+
+ArgStatus ParseCaseArgument(int argc, const char* argv[], int& ii, TheData& td)
+    /* The command-line options that just set td's inputs (-convex, -sw, ... -target) - for main() and for the -serve jobs.
+     * Consumes the option's fields (advancing ii). Returns ArgUnknown for any other option, and ArgBad (after an error
+     * message) if the option's fields are missing or invalid.
+     */
+{
+    struct { const char* m_name; int m_fields; } fixed_fields[] = {
+        { "-sw", 1 }, { "-seed", 1 }, { "-precision", 1 }, { "-gradient", 1 }, { "-sun-samples", 1 }, { "-reflectivity", 1 },
+        { "-slope-error", 1 }, { "-sun-shape", 1 }, { "-screen", 4 }, { "-stencil", 4 }, { "-mirror", 5 }, { "-profile", 1 },
+        { "-mirror-row", 8 }, { "-target", 2 }, { "-stencil-file", 1 }, { "-target-file", 1 }
+    };
+    for (size_t ff=0; ff<sizeof(fixed_fields)/sizeof(fixed_fields[0]); ff++)
+        if ((strcmp(argv[ii], fixed_fields[ff].m_name) == 0) && (argc < (ii+1+fixed_fields[ff].m_fields))) {
+            fprintf(stderr,"ERROR: Expecting %d field%s for the %s argument\n", fixed_fields[ff].m_fields, (fixed_fields[ff].m_fields > 1) ? "s" : "", argv[ii]);
+            return ArgBad;
+        }
+
+         if (strcmp(argv[ii], "-convex"  ) == 0) { td.m_IsConvex = 1; }
+    else if (strcmp(argv[ii], "-concave" ) == 0) { td.m_IsConvex = 0; }
+    else if (strcmp(argv[ii], "-sw"      ) == 0) { ii++; td.m_sun_width_ang    = atof(argv[ii]); }
+    else if (strcmp(argv[ii], "-seed"    ) == 0) { td.m_seed = strtoull(argv[++ii], NULL, 0); }
+    else if (strcmp(argv[ii], "-lut"    ) == 0) {
+        td.m_lut_cells = 512;
+        if (((ii+1)<argc) && isdigit(argv[ii+1][0])) td.m_lut_cells = atoi(argv[++ii]);
+    }
+    else if (strcmp(argv[ii], "-precision") == 0) {
+        ii++;
+             if (strcmp(argv[ii], "float" ) == 0) td.m_single_precision = true;
+        else if (strcmp(argv[ii], "double") == 0) td.m_single_precision = false;
+        else { fprintf(stderr,"ERROR: Expecting float or double for -precision (not %s)\n", argv[ii]); return ArgBad; }
+    }
+    else if (strcmp(argv[ii], "-gradient") == 0) {
+        td.m_gradient_parameter = argv[++ii];
+        if (! TheData::CanSetParameter( td.m_gradient_parameter )) {
+            fprintf(stderr, "ERROR: -gradient can't differentiate with respect to %s.\n", argv[ii] );
+            return ArgBad;
+        }
+    }
+    else if (strcmp(argv[ii], "-sun-samples")==0){ td.m_sun_samples = strtoul(argv[++ii], NULL, 0); }
+    else if (strcmp(argv[ii], "-reflectivity")==0){ td.m_reflectivity = atof(argv[++ii]); }
+    else if (strcmp(argv[ii], "-convolve") == 0) { td.m_convolve = true; }
+    else if (strcmp(argv[ii], "-slope-error")==0){ td.m_slope_error = atof(argv[++ii]); td.m_convolve = true; }
+    else if (strcmp(argv[ii], "-sun-shape") == 0) {
+        ii++;
+             if (strcmp(argv[ii], "uniform") == 0) td.m_sun_shape.m_type = SunShape::Uniform;
+        else if (strcmp(argv[ii], "disk"   ) == 0) td.m_sun_shape.m_type = SunShape::Disk;
+        else if (strcmp(argv[ii], "limb"   ) == 0) {
+            td.m_sun_shape.m_type = SunShape::LimbDarkened;
+            if (((ii+1)<argc) && (isdigit(argv[ii+1][0]) || (argv[ii+1][0] == '.'))) { ii++; td.m_sun_shape.m_limb_u = atof(argv[ii]); }
+        }
+        else fprintf(stderr, "ERROR: Unrecognized sun shape (%s) for -sun-shape. Expecting uniform, disk or limb.\n", argv[ii]);
+    }
+    else if (strcmp(argv[ii], "-screen" ) == 0) { // End points (each with an X,Y value) for the screen
+        double X1 = atof( argv[++ii] );
+        double Y1 = atof( argv[++ii] );
+        double X2 = atof( argv[++ii] );
+        double Y2 = atof( argv[++ii] );
+        td.m_screen = Segment( Point(X1,Y1), Point(X2,Y2) );
+    }
+    else if (strcmp(argv[ii], "-stencil" ) == 0) { // End points (each with an X,Y value) for one line of the stencil
+        double X1 = atof( argv[++ii] );
+        double Y1 = atof( argv[++ii] );
+        double X2 = atof( argv[++ii] );
+        double Y2 = atof( argv[++ii] );
+        td.m_stencils.push_back(  Segment( Point(X1,Y1), Point(X2,Y2) ) );
+    }
+    else if (strcmp(argv[ii], "-mirror" ) == 0) { // COC (X,Y), radius, min and max normal directions
+        double X = atof( argv[++ii] );
+        double Y = atof( argv[++ii] );
+        double R = atof( argv[++ii] );
+        double MNA = atof( argv[++ii] );
+        double MXA = atof( argv[++ii] );
+        td.m_scene.m_arcs.push_back( MirrorArc( Point(X,Y), R, MNA, MXA ) );
+    }
+    else if (strcmp(argv[ii], "-profile") == 0) {
+        if (! td.m_profile.Load( argv[++ii] )) return ArgBad;
+    }
+    else if (strcmp(argv[ii], "-mirror-row") == 0) { // count, 1st COC (X,Y), step (X,Y), radius, min and max normal directions
+        int count = atoi( argv[++ii] );
+        double X = atof( argv[++ii] );
+        double Y = atof( argv[++ii] );
+        double DX = atof( argv[++ii] );
+        double DY = atof( argv[++ii] );
+        double R = atof( argv[++ii] );
+        double MNA = atof( argv[++ii] );
+        double MXA = atof( argv[++ii] );
+        for (int mm=0; mm<count; mm++)
+            td.m_scene.m_arcs.push_back( MirrorArc( Point(X + mm*DX, Y + mm*DY), R, MNA, MXA ) );
+    }
+    else if (strcmp(argv[ii], "-target" ) == 0) {
+        double X = atof( argv[++ii] );
+        double Y = atof( argv[++ii] );
+        td.m_target_pts.push_back( Point(X,Y) );
+    }
+    else if (strcmp(argv[ii], "-stencil-file") == 0) { // X1 Y1 X2 Y2 per record - as -stencil
+        std::vector<double> values;
+        if (! LoadNumbers( argv[++ii], 4, values )) return ArgBad;
+        for (size_t vv=0; vv<values.size(); vv+=4)
+            td.m_stencils.push_back( Segment( Point(values[vv], values[vv+1]), Point(values[vv+2], values[vv+3]) ) );
+    }
+    else if (strcmp(argv[ii], "-target-file") == 0) { // X Y per record - as -target
+        std::vector<double> values;
+        if (! LoadNumbers( argv[++ii], 2, values )) return ArgBad;
+        for (size_t vv=0; vv<values.size(); vv+=2)
+            td.m_target_pts.push_back( Point(values[vv], values[vv+1]) );
+    }
+    else return ArgUnknown;
+    if (!td.m_profile.Empty() && (!td.m_scene.Empty() || !td.m_stencils.empty())) { // (in either order)
+        fprintf(stderr, "ERROR: -profile can't be combined with -mirror, -mirror-row or -stencil (stencils aren't traced for a profile mirror).\n");
+        return ArgBad;
+    }
+    return ArgUsed;
+}
+
+bool CaseServer::Job(const std::string& line, size_t line_number, std::string& result) const
+{
+    std::vector<std::string> words;
+    for (size_t start = line.find_first_not_of(" \t\r\n"); start != std::string::npos; ) {
+        size_t end = line.find_first_of(" \t\r\n", start);
+        if (end == std::string::npos) end = line.size();
+        words.push_back( line.substr(start, end-start) );
+        start = line.find_first_not_of(" \t\r\n", end);
+    }
+    std::vector<const char*> argv;
+    for (auto it = words.begin(); it != words.end(); ++it) argv.push_back( it->c_str() );
+    const int argc = argv.size();
+
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%zu", line_number);
+    const bool has_id = (argc > 0) && (argv[0][0] != '-');
+    result = has_id ? argv[0] : buffer;
+
+    TheData td;
+    td.DuplicateSettings( m_base );
+    int num_rays = m_num_rays, do_pupil = m_do_pupil, reverse = m_reverse;
+    const QualityTier* quality = dvo_quality;
+    std::vector<std::string> values = m_values;
+    for (int ii = has_id ? 1 : 0; ii<argc; ii++) {
+        if ((strcmp(argv[ii], "-values") == 0) && ((ii+1) >= argc)) {
+            result += " ERROR Expecting 1 field for the -values argument";
+            return false;
+        }
+        const int option = ii;
+        ArgStatus status = ArgUsed;
+             if (strcmp(argv[ii], "-values") == 0) { values = SplitNames( argv[++ii] ); }
+        else if (strcmp(argv[ii], "-pupil" ) == 0) { do_pupil = 1; }
+        else if (strcmp(argv[ii], "-reverse") == 0) { reverse = 1; }
+        else if ((status = ParseRunArgument(argc, argv.data(), ii, td, num_rays, quality)) != ArgUnknown) {}
+        else if ((status = ParseDimensionArgument(argc, argv.data(), ii, td)) == ArgUnknown)
+            status = ParseCaseArgument(argc, argv.data(), ii, td);
+        if (status != ArgUsed) {
+            result += std::string(" ERROR ") + ((status == ArgUnknown) ? "unrecognized argument " : "invalid fields for ") + argv[option];
+            return false;
+        }
+    }
+    for (auto it = values.begin(); it != values.end(); ++it) {
+        bool known;
+        td.GetValue( *it, known );
+        if (! known) {
+            result += " ERROR unknown value " + *it;
+            return false;
+        }
+    }
+    if ((td.m_radius == BadValue) || (td.m_sun_dir == BadValue) || (td.m_IsConvex && (td.m_distance == BadValue)) || !td.CheckInputs()) {
+        result += " ERROR incomplete case (needs -r and -sa, and -d for -convex)";
+        return false;
+    }
+    td.DefaultSunSamples();
+
+    td.m_outputs = td.m_gradient_parameter.empty() ? 0 : unsigned(OutAll); // just what the values need
+    for (auto it = values.begin(); it != values.end(); ++it) td.m_outputs |= TheData::OutputsFor( *it );
+
+    const QualityTier* base_quality = dvo_quality;
+    dvo_quality = quality;
+    td.Calculate(reverse ? 0 : num_rays, do_pupil);
+    dvo_quality = base_quality;
+    for (auto it = values.begin(); it != values.end(); ++it) {
+        snprintf(buffer, sizeof(buffer), "=%.10g", td.GetValue( *it ));
+        result += " " + *it + buffer;
+    }
+    return true;
+}
+
+int CaseServer::Run(FILE *fin, FILE *fout)
+{
+    struct Pending {
+        size_t m_sequence;    // order of the jobs - and of their results
+        size_t m_line_number;
+        std::string m_line;
+    };
+    const unsigned num_workers = NumThreads( size_t(-1) );
+    const size_t max_pending = 64 * num_workers; // jobs read but not yet written - bounds the memory for an endless input
+
+    std::mutex mutex;
+    std::condition_variable work_ready, work_done;
+    std::deque<Pending> queue;
+    std::map<size_t,std::string> finished; // results not yet written - waiting for an earlier job
+    size_t next_read = 0, next_write = 0;
+    bool end_of_input = false;
+    m_errors = 0;
+
+    const int debug = dvo_debug;
+    const QualityTier* quality = dvo_quality;
+    std::vector<std::thread> workers;
+    for (unsigned ww=0; ww<num_workers; ww++)
+        workers.push_back( std::thread( [&, debug, quality]() {
+            dvo_debug = debug;
+            dvo_threads = 1; // each job single-threaded - the pool is the parallelism
+            dvo_quality = quality;
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;) {
+                work_ready.wait( lock, [&]() { return !queue.empty() || end_of_input; } );
+                if (queue.empty()) return;
+                Pending job = queue.front();
+                queue.pop_front();
+                lock.unlock();
+                std::string result;
+                bool success = Job( job.m_line, job.m_line_number, result );
+                lock.lock();
+                if (!success) m_errors++;
+                finished[job.m_sequence] = result;
+                for (auto it = finished.begin(); (it != finished.end()) && (it->first == next_write); it = finished.erase(it), next_write++)
+                    fprintf(fout, "%s\n", it->second.c_str());
+                if (next_write == next_read) fflush(fout); // caught up with the input (which may be waiting for these results)
+                work_done.notify_all();
+            }
+        } ) );
+
+    std::string line;
+    size_t line_number = 0;
+    char buffer[4096];
+    while (fgets(buffer, sizeof(buffer), fin)) {
+        line += buffer;
+        if ((line[line.size()-1] != '\n') && !feof(fin)) continue; // a long line - read the rest of it
+        line_number++;
+        size_t start = line.find_first_not_of(" \t\r\n");
+        if ((start != std::string::npos) && (line[start] != '#')) {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_done.wait( lock, [&]() { return (next_read - next_write) < max_pending; } );
+            Pending job = { next_read++, line_number, line };
+            queue.push_back( job );
+            work_ready.notify_one();
+        }
+        line.clear();
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        end_of_input = true;
+        work_ready.notify_all();
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it) it->join();
+    m_jobs = next_read;
+    return m_errors ? 1 : 0;
 }
 
-void GrabIteratorArgs( int &arg_index, int argc, const char* argv[], const char* param_name, arg_iterator &arg_it)
+ArgStatus ParseRunArgument(int argc, const char* argv[], int& ii, TheData& td, int& num_rays, const QualityTier*& quality)
+    /* -nr <n>|auto [<tolerance>] and -quality - how the case is calculated (into num_rays and quality - and -nr auto into td's
+     * m_ray_tolerance). For main() and the -serve jobs. Returns as ParseCaseArgument().
+     */
 {
-    arg_it.parameter_name = param_name;
+    const bool is_nr = (strcmp(argv[ii], "-nr") == 0);
+    if (!is_nr && (strcmp(argv[ii], "-quality") != 0)) return ArgUnknown;
+    if ((ii+1) >= argc) {
+        fprintf(stderr,"ERROR: Expecting 1 field for the %s argument\n", argv[ii]);
+        return ArgBad;
+    }
+    ii++;
+    if (is_nr) {
+        td.m_convex_fan = true; // (the convex fan is traced only when asked for)
+        if (strcmp(argv[ii], "auto") == 0) { // Adaptive sampling along the arc - with an optional tolerance (degrees)
+            td.m_ray_tolerance = 0.05;
+            if (((ii+1)<argc) && (isdigit(argv[ii+1][0]) || (argv[ii+1][0] == '.'))) { ii++; td.m_ray_tolerance = atof(argv[ii]); }
+        } else {
+            num_rays = atoi(argv[ii]);
+            td.m_ray_tolerance = 0;
+        }
+        return ArgUsed;
+    }
+    for (size_t qq=0; qq<sizeof(quality_tiers)/sizeof(quality_tiers[0]); qq++)
+        if (strcmp(argv[ii], quality_tiers[qq].m_name) == 0) { quality = &quality_tiers[qq]; return ArgUsed; }
+    fprintf(stderr,"ERROR: Expecting fast, default or exact for -quality (not %s)\n", argv[ii]);
+    return ArgBad;
+}
 
-    if (isdigit(argv[arg_index+1][0]) || ((argv[arg_index+1][0] == '-') && isdigit(argv[arg_index+1][1]))) {
-        arg_index++;
-        arg_it.increment = 0;
-        arg_it.from  = arg_it.to = atof(argv[arg_index]);
+ArgStatus ParseDimensionArgument(int argc, const char* argv[], int& ii, TheData& td)
+    // -r, -d, -sa, -sA, -mna, -mxa and -mw - as main() without -iterate. Returns as ParseCaseArgument().
+{
+    const char* options[] = { "-r", "-d", "-sa", "-sA", "-mna", "-mxa", "-mw" };
+    size_t option = 0;
+    while ((option < sizeof(options)/sizeof(options[0])) && (strcmp(argv[ii], options[option]) != 0)) option++;
+    if (option == sizeof(options)/sizeof(options[0])) return ArgUnknown;
+    if ((ii+1) >= argc) {
+        fprintf(stderr,"ERROR: Expecting 1 field for the %s argument\n", argv[ii]);
+        return ArgBad;
     }
-    if (isdigit(argv[arg_index+1][0]) || ((argv[arg_index+1][0] == '-') && isdigit(argv[arg_index+1][1]))) {
-        arg_index++;
-        arg_it.to = atof(argv[arg_index]);
+    double value = atof(argv[++ii]);
+    switch (option) {
+        case 0: td.m_radius = value; break;
+        case 1: td.m_distance = value; break;
+        case 2: td.m_sun_dir = value; break;
+        case 3: td.m_sun_dir = value + 180; break;
+        case 4: td.m_min_normal_dir = value; break;
+        case 5: td.m_max_normal_dir = value; break;
+        case 6: td.m_min_normal_dir = 270 - value; td.m_max_normal_dir = 270 + value; break;
     }
-    if (isdigit(argv[arg_index+1][0]) || ((argv[arg_index+1][0] == '-') && isdigit(argv[arg_index+1][1]))) {
-        arg_index++;
-        double value = atof(argv[arg_index]);
-        if (value < arg_it.to) {
-            arg_it.increment = value;
-            return;
+    return ArgUsed;
+}
+
+bool ParseJobs(const char* data, size_t size, const char* source, const TheData& base, std::deque<TheData>& cases)
+    /* -jobs: appends a case to cases for each line of data (size bytes - not necessarily terminated). A line has a case's
+     * options (as ParseDimensionArgument() and ParseCaseArgument()), starting from base's settings. The value of -r, -d, -sa,
+     * -sA, -mna, -mxa or -sw may be a range - from:to:step (to inclusive) - and the line is then a case for each value (for
+     * each combination of values with several ranges - the first spinning fastest, as -iterate) - up to max_line_cases cases.
+     * Blank lines, and lines starting with #, are skipped. Returns success (after an error message naming source and the line).
+     */
+{
+    const double max_line_cases = 1e6; // (each case takes about 5KB)
+    const char* range_options[] = { "-r", "-d", "-sa", "-sA", "-mna", "-mxa", "-sw" };
+    const char* range_names[]   = { "radius", "distance", "sun_a", "sun_A", "min_normal", "max_normal", "sun_width" };
+    std::vector<char> line;        // the current line - with its fields' separators replaced by '\0' (so argv points into it)
+    std::vector<const char*> argv;
+    std::vector< std::pair<const char*, std::vector<double> > > ranges; // SetParameter() name, values
+    size_t line_number = 0;
+    for (const char *start = data, *end = data + size; start < end; ) {
+        const char* eol = static_cast<const char*>( memchr(start, '\n', end - start) );
+        if (eol == NULL) eol = end;
+        line_number++;
+        line.assign(start, eol);
+        line.push_back(0);
+        start = eol + 1;
+
+        argv.clear();
+        for (size_t cc=0; line[cc]; ) {
+            while ((line[cc] == ' ') || (line[cc] == '\t') || (line[cc] == '\r')) line[cc++] = 0;
+            if (line[cc] == 0) break;
+            argv.push_back( &line[cc] );
+            while (line[cc] && (line[cc] != ' ') && (line[cc] != '\t') && (line[cc] != '\r')) cc++;
         }
-        // else take as a list of values
-        arg_it.value_list.push_back(arg_it.from);
-        arg_it.value_list.push_back(arg_it.to);
-        arg_it.value_list.push_back(value);
-        arg_it.from = arg_it.to = 0.0;
-        while (    argv[arg_index+1] &&
-              (argv[arg_index+1][0] != '\0') &&
-              (isdigit(argv[arg_index+1][0]) || ((argv[arg_index+1][0] == '-') && isdigit(argv[arg_index+1][1]))) ) {
-            arg_index++;
-            arg_it.value_list.push_back( atof(argv[arg_index]) );
+        if (argv.empty() || (argv[0][0] == '#')) continue;
+
+        cases.resize( cases.size() + 1 );
+        TheData& td = cases.back();
+        td.DuplicateSettings( base );
+        ranges.clear();
+        const int argc = argv.size();
+        for (int ii=0; ii<argc; ii++) {
+            const int option = ii;
+            for (size_t rr=0; ((ii+1) < argc) && (rr < sizeof(range_options)/sizeof(range_options[0])); rr++) {
+                char* colon = const_cast<char*>( strchr(argv[ii+1], ':') );
+                if ((colon == NULL) || (strcmp(argv[ii], range_options[rr]) != 0)) continue;
+                double from = atof(argv[ii+1]), to = atof(colon+1), step = 0;
+                const char* colon2 = strchr(colon+1, ':');
+                if (colon2) step = atof(colon2+1);
+                if ((colon2 == NULL) || !(step > 0) || (to < from)) {
+                    fprintf(stderr, "ERROR: Expecting from:to:step (from<=to, step>0) for %s at line %d of %s.\n", argv[ii], int(line_number), source);
+                    return false;
+                }
+                double line_cases = floor( (to - from) / step + 1e-9 ) + 1;
+                for (size_t pp=0; pp<ranges.size(); pp++) line_cases *= ranges[pp].second.size();
+                if (! (line_cases <= max_line_cases)) {
+                    fprintf(stderr, "ERROR: Too many cases (%g - the most is %g) from the ranges at line %d of %s.\n",
+                            line_cases, max_line_cases, int(line_number), source);
+                    return false;
+                }
+                *colon = 0; // the line is parsed with the range's first value
+                ranges.push_back( std::make_pair( range_names[rr], std::vector<double>() ) );
+                size_t count = size_t( floor( (to - from) / step + 1e-9 ) ) + 1;
+                for (size_t vv=0; vv<count; vv++) ranges.back().second.push_back( from + vv * step );
+            }
+            ArgStatus status = ParseDimensionArgument(argc, &argv[0], ii, td);
+            if (status == ArgUnknown) status = ParseCaseArgument(argc, &argv[0], ii, td);
+            if (status != ArgUsed) {
+                fprintf(stderr, "ERROR: %s argument %s at line %d of %s.\n", (status == ArgUnknown) ? "Unrecognized" : "Invalid fields for the",
+                        argv[option], int(line_number), source);
+                return false;
+            }
+            for (int ff=option+1; ff<=ii; ff++) { // (a range's field was cut at its first colon, above)
+                char* number_end;
+                strtod(argv[ff], &number_end);
+                if ((number_end != argv[ff]) && (*number_end == ':')) {
+                    fprintf(stderr, "ERROR: %s can't take a range (from:to:step) at line %d of %s.\n", argv[option], int(line_number), source);
+                    return false;
+                }
+            }
+        }
+
+        if (ranges.empty()) continue;
+        TheData first; // the line's case, with each range at its first value
+        first.DuplicateSettings( td );
+        cases.pop_back();
+        std::vector<size_t> indices( ranges.size(), 0 );
+        for (bool done = false; !done; ) {
+            cases.resize( cases.size() + 1 );
+            cases.back().DuplicateSettings( first );
+            for (size_t rr=0; rr<ranges.size(); rr++) cases.back().SetParameter( ranges[rr].first, ranges[rr].second[ indices[rr] ] );
+            size_t rr = 0;
+            while ((rr < ranges.size()) && (++indices[rr] == ranges[rr].second.size())) indices[rr++] = 0;
+            done = (rr == ranges.size());
         }
     }
+    return true;
 }
 
+bool LoadJobs(const char* filename, const TheData& base, std::deque<TheData>& cases)
+    // -jobs: ParseJobs() of a file
+{
+    MappedFile file;
+    return file.Open(filename) && ParseJobs(file.Data(), file.Size(), filename, base, cases);
+}
 
-void GenerateReport(const std::deque<TheData> &td,const std::string& row_param, const std::string& col_param, const std::string& value_param)
+} // namespace (the internals)
+
+namespace smraytrc {
+
+Config::Config() :
+    m_convex(false),
+    m_radius(BadValue),
+    m_distance(BadValue),
+    m_sun_dir(BadValue),
+    m_min_normal_dir(0),
+    m_max_normal_dir(360),
+    m_sun_width(0.5),
+    m_num_rays(3),
+    m_ray_tolerance(0),
+    m_convex_fan(false),
+    m_reverse(false),
+    m_pupil(false),
+    m_sun_samples(0),
+    m_seed(1),
+    m_flux_bins(0),
+    m_farfield_bins(0),
+    m_reflectivity(1),
+    m_slope_error(0),
+    m_convolve(false),
+    m_single_precision(false),
+    m_lut_cells(0),
+    m_screen(),
+    m_stencils(),
+    m_targets(),
+    m_quality("default"),
+    m_threads(0),
+    m_debug(0)
 {
-    std::set<double> row_values_set;
-    std::set<double> col_values_set;
-    for (auto it = td.begin(); it != td.end(); ++it) {
-        double row_value = it->GetValue(row_param);
-        row_values_set.insert( row_value );
-        double col_value = it->GetValue(col_param);
-        col_values_set.insert( col_value );
-    }
+}
 
-    int row_index = 0;
-    std::map<double,int> row_indices;
-    std::deque<double> row_values( row_values_set.size() );
-    for (auto it = row_values_set.begin(); it != row_values_set.end(); ++it) {
-        row_indices.insert( std::pair<double,int>( *it, row_index ) );
-        row_values[row_index] = *it;
-        row_index++;
-    }
+struct Context::Impl {
+    Config m_config;
+    TheData m_data;
+    const QualityTier* m_quality; // NULL if m_config.m_quality isn't a tier's name
 
-    int col_index = 0;
-    std::map<double,int> col_indices;
-    std::deque<double> col_values( col_values_set.size() );
-    for (auto it = col_values_set.begin(); it != col_values_set.end(); ++it) {
-        col_indices.insert( std::pair<double,int>( *it, col_index ) );
-        col_values[col_index] = *it;
-        col_index++;
-    }
+    Impl(const Config& config);
+};
+
+Context::Impl::Impl(const Config& config) :
+    m_config(config),
+    m_data(),
+    m_quality(NULL)
+{
+    for (size_t qq=0; qq<sizeof(quality_tiers)/sizeof(quality_tiers[0]); qq++)
+        if (config.m_quality == quality_tiers[qq].m_name) m_quality = &quality_tiers[qq];
+
+    TheData& td = m_data;
+    td.m_IsConvex = config.m_convex;
+    td.m_radius = config.m_radius;
+    td.m_distance = config.m_distance;
+    td.m_sun_dir = config.m_sun_dir;
+    td.m_min_normal_dir = config.m_min_normal_dir;
+    td.m_max_normal_dir = config.m_max_normal_dir;
+    td.m_sun_width_ang = config.m_sun_width;
+    td.m_ray_tolerance = config.m_ray_tolerance;
+    td.m_convex_fan = config.m_convex_fan;
+    td.m_sun_samples = config.m_sun_samples;
+    td.m_seed = config.m_seed;
+    td.m_flux_bins = config.m_flux_bins;
+    td.m_farfield_bins = config.m_farfield_bins;
+    td.m_reflectivity = config.m_reflectivity;
+    td.m_slope_error = config.m_slope_error;
+    td.m_convolve = config.m_convolve || (config.m_slope_error != 0);
+    td.m_single_precision = config.m_single_precision;
+    td.m_lut_cells = config.m_lut_cells;
+    if (config.m_screen.size() == 4)
+        td.m_screen = Segment( Point(config.m_screen[0], config.m_screen[1]), Point(config.m_screen[2], config.m_screen[3]) );
+    for (size_t ii=0; ii+3<config.m_stencils.size(); ii+=4)
+        td.m_stencils.push_back( Segment( Point(config.m_stencils[ii],   config.m_stencils[ii+1]),
+                                          Point(config.m_stencils[ii+2], config.m_stencils[ii+3]) ) );
+    for (size_t ii=0; ii+1<config.m_targets.size(); ii+=2)
+        td.m_target_pts.push_back( Point(config.m_targets[ii], config.m_targets[ii+1]) );
+    td.DefaultSunSamples();
+}
 
+struct ThreadOptions
+    // Sets this thread's run-time options (dvo_debug, etc.) for the life of the object - then restores them.
+{
+    int m_debug, m_threads;
+    const QualityTier* m_quality;
 
-    std::deque< std::deque<double> > two_d(row_index);
-    for (auto it = two_d.begin(); it != two_d.end(); ++it)
-        it->resize(col_index);
+    ThreadOptions(const Config& config, const QualityTier* quality) : m_debug(dvo_debug), m_threads(dvo_threads), m_quality(dvo_quality)
+        { dvo_debug = config.m_debug; dvo_threads = config.m_threads; dvo_quality = quality; }
+    ~ThreadOptions() { dvo_debug = m_debug; dvo_threads = m_threads; dvo_quality = m_quality; }
+};
 
-    for (auto it = td.begin(); it != td.end(); ++it) {
-        double row_value = it->GetValue(row_param);
-        auto row_it = row_indices.find( row_value );
-        int row_index = row_it->second;
+Context::Context(const Config& config) : m_impl( new Impl(config) )
+{
+}
+
+Context::~Context()
+{
+}
 
-        double col_value = it->GetValue(col_param);
-        auto col_it = col_indices.find( col_value );
-        int col_index = col_it->second;
+const Config& Context::GetConfig() const
+{
+    return m_impl->m_config;
+}
 
-        double value = it->GetValue(value_param);
-        two_d[row_index][col_index] = value;
+bool Context::Calculate()
+{
+    const Config& config = m_impl->m_config;
+    TheData& td = m_impl->m_data;
+    if (m_impl->m_quality == NULL) {
+        fprintf(stderr,"ERROR: Expecting fast, default or exact for the quality (not %s)\n", config.m_quality.c_str());
+        return false;
     }
+    if ((td.m_radius == BadValue) || (td.m_sun_dir == BadValue) || (td.m_IsConvex && (td.m_distance == BadValue)) || !td.CheckInputs())
+        return false;
 
+    ThreadOptions options(config, m_impl->m_quality);
+    td.Calculate(config.m_reverse ? 0 : config.m_num_rays, config.m_pupil);
+    return true;
+}
 
+double Context::Value(const std::string& name) const
+{
+    bool known;
+    return m_impl->m_data.GetValue(name, known); // (BadValue if !known)
+}
 
-    printf("%s", row_param.c_str());
-    for (int ii=0; ii<col_index; ii++) {
-        printf(",%s_%g",value_param.c_str(), col_values[ii]);
-    }
-    printf("\n");
-    for (int rr=0; rr<row_index; rr++) {
-        printf("%g", row_values[rr] );
-        for (int cc=0; cc<col_index; cc++) {
-            if (two_d[rr][cc] == BadValue)    printf(",");
-            else                printf(",%g",  two_d[rr][cc]);
-        }
-        printf("\n");
-    }
+void Context::RayReport(FILE *fout) const
+{
+    m_impl->m_data.RayReport(fout, 1);
+}
+
+bool Context::SVG(FILE *fout, const std::string& title) const
+{
+    ThreadOptions options(m_impl->m_config, m_impl->m_quality);
+    const TheData& td = m_impl->m_data;
+    if (td.m_IsConvex) return td.GenSVG_Convex(fout, 0, 0);
+    int ray_index = 0;
+    return td.GenSVG_Concave(fout, 0, 0, title, ray_index);
 }
 
+} // namespace smraytrc
 
+
+#ifndef SMRAYTRC_LIBRARY // (the library - libsmraytrc.a - is this file without the command-line program)
 void usage(const char* program_name)
 {
     printf("Usage: %s [-next | -iterate] [-r ...] [-d ...] [-s[aA] ...] [-sw <value>] [-svg [<filename>]] [-csv] [-pupil] [-animate]\n", program_name);
@@ -2242,12 +6623,111 @@ void usage(const char* program_name)
     printf("\t\t<value1> <value2> <value3> (if value2>value3): Iterate from value1 to <=value2, incrementing by value3.\n");
     printf("\t\t<value1> <value2> <value3> ... (if value2<value3): taken as a series of values.\n");
     printf("\t\tNote that -iterate and -next are not compatible with each other.\n");
+    printf("\t-gradient <parameter>: Also calculates the derivatives - by automatic differentiation - of the metrics (ref_width,\n");
+    printf("\t\tref_focal_d and ref_blur for concave mirrors; brightness, brightness2 and the pupils for convex - with -pupil) with\n");
+    printf("\t\trespect to parameter (radius, distance, sun_a, sun_A, sun_width, min_normal, max_normal or mirror_width). Printed -\n");
+    printf("\t\tor, with -csv2, as d_<name> (e.g. d_ref_blur). Not for -mirror or -profile, or reverse-tracing.\n");
+    printf("\t-sample <sobol|lhs> <count> <name,...> [<file>]: With -iterate - where each parameter's first and last values are its range.\n");
+    printf("\t\tCalculates count cases - the parameters from the Sobol sequence (up to 10 parameters) or a Latin hypercube (see\n");
+    printf("\t\t-seed) - and writes the names (as -csv2) in long format: sample, the parameters, name, value. To file (defaults\n");
+    printf("\t\tto output_samples.csv).\n");
+    printf("\t-optimize <name> [min|max] [<evaluations>] [<file>]: With -iterate - where each parameter's first and last values are\n");
+    printf("\t\tits bounds. Minimizes (or maximizes) name (as -csv2) by Nelder-Mead, from the middle of the bounds, until the simplex\n");
+    printf("\t\tis 1e-4 of the bounds or after about evaluations cases (defaults to 300) - the candidates of each step calculated in\n");
+    printf("\t\tparallel (see -threads). Prints the optimum, and writes every case to file (defaults to output_optimize.csv).\n");
+    printf("\t-jobs <file>: Cases from file - one per line, with the case's options (-r, -d, -sa, -sA, -mna, -mxa, -mw, -sw, -sun-samples,\n");
+    printf("\t\t-target, ...) - rather than -next on the command line. Each starts from the case's options - before and after\n");
+    printf("\t\t-jobs (the jobs replace that case, so no -next after -jobs). A value of -r, -d, -sa, -sA, -mna, -mxa or -sw may be\n");
+    printf("\t\tfrom:to:step - a case per value (the 1st such range spinning fastest - up to 1000000 cases a line). Lines starting\n");
+    printf("\t\twith # are skipped. Not with -iterate. Each case takes about 5KB - for millions of cases, stream the lines (without\n");
+    printf("\t\tranges) through -serve instead.\n");
+    printf("\t-serve [<name,...>]: Reads jobs from standard-input - one per line: [<id>] <options> - and writes a line per job:\n");
+    printf("\t\t<id> name=value ... (the names default to ref_focal_d,ref_blur,ref_width), or <id> ERROR <why>. The options\n");
+    printf("\t\tare a case's (-r, -d, -sa, -sA, -mna, -mxa, -mw, -sw, -nr, -reverse, -pupil, -quality, -sun-samples, -target, ...)\n");
+    printf("\t\tplus -values <name,...>, and start from the command line's case. id defaults to the line number. The jobs run\n");
+    printf("\t\ton -threads workers; the results are written (and flushed) in the jobs' order. For a Unix socket, run it under\n");
+    printf("\t\te.g. socat UNIX-LISTEN:<path>,fork EXEC:'smraytrc -serve'.\n");
+    printf("\t-adaptive <name> <tolerance> [<depth>] [<file>]: With -iterate - starts with the -iterate grid (of any number of parameters),\n");
+    printf("\t\tthen halves (in every parameter) each cell whose corner values of name differ by more than tolerance, or are only\n");
+    printf("\t\tpartly defined - up to depth times (defaults to 4). The samples are written to file (defaults to output_adaptive.csv).\n");
+    printf("\t\tWith -csv2, its table is resampled (interpolated) onto the regular grid of the smallest cells.\n");
     printf("\t-r <value> [...]: Defines the radius if the mirror (defaults to 1). See above comments regarding -next and -iterate.\n");
     printf("\t-d <value> [...]: Defines the distance from the observer to the center-of-curvature of the mirror. Must be >radius. See\n");
     printf("\t\tabove comments.\n");
     printf("\t-sa <value> [...]: Defines the the angle of the sun's rays (i.e. 0 is horizontal to the left, 270 vertically down).\n");
     printf("\t-sA <value> [...]: An alterative to -sa - defines the sun's altitude (is 180 more/less than -sa): 90 is vertically down.\n");
     printf("\t-sw <value>: Defines the angular width of the sun in degrees. Defaults to 0.5. The above comments are not applicable.\n");
+    printf("\t-nr <value>: The number of points along the (concave) mirror to forward ray-trace. Defaults to 3.\n");
+    printf("\t\tFor a convex mirror (only when -nr is given), the number of rays in a fan (from each of the top and bottom of the sun) spaced evenly across\n");
+    printf("\t\tthe sunlit part of the arc (-mna to -mxa) and reflected off the outside. Reports ref_spread (the angular width of\n");
+    printf("\t\tthe reflected fan), and - from the virtual-image envelope behind the mirror - ref_focal_d, ref_blur and ref_width.\n");
+    printf("\t-nr auto [<tolerance>]: Forward ray-trace adaptively - a coarse set of points along the mirror is refined wherever\n");
+    printf("\t\tneighboring rays differ in status or their reflected directions differ by more than tolerance (degrees, default 0.05).\n");
+    printf("\t-converge <tolerance> [<max_rays>]: Convergence study - for each case, the number of rays (starting with -nr) is doubled until\n");
+    printf("\t\tref_focal_d, ref_blur and ref_width each change by less than tolerance (relative). Reports the ray count chosen\n");
+    printf("\t\t(num_rays) and the estimated error (converge_err). max_rays defaults to 4097.\n");
+    printf("\t-sun-samples <count>: (concave) Also forward-traces count rays - each aimed at a random point along the mirror from a random\n");
+    printf("\t\tdirection across the sun's disk (see -sun-shape). Reports flux_in and flux_out (reflected).\n");
+    printf("\t-sun-shape uniform|disk|limb [<u>]: Brightness across the sun for -sun-samples. limb (the default) is a disk with linear\n");
+    printf("\t\tlimb-darkening coefficient u (default 0.6).\n");
+    printf("\t-seed <value>: Random number seed for -sun-samples. The same seed gives the same results for any number of threads.\n");
+    printf("\t-lut [<cells>]: The -sun-samples rays (single mirror) are looked up in a table of the mirror's reflections - over the\n");
+    printf("\t\ttarget point and the angle of incidence, cells (defaults to 512) each way - built once per mirror (so shared by the\n");
+    printf("\t\tcases of a sun-angle sweep). Interpolated within the cells away from any change of status (or of the number of\n");
+    printf("\t\tstrikes) - the cells next to one are traced as usual.\n");
+    printf("\t-precision float|double: The -sun-samples rays are traced (single mirror) and stored in float - about a third less\n");
+    printf("\t\tmemory (the weights and sums stay double). Directions are within about 1e-4 degrees of double (the default) for a few\n");
+    printf("\t\treflections, but drift apart with many - up to 21 degrees for grazing rays of 20 strikes (see README.md).\n");
+    printf("\t-flux-bins <count> [<filename>]: (concave) The irradiance profile along the -screen - the reflected -sun-samples rays\n");
+    printf("\t\t(100000 if not otherwise specified) that reach the screen are summed into count bins along it, and written as CSV\n");
+    printf("\t\tto filename (default output_flux.csv). Stencils block rays. Reports screen_flux and screen_peak (concentration).\n");
+    printf("\t-farfield <count> [<filename>]: (concave) The far-field intensity - the reflected -sun-samples rays are summed by\n");
+    printf("\t\treflected direction into count bins, and written as CSV to filename (default output_farfield.csv). Reports the\n");
+    printf("\t\tmean direction (ff_center) and the widths containing 50, 90 and 99%% of the reflected flux (ff_w50, ff_w90, ff_w99).\n");
+    printf("\t\tOnly the -sun-samples rays (100000 unless given) are binned - not the -nr (or -nr auto) forward-traced rays.\n");
+    printf("\t-reflectivity <value>: Fraction of the light reflected at each strike on the mirror (default 1). For -sun-samples.\n");
+    printf("\t-convolve: For -flux-bins and -farfield - trace the -sun-samples from a point sun (the ideal response), and then\n");
+    printf("\t\tconvolve (by FFT) the histograms with the sun's shape (-sun-shape, -sw) and the slope-error. Far fewer samples are\n");
+    printf("\t\tneeded for a smooth profile. The screen's kernel is scaled by the mean distance from the mirror to the screen.\n");
+    printf("\t-slope-error <degrees>: Standard deviation of the mirror's surface normal (Gaussian). Implies -convolve.\n");
+    printf("\t-mirror <X> <Y> <R> <mna> <mxa>: Adds a concave mirror to a mirror-field (center-of-curvature X,Y, radius R, and\n");
+    printf("\t\tnormal directions mna to mxa). May be repeated. A mirror-field replaces the single mirror (-r, -mna, -mxa): it's traced\n");
+    printf("\t\twith -sun-samples (default 100000) - with shading and blocking between the mirrors and stencils. Reports\n");
+    printf("\t\tnum_mirrors, shading and blocking (fractions of flux_in), and feeds -flux-bins and -farfield. Not drawn by -svg.\n");
+    printf("\t-mirror-row <count> <X> <Y> <DX> <DY> <R> <mna> <mxa>: Adds count mirrors - the 1st with COC X,Y, then in steps of DX,DY.\n");
+    printf("\t-profile <filename>: A mirror with a tabulated (e.g. measured) profile - one X,Y point per line, in order along the\n");
+    printf("\t\tmirror with the reflective side on the left (e.g. left to right for a mirror facing up). Fitted with a spline.\n");
+    printf("\t\tReplaces the single mirror (traced with -sun-samples; reports its own shading and blocking).\n");
+    printf("\t\tCan't be combined with -mirror, -mirror-row or -stencil/-stencil-file in the same case.\n");
+    printf("\t-stencil-file <filename>: Adds the stencil lines of filename - as -stencil, X1 Y1 X2 Y2 per line (separated by spaces,\n");
+    printf("\t\ttabs or commas; lines starting with # are skipped). A filename ending in .bin is packed binary instead - 4 doubles\n");
+    printf("\t\tper line (native byte order, e.g. from numpy's tofile()). The file is memory-mapped.\n");
+    printf("\t-target-file <filename>: Adds the target points of filename - as -target, X Y per line (or 2 doubles each, for .bin).\n");
+    printf("\t-glaremap <x0> <x1> <nx> <y0> <y1> <ny> [<filename>]: (convex) A glare map - the reflected sun as seen by an observer\n");
+    printf("\t\tat each point of an nx by ny grid (from x0,y0 to x1,y1 - the mirror's COC is at 0,0). All the grid points are solved\n");
+    printf("\t\tas one batch (see -threads). Written as CSV to filename (default output_glaremap.csv): the observed angles of\n");
+    printf("\t\tthe reflected sun (mid, bot, top), the reflection point on the mirror, and the brightness (as -pupil).\n");
+    printf("\t-brighttable [<d0> <d1> <nd> <s0> <s1> <ns>] [<filename>]: Prints a table of the brightness (in ppm) of the sun reflected\n");
+    printf("\t\toff a convex mirror (radius -r, default 100) - for nd distances of the observer from the mirror's surface (log spaced\n");
+    printf("\t\tfrom d0 to d1) by ns sun angles (-sa, from s0 to s1). Defaults to a 24x22 table. With a filename, the table is\n");
+    printf("\t\twritten as CSV instead. Also uses -sw and -threads. A cell is - (empty in the CSV) where the reflection can't be seen\n");
+    printf("\t\t(earlier versions printed the previous cell's value there - and, searching too wide a range of normals, could\n");
+    printf("\t\tdiffer from these by a few ppm).\n");
+    printf("\t-find-event <parameter> <from> <to> <name> [<threshold>]: Finds where name (as -csv2 - or num_reflected or num_nstrike,\n");
+    printf("\t\tthe counts of forward-traced rays) changes as parameter (radius, distance, sun_a, sun_A, sun_width, min_normal,\n");
+    printf("\t\tmax_normal or mirror_width) goes from <from> to <to>. With a threshold, a change is crossing it - otherwise, any change\n");
+    printf("\t\tof value. Becoming undefined (e.g. a convex reflection passing the tangent) is also a change. Each change found by a\n");
+    printf("\t\tcoarse scan (20 intervals) is bisected to about 1e-10 of the range.\n");
+    printf("\t-sun-path <latitude> <azimuth> <start> <end> <minutes> <names> [<filename>]: Follows the sun across the sky - a case\n");
+    printf("\t\tfor every <minutes> from start to end (YYYY-MM-DD or YYYY-MM-DDTHH:MM, local mean solar time) while the sun is up.\n");
+    printf("\t\tThe sun's position (NOAA's algorithm) at latitude is projected onto the model's vertical plane - whose +X axis points\n");
+    printf("\t\ttowards azimuth (degrees clockwise from north) - for -sa. Writes a CSV time series (default output_sunpath.csv) of\n");
+    printf("\t\tthe sun's elevation, azimuth and -sa, and each of the comma-separated names (as -csv2). Cases run in parallel.\n");
+    printf("\t-threads <value>: Number of worker threads for the parallel calculations (defaults to one per hardware thread).\n");
+    printf("\t-quality fast|default|exact: The solvers' tolerances together - the reverse-trace searches to 1e-4, 1e-6 or 1e-9 degrees\n");
+    printf("\t\t(with 17, 51 or 101 steps across the arc, and up to 40, 100 or 200 bisections for convex), and up to 8, 20 or 50\n");
+    printf("\t\treflections per ray. fast also traces the -sun-samples without trig (but for polynomial sin/cos). Each case's\n");
+    printf("\t\testimated error (degrees) is printed - or, with -csv2, as quality_err.\n");
     printf("\t-csv: generates results in a comma-separated-values format on standard-output.\n");
     printf("\t-svg <filename>: generates SVG graphics in the indicated filename. Typically observer in a browser.\n");
     printf("\t-animate: Adds animation to the SVG (per the test-cases identified with -next or -iterate).\n");
@@ -2256,6 +6736,11 @@ void usage(const char* program_name)
 
 }
 
+namespace {
+int brighttable(const TheData& settings, std::vector<double> distances, std::vector<double> sun_angles, const std::string& csv_filename); // Defined near the end of this file
+bool GlareMapReport(FILE *fout, const TheData& td, int case_index, bool header, double x0, double x1, int nx, double y0, double y1, int ny); // ditto
+}
+
 int main(int argc, const char* argv[])
 {
     std::deque<TheData> td;
@@ -2263,7 +6748,10 @@ int main(int argc, const char* argv[])
     int tdi = 0; // Number of elements used in td
 
     int do_iterate = 0;
-    arg_iterator arg_it[3];
+    int do_jobs = 0;
+    std::string jobs_filename;
+    int jobs_case = 0; // the case the -jobs replace
+    std::vector<arg_iterator> arg_it;
     int aii = 0; // Number of elements used in arg_it
 
     int do_svg = 0;
@@ -2272,6 +6760,27 @@ int main(int argc, const char* argv[])
     int do_csv = 0;
     int calc_pupil = 0;
     int num_rays = 3;
+    double converge_tolerance = 0;
+    int converge_max_rays = 4097;
+    std::string flux_filename = "output_flux.csv";
+    std::string farfield_filename = "output_farfield.csv";
+    int glaremap_nx = 0, glaremap_ny = 0;
+    double glaremap_x0 = 0, glaremap_x1 = 0, glaremap_y0 = 0, glaremap_y1 = 0;
+    std::string glaremap_filename = "output_glaremap.csv";
+    int do_brighttable = 0;
+    std::vector<double> brighttable_distances, brighttable_sun_angles;
+    std::string brighttable_filename; // empty: the ppm table on standard-output
+    SunPathSweep sun_path;
+    std::string sun_path_filename = "output_sunpath.csv";
+    EventFinder event_finder;
+    AdaptiveSweep adaptive;
+    ParameterSampler sampler;
+    std::string sampler_filename = "output_samples.csv";
+    std::string adaptive_filename = "output_adaptive.csv";
+    Optimizer optimizer;
+    std::string optimizer_filename = "output_optimize.csv";
+    int do_serve = 0;
+    CaseServer server;
 
     double offset_X=0, offset_Y=0;
 
@@ -2283,8 +6792,6 @@ int main(int argc, const char* argv[])
     double default_mirror_width = BadValue;
     int animate_interval_ms = 200;
 
-    int do_convex = 0;
-    int do_concave = 0;
     int do_boxes = 0;
     int focal_pts = 0;
 
@@ -2299,11 +6806,18 @@ int main(int argc, const char* argv[])
              if (strcmp(argv[ii], "-svg"     ) == 0) { do_svg++; if (((ii+1)<argc) && (argv[ii+1][0] != '-')) { ii++; svg_filename = argv[ii]; }}
         else if (strcmp(argv[ii], "-help"    ) == 0) { usage(argv[0]); exit(0); }
         else if (strcmp(argv[ii], "-title"   ) == 0) { title = argv[++ii]; }
-        else if (strcmp(argv[ii], "-convex"  ) == 0) { do_convex=1; do_concave=0; td[tdi].m_IsConvex = 1; }
-        else if (strcmp(argv[ii], "-concave" ) == 0) { do_convex=0; do_concave=1; td[tdi].m_IsConvex = 0; }
         else if (strcmp(argv[ii], "-debug"   ) == 0) { dvo_debug++; if (((ii+1)<argc) && (argv[ii+1][0] != '-')) { ii++; dvo_debug = atoi(argv[ii]); }}
         else if (strcmp(argv[ii], "-test"    ) == 0) { int result = CoordConverter::Test(); exit(result); }
-        else if (strcmp(argv[ii], "-brighttable")==0){ int brighttable(); int result = brighttable(); exit(result); }
+        else if (strcmp(argv[ii], "-brighttable")==0){
+            do_brighttable = 1;
+            if (((ii+6)<argc) && (isdigit(argv[ii+1][0]) || (argv[ii+1][0] == '.'))) {
+                double d0 = atof(argv[++ii]), d1 = atof(argv[++ii]); int nd = atoi(argv[++ii]);
+                double s0 = atof(argv[++ii]), s1 = atof(argv[++ii]); int ns = atoi(argv[++ii]);
+                for (int dd=0; dd<nd; dd++) brighttable_distances.push_back( (nd > 1) ? d0 * pow( d1/d0, double(dd)/(nd-1) ) : d0 ); // log spaced
+                for (int ss=0; ss<ns; ss++) brighttable_sun_angles.push_back( (ns > 1) ? s0 + (s1 - s0) * ss / (ns-1) : s0 );
+            }
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) { ii++; brighttable_filename = argv[ii]; }
+        }
         else if (strcmp(argv[ii], "-report"  ) == 0) { ray_report++; }
         else if (strcmp(argv[ii], "-box"     ) == 0) { do_boxes++; }
         else if (strcmp(argv[ii], "-focal_pts")== 0) { focal_pts++; }
@@ -2312,8 +6826,85 @@ int main(int argc, const char* argv[])
         else if (strcmp(argv[ii], "-reverse" ) == 0) { do_reverse_trace++; }
         else if (strcmp(argv[ii], "-pupil"   ) == 0) { calc_pupil++; }
         else if (strcmp(argv[ii], "-iterate" ) == 0) { do_iterate++; }
-        else if (strcmp(argv[ii], "-sw"      ) == 0) { ii++; td[tdi].m_sun_width_ang    = atof(argv[ii]); }
-        else if (strcmp(argv[ii], "-nr"      ) == 0) { ii++; num_rays    = atoi(argv[ii]); }
+        else if (ArgStatus status = ParseRunArgument(argc, argv, ii, td[tdi], num_rays, dvo_quality)) { if (status == ArgBad) exit(1); }
+        else if (strcmp(argv[ii], "-threads" ) == 0) { dvo_threads = atoi(argv[++ii]); }
+        else if (strcmp(argv[ii], "-flux-bins")== 0) {
+            td[tdi].m_flux_bins = atoi(argv[++ii]);
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) { ii++; flux_filename = argv[ii]; }
+        }
+        else if (strcmp(argv[ii], "-farfield") == 0) {
+            td[tdi].m_farfield_bins = atoi(argv[++ii]);
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) { ii++; farfield_filename = argv[ii]; }
+        }
+        else if (strcmp(argv[ii], "-glaremap") == 0) {
+            glaremap_x0 = atof(argv[++ii]); glaremap_x1 = atof(argv[++ii]); glaremap_nx = atoi(argv[++ii]);
+            glaremap_y0 = atof(argv[++ii]); glaremap_y1 = atof(argv[++ii]); glaremap_ny = atoi(argv[++ii]);
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) { ii++; glaremap_filename = argv[ii]; }
+        }
+        else if (strcmp(argv[ii], "-sun-path") == 0) {
+            if (argc < (ii+7)) { fprintf(stderr,"ERROR: Expecting 6 fields for the %s argument\n", argv[ii]); exit(1); }
+            sun_path.m_latitude = atof(argv[++ii]);
+            sun_path.m_plane_azimuth = atof(argv[++ii]);
+            time_t* dates[] = { &sun_path.m_start, &sun_path.m_end };
+            for (size_t dd = 0; dd < sizeof(dates)/sizeof(dates[0]); dd++) {
+                ii++;
+                if (!ParseDateTime(argv[ii], *dates[dd])) {
+                    fprintf(stderr, "ERROR: Expecting dates as YYYY-MM-DD or YYYY-MM-DDTHH:MM for -sun-path (not %s)\n", argv[ii] );
+                    exit(1);
+                }
+            }
+            sun_path.m_step_minutes = atof(argv[++ii]);
+            sun_path.m_values = SplitNames( argv[++ii] );
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) { ii++; sun_path_filename = argv[ii]; }
+        }
+        else if (strcmp(argv[ii], "-sample") == 0) {
+            if (argc < (ii+4)) { fprintf(stderr,"ERROR: Expecting at least 3 fields for the %s argument\n", argv[ii]); exit(1); }
+            ii++;
+                 if (strcmp(argv[ii], "sobol") == 0) sampler.m_method = ParameterSampler::Sobol;
+            else if (strcmp(argv[ii], "lhs"  ) == 0) sampler.m_method = ParameterSampler::LatinHypercube;
+            else { fprintf(stderr,"ERROR: Expecting sobol or lhs for -sample (not %s)\n", argv[ii]); exit(1); }
+            sampler.m_count = strtoul(argv[++ii], NULL, 0);
+            sampler.m_values = SplitNames( argv[++ii] );
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) sampler_filename = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-optimize") == 0) {
+            if (argc < (ii+2)) { fprintf(stderr,"ERROR: Expecting at least 1 field for the %s argument\n", argv[ii]); exit(1); }
+            optimizer.m_metric = argv[++ii];
+            if (((ii+1)<argc) && ((strcmp(argv[ii+1], "min") == 0) || (strcmp(argv[ii+1], "max") == 0)))
+                optimizer.m_maximize = (strcmp(argv[++ii], "max") == 0);
+            if (((ii+1)<argc) && isdigit(argv[ii+1][0])) optimizer.m_max_evaluations = atoi(argv[++ii]);
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) optimizer_filename = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-jobs"   ) == 0) {
+            if (argc < (ii+2)) { fprintf(stderr,"ERROR: Expecting 1 field for the %s argument\n", argv[ii]); exit(1); }
+            if (do_jobs++) { fprintf(stderr,"ERROR: Only one -jobs.\n"); exit(1); }
+            jobs_filename = argv[++ii];
+            jobs_case = tdi; // (loaded after the other options - see below)
+        }
+        else if (strcmp(argv[ii], "-serve"  ) == 0) {
+            do_serve = 1;
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) server.m_values = SplitNames( argv[++ii] );
+        }
+        else if (strcmp(argv[ii], "-adaptive") == 0) {
+            if (argc < (ii+3)) { fprintf(stderr,"ERROR: Expecting at least 2 fields for the %s argument\n", argv[ii]); exit(1); }
+            adaptive.m_metric = argv[++ii];
+            adaptive.m_tolerance = atof(argv[++ii]);
+            if (((ii+1)<argc) && isdigit(argv[ii+1][0])) adaptive.m_max_depth = atoi(argv[++ii]);
+            if (((ii+1)<argc) && (argv[ii+1][0] != '-')) adaptive_filename = argv[++ii];
+        }
+        else if (strcmp(argv[ii], "-find-event") == 0) {
+            if (argc < (ii+5)) { fprintf(stderr,"ERROR: Expecting at least 4 fields for the %s argument\n", argv[ii]); exit(1); }
+            event_finder.m_parameter = argv[++ii];
+            event_finder.m_from = atof(argv[++ii]);
+            event_finder.m_to = atof(argv[++ii]);
+            event_finder.m_metric = argv[++ii];
+            if (((ii+1)<argc) && (isdigit(argv[ii+1][0]) || (argv[ii+1][0] == '.') || (argv[ii+1][0] == '-' && isdigit(argv[ii+1][1]))))
+                event_finder.m_threshold = atof(argv[++ii]);
+        }
+        else if (strcmp(argv[ii], "-converge") == 0) {
+            converge_tolerance = atof(argv[++ii]);
+            if (((ii+1)<argc) && isdigit(argv[ii+1][0])) { ii++; converge_max_rays = atoi(argv[ii]); }
+        }
         else if (strcmp(argv[ii], "-csv"     ) == 0) { do_csv++; }
         else if (strcmp(argv[ii], "-csv2"    ) == 0) {
             // Expect 3 more arguments - name of row-index (independent variable #1), name of col-index (independent variable #2) and value
@@ -2324,41 +6915,20 @@ int main(int argc, const char* argv[])
             csv2_col = argv[++ii];
             csv2_val = argv[++ii];
              } 
-        else if (strcmp(argv[ii], "-screen" ) == 0) {
-            if (argc < (ii+4)) fprintf(stderr,"ERROR: Expecting 4 fields for the %s argument: End points (each with an X,Y value) for the screen.\n", argv[ii]);
-            double X1 = atof( argv[++ii] );
-            double Y1 = atof( argv[++ii] );
-            double X2 = atof( argv[++ii] );
-            double Y2 = atof( argv[++ii] );
-            td[tdi].m_screen = Segment( Point(X1,Y1), Point(X2,Y2) );
-        }
-        else if (strcmp(argv[ii], "-stencil" ) == 0) {
-            if (argc < (ii+4)) fprintf(stderr,"ERROR: Expecting 4 fields for the %s argument: End points (each with an X,Y value) for one line of the stencil.\n", argv[ii]);
-            double X1 = atof( argv[++ii] );
-            double Y1 = atof( argv[++ii] );
-            double X2 = atof( argv[++ii] );
-            double Y2 = atof( argv[++ii] );
-            td[tdi].m_stencils.push_back(  Segment( Point(X1,Y1), Point(X2,Y2) ) );
-        }
         else if (strcmp(argv[ii], "-offset" ) == 0) {
             if (argc < (ii+2)) fprintf(stderr,"ERROR: Expecting 2 fields for the %s argument", argv[ii]);
             offset_X = atof( argv[++ii] );
             offset_Y = atof( argv[++ii] );
         }
-        else if (strcmp(argv[ii], "-target" ) == 0) {
-            if (argc < (ii+2)) fprintf(stderr,"ERROR: Expecting 2 fields for the %s argument", argv[ii]);
-            double X = atof( argv[++ii] );
-            double Y = atof( argv[++ii] );
-            td[tdi].m_target_pts.push_back( Point(X,Y) );
-        }
+        else if (ArgStatus status = ParseCaseArgument(argc, argv, ii, td[tdi])) { if (status == ArgBad) exit(1); }
         else if (do_iterate) { // We interpret some arguments differently depending on whether the -iterate argument has been specified (must be earlier)
-            if (aii >= sizeof(arg_it)/sizeof(arg_it[0])) fprintf(stderr, "Error: too many iterate arguments (%d >= %d)\n", aii, sizeof(arg_it)/sizeof(arg_it[0]));
+            arg_it.resize(aii+1);
                  if (strcmp(argv[ii], "-r"   ) == 0) { GrabIteratorArgs( ii, argc, argv, "radius",       arg_it[aii] ); aii++; }
             else if (strcmp(argv[ii], "-d"   ) == 0) { GrabIteratorArgs( ii, argc, argv, "distance",     arg_it[aii] ); aii++; }
-            else if (strcmp(argv[ii], "-sa"  ) == 0) { GrabIteratorArgs( ii, argc, argv, "sunangle",     arg_it[aii] ); aii++; }
-            else if (strcmp(argv[ii], "-sA"  ) == 0) { GrabIteratorArgs( ii, argc, argv, "sunaltitude",  arg_it[aii] ); aii++; }
-            else if (strcmp(argv[ii], "-mna" ) == 0) { GrabIteratorArgs( ii, argc, argv, "minnormal",    arg_it[aii] ); aii++; }
-            else if (strcmp(argv[ii], "-mxa" ) == 0) { GrabIteratorArgs( ii, argc, argv, "mixnormal",    arg_it[aii] ); aii++; }
+            else if (strcmp(argv[ii], "-sa"  ) == 0) { GrabIteratorArgs( ii, argc, argv, "sun_a",        arg_it[aii] ); aii++; }
+            else if (strcmp(argv[ii], "-sA"  ) == 0) { GrabIteratorArgs( ii, argc, argv, "sun_A",        arg_it[aii] ); aii++; }
+            else if (strcmp(argv[ii], "-mna" ) == 0) { GrabIteratorArgs( ii, argc, argv, "min_normal",   arg_it[aii] ); aii++; }
+            else if (strcmp(argv[ii], "-mxa" ) == 0) { GrabIteratorArgs( ii, argc, argv, "max_normal",   arg_it[aii] ); aii++; }
             else if (strcmp(argv[ii], "-mw"  ) == 0) { GrabIteratorArgs( ii, argc, argv, "mirror_width", arg_it[aii] ); aii++; }
             else    { fprintf(stderr, "ERROR - unrecognized command line argument (#%d): %s - with -iterate option.\n", ii, argv[ii] ); }
         } else { // not iterate
@@ -2373,6 +6943,112 @@ int main(int argc, const char* argv[])
             else    { fprintf(stderr, "ERROR - unrecognized command line argument (#%d): %s\n", ii, argv[ii] ); }
         }
     } // for ii<argc
+    if (do_jobs && do_iterate) { fprintf(stderr,"ERROR: -jobs is not compatible with -iterate.\n"); exit(1); }
+    if (do_jobs) { // the jobs replace their case - whose settings (the options before and after -jobs) are each job's defaults
+        if (tdi != jobs_case) { fprintf(stderr,"ERROR: -next can't follow -jobs.\n"); exit(1); }
+        TheData base;
+        base.DuplicateSettings( td[tdi] );
+        td.resize(tdi);
+        if (! LoadJobs( jobs_filename.c_str(), base, td )) exit(1);
+        if (int(td.size()) == jobs_case) { fprintf(stderr,"ERROR: No cases in the -jobs file %s.\n", jobs_filename.c_str()); exit(1); }
+        tdi = td.size() - 1;
+    }
+
+    { // Demand-driven: when the outputs are just named values (-csv2, or a sweep's names), Calculate() skips the stages they don't need
+        std::vector<std::string> names = adaptive.m_values;
+        if (do_csv2) { names.push_back( csv2_row ); names.push_back( csv2_col ); names.push_back( csv2_val ); }
+        if ((dvo_quality != &quality_tiers[1]) && !do_csv2) names.push_back( "quality_err" ); // (each case's "Quality" line)
+        if (event_finder.Defined()) names.push_back( event_finder.m_metric );
+        if (optimizer.Defined()) names.push_back( optimizer.m_metric );
+        if (adaptive.Defined()) names.push_back( adaptive.m_metric );
+        names.insert( names.end(), sampler.m_values.begin(), sampler.m_values.end() );
+        names.insert( names.end(), sun_path.m_values.begin(), sun_path.m_values.end() );
+        bool whole_case = do_svg || ray_report || do_csv || dvo_debug || glaremap_nx || do_serve || names.empty();
+        for (int ii=0; ii<=tdi; ii++) {
+            unsigned outputs = (td[ii].m_flux_bins || td[ii].m_farfield_bins) ? unsigned(OutSamples) : 0; // (their files)
+            if (converge_tolerance > 0) outputs |= OutRays | OutFocal;
+            for (auto it = names.begin(); it != names.end(); ++it) outputs |= TheData::OutputsFor( *it );
+            td[ii].m_outputs = (whole_case || !td[ii].m_gradient_parameter.empty()) ? unsigned(OutAll) : outputs;
+        }
+    }
+
+    if (do_brighttable) exit( brighttable(td[0], brighttable_distances, brighttable_sun_angles, brighttable_filename) );
+    if (event_finder.Defined()) exit( event_finder.Run(td[0], num_rays, calc_pupil) );
+    if (sampler.Defined()) {
+        for (int ii=0; ii<aii; ii++) {
+            std::vector<double> values = arg_it[ii].Values();
+            sampler.m_parameters.push_back( arg_it[ii].parameter_name );
+            sampler.m_ranges.push_back( std::make_pair( values.front(), values.back() ) );
+        }
+        sampler.m_seed = td[tdi].m_seed;
+        FILE *sampler_fout = fopen(sampler_filename.c_str(), "w");
+        if (sampler_fout == NULL) {
+            fprintf(stderr, "Error: Can't open %s for writing.\n", sampler_filename.c_str() );
+            exit(1);
+        }
+        int result = sampler.Run(td[tdi], num_rays, calc_pupil, sampler_fout);
+        fclose(sampler_fout);
+        exit(result);
+    }
+    if (optimizer.Defined()) {
+        for (int ii=0; ii<aii; ii++) {
+            std::vector<double> values = arg_it[ii].Values();
+            optimizer.m_parameters.push_back( arg_it[ii].parameter_name );
+            optimizer.m_ranges.push_back( std::make_pair( values.front(), values.back() ) );
+        }
+        int result = optimizer.Run(td[tdi], num_rays, calc_pupil);
+        FILE *optimizer_fout = fopen(optimizer_filename.c_str(), "w");
+        if (optimizer_fout == NULL) {
+            fprintf(stderr, "Error: Can't open %s for writing.\n", optimizer_filename.c_str() );
+            exit(1);
+        }
+        optimizer.TraceReport(optimizer_fout);
+        fclose(optimizer_fout);
+        exit(result);
+    }
+    if (adaptive.Defined()) {
+        for (int ii=0; ii<aii; ii++) {
+            adaptive.m_parameters.push_back( arg_it[ii].parameter_name );
+            adaptive.m_axes.push_back( arg_it[ii].Values() );
+        }
+        if (do_csv2) adaptive.m_values.push_back( csv2_val );
+        int result = adaptive.Run(td[tdi], num_rays, calc_pupil);
+        if (result) exit(result);
+        FILE *adaptive_fout = fopen(adaptive_filename.c_str(), "w");
+        if (adaptive_fout == NULL) {
+            fprintf(stderr, "Error: Can't open %s for writing.\n", adaptive_filename.c_str() );
+            exit(1);
+        }
+        adaptive.SampleReport(adaptive_fout);
+        fclose(adaptive_fout);
+        if (do_csv2) exit( adaptive.PivotReport(csv2_row, csv2_col, csv2_val) ? 0 : 1 );
+        double regular_cases = 1;
+        for (auto it = adaptive.m_axes.begin(); it != adaptive.m_axes.end(); ++it)
+            regular_cases *= (it->size() - 1) * (1L << adaptive.m_depth_reached) + 1;
+        printf("adaptive: %d cases, refined %d times (the regular grid at that resolution: %.0f cases)\n",
+               int(adaptive.m_samples.size()), adaptive.m_depth_reached, regular_cases );
+        exit(0);
+    }
+    if (sun_path.Defined()) {
+        FILE *sun_path_fout = fopen(sun_path_filename.c_str(), "w");
+        if (sun_path_fout == NULL) {
+            fprintf(stderr, "Error: Can't open %s for writing.\n", sun_path_filename.c_str() );
+            exit(1);
+        }
+        int result = sun_path.Run(td[0], num_rays, calc_pupil, sun_path_fout);
+        fclose(sun_path_fout);
+        exit(result);
+    }
+    if (do_serve) {
+        server.m_base.DuplicateSettings( td[tdi] );
+        server.m_num_rays = num_rays;
+        server.m_do_pupil = calc_pupil;
+        server.m_reverse = do_reverse_trace;
+        if (server.m_values.empty()) server.m_values = SplitNames( "ref_focal_d,ref_blur,ref_width" );
+        int result = server.Run(stdin, stdout);
+        if (dvo_debug) fprintf(stderr, "serve: %zu jobs, %zu errors\n", server.m_jobs, server.m_errors);
+        exit(result);
+    }
 
     if (aii && dvo_debug)
         for (int ii=0; ii<aii; ii++) {
@@ -2386,14 +7062,9 @@ int main(int argc, const char* argv[])
         }
 
     if (aii) {
-        int it_indices[ sizeof(arg_it)/sizeof(arg_it[0]) ];
-        double it_values[ sizeof(arg_it)/sizeof(arg_it[0]) ];
-        int bad_index[ sizeof(arg_it)/sizeof(arg_it[0]) ];
-        for (int ii=0; ii<sizeof(arg_it)/sizeof(arg_it[0]); ii++) {
-            it_indices[ii] = 0;
-            it_values[ii] = 0;
-            bad_index[ii] = 0;
-        }
+        std::vector<int> it_indices( aii, 0 );
+        std::vector<double> it_values( aii, 0.0 );
+        std::vector<int> bad_index( aii, 0 );
         // Here's the approach - the first iterator in arg_it spins the fastest. Iterate through it until reaches its
         // end, then reset it to the beginning. Then increment the next iterator (if possible) and restart on the first iterator.
         int done = 0;
@@ -2419,19 +7090,9 @@ int main(int argc, const char* argv[])
 
             // Apply the values
             for (int ii=0; ii<aii; ii++) {
-                     if (arg_it[ii].parameter_name == "radius"      ) { td[tdi].m_radius           = it_values[ii]; }
-				else if (arg_it[ii].parameter_name == "distance"    ) { td[tdi].m_distance         = it_values[ii]; }
-                else if (arg_it[ii].parameter_name == "sunangle"    ) { td[tdi].m_sun_dir = it_values[ii]; }
-                else if (arg_it[ii].parameter_name == "sunaltitude" ) { td[tdi].m_sun_dir = it_values[ii] + 180; }
-                else if (arg_it[ii].parameter_name == "minnormal"   ) { td[tdi].m_min_normal_dir   = it_values[ii]; }
-                else if (arg_it[ii].parameter_name == "minnormal"   ) { td[tdi].m_max_normal_dir   = it_values[ii]; }
-                else if (arg_it[ii].parameter_name == "mirror_width") {
-                           td[tdi].m_max_normal_dir = 270 + it_values[ii]/2;
-                           td[tdi].m_min_normal_dir = 270 - it_values[ii]/2;
-                       } else {
+                if (! td[tdi].SetParameter( arg_it[ii].parameter_name, it_values[ii] ))
                     fprintf(stderr,"Unrecognized iterator parameter (%s) for index=%d at %d of %s\n",
                                    arg_it[ii].parameter_name.c_str(), ii, __LINE__, __FILE__ );
-                }
             }
             if (! done) {
                 tdi++; td.resize(tdi+1);
@@ -2443,6 +7104,7 @@ int main(int argc, const char* argv[])
 
 
     FILE *fout = NULL;
+    int svg_ray_index = 0; // numbers the rays (their CSS classes) across all of the cases in the SVG
     if (do_svg) {
         fout = fopen(svg_filename.c_str(), "w");
         if (fout == NULL) {
@@ -2452,13 +7114,28 @@ int main(int argc, const char* argv[])
     }
 
 
+    int converge_start_rays = num_rays;
     for (int ii=0; ii<=tdi; ii++) {
         if (dvo_debug>1) {
             printf("Iteration loop %d of %d\n", ii, tdi);
             td[ii].InputDump(stdout);
         }
-
-        td[ii].Calculate(do_reverse_trace ? 0 : num_rays, calc_pupil);
+        td[ii].DefaultSunSamples();
+
+        if ((converge_tolerance > 0) && !do_reverse_trace) {
+            bool converged = td[ii].CalculateConverged(converge_start_rays, converge_max_rays, converge_tolerance, calc_pupil);
+            if (!do_csv2)
+                printf("Converge %d: num_rays=%d, ref_focal_d=%g, ref_blur=%g, ref_width=%g, est_error=%g%s\n", ii,
+                        td[ii].m_NumRayPositions, td[ii].GetValue("ref_focal_d"), td[ii].GetValue("ref_blur"), td[ii].GetValue("ref_width"),
+                        td[ii].m_converge_error, converged ? "" : " (NOT converged)");
+            // Neighboring cases (-next/-iterate) usually need about the same number of rays. So start the next case one
+            // doubling below this one - if that's still sufficient, the next case costs just two calculations.
+            if (converged && !td[ii].m_IsConvex) converge_start_rays = Max(num_rays, int(td[ii].m_NumRayPositions+1)/2);
+        } else {
+            td[ii].Calculate(do_reverse_trace ? 0 : num_rays, calc_pupil);
+        }
+        if ((dvo_quality != &quality_tiers[1]) && !do_csv2)
+            printf("Quality %d: %s, est_error=%g degrees\n", ii, dvo_quality->m_name, td[ii].m_quality_error);
 
         if (dvo_debug) {
             printf("Calculated Data in Iteration loop %d of %d:\n", ii, tdi);
@@ -2469,6 +7146,10 @@ int main(int argc, const char* argv[])
         if (ray_report) {
             td[ii].RayReport(stdout,1);
         }
+        if (!do_csv2)
+            for (auto it = td[ii].m_gradient.begin(); it != td[ii].m_gradient.end(); ++it)
+                printf("Gradient %d: d(%s)/d(%s)=%g (%s=%g)\n", ii, it->first.c_str(), td[ii].m_gradient_parameter.c_str(), it->second,
+                        it->first.c_str(), td[ii].GetValue( it->first ) );
     }
 
     for (int ii=0; ii<=tdi; ii++) {
@@ -2477,18 +7158,60 @@ int main(int argc, const char* argv[])
             if (td[ii].m_distance != BadValue)
     			td[ii].GenSVG_Convex(fout, offset_X, offset_Y, ii==0, ii==tdi, animate);
             else
-                td[ii].GenSVG_Concave(fout, offset_X, offset_Y, title, ii==0, ii==tdi, animate, animate_interval_ms);
+                td[ii].GenSVG_Concave(fout, offset_X, offset_Y, title, svg_ray_index, ii==0, ii==tdi, animate, animate_interval_ms);
 #else
             if (td[ii].m_IsConvex) td[ii].GenSVG_Convex(fout, offset_X, offset_Y, ii==0, ii==tdi, animate);
-            else                   td[ii].GenSVG_Concave(fout, offset_X, offset_Y, title, ii==0, ii==tdi, animate, animate_interval_ms, do_boxes, focal_pts);
+            else if (!td[ii].m_scene.Empty() || !td[ii].m_profile.Empty())
+                fprintf(stderr, "Warning: -svg does not (yet) draw mirror-fields (-mirror) or profile mirrors (-profile). Case %d skipped.\n", ii);
+            else                   td[ii].GenSVG_Concave(fout, offset_X, offset_Y, title, svg_ray_index, ii==0, ii==tdi, animate, animate_interval_ms, do_boxes, focal_pts);
 #endif
         }
     }
 
     if (do_csv2) GenerateReport(td, csv2_row, csv2_col, csv2_val );
 
+    int first_flux_case = 0; // (-flux-bins may be set from any case on)
+    while ((first_flux_case <= tdi) && !td[first_flux_case].m_flux_bins) first_flux_case++;
+    if (first_flux_case <= tdi) {
+        FILE *flux_fout = fopen(flux_filename.c_str(), "w");
+        if (flux_fout == NULL) {
+            fprintf(stderr, "Error: Can't open %s for writing.\n", flux_filename.c_str() );
+            return false;
+        }
+        for (int ii=first_flux_case; ii<=tdi; ii++)
+            if (td[ii].m_flux_bins) td[ii].ScreenFluxReport(flux_fout, ii, ii == first_flux_case);
+        fclose(flux_fout);
+    }
+    int first_farfield_case = 0; // (as -flux-bins)
+    while ((first_farfield_case <= tdi) && !td[first_farfield_case].m_farfield_bins) first_farfield_case++;
+    if (first_farfield_case <= tdi) {
+        FILE *farfield_fout = fopen(farfield_filename.c_str(), "w");
+        if (farfield_fout == NULL) {
+            fprintf(stderr, "Error: Can't open %s for writing.\n", farfield_filename.c_str() );
+            return false;
+        }
+        for (int ii=first_farfield_case; ii<=tdi; ii++)
+            if (td[ii].m_farfield_bins) td[ii].FarFieldReport(farfield_fout, ii, ii == first_farfield_case);
+        fclose(farfield_fout);
+    }
+    if ((glaremap_nx > 0) && (glaremap_ny > 0)) {
+        FILE *glaremap_fout = fopen(glaremap_filename.c_str(), "w");
+        if (glaremap_fout == NULL) {
+            fprintf(stderr, "Error: Can't open %s for writing.\n", glaremap_filename.c_str() );
+            return false;
+        }
+        bool header = true; // (from the first convex case - the others are skipped)
+        for (int ii=0; ii<=tdi; ii++)
+            if (GlareMapReport(glaremap_fout, td[ii], ii, header, glaremap_x0, glaremap_x1, glaremap_nx, glaremap_y0, glaremap_y1, glaremap_ny))
+                header = false;
+        fclose(glaremap_fout);
+    }
+
     return 0;
 }
+#endif // SMRAYTRC_LIBRARY
+
+namespace { // (the internals, continued)
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2557,13 +7280,12 @@ int main(int argc, const char* argv[])
 
 
 
-static Point my_local_normal_point; // junk storage usable for an optional default argument.
-
-bool CalcFromNormal_Convex(const TheData&td,
-			double normal_ang,
-		       	double& ang_from_observer,
-		       	double& ang_from_sky,
-		       	Point & normalPt=my_local_normal_point)
+template<class PointType>
+bool CalcFromNormal_Convex(const PointType& MirrorCOCPt, typename ScalarOf<PointType>::type radius, const PointType& ObserverPt, double NormalTangentAng,
+			typename ScalarOf<PointType>::type normal_ang,
+		       	typename ScalarOf<PointType>::type& ang_from_observer,
+		       	typename ScalarOf<PointType>::type& ang_from_sky,
+		       	PointType & normalPt)
 // Convex Mirror
 	// Take the normal_angle (in degrees from Mirror's center-of-curvature) - 
 	// Step 1: calculate the (X,Y) coordinates on the mirror,
@@ -2572,8 +7294,9 @@ bool CalcFromNormal_Convex(const TheData&td,
 	// 	reflected at point (X,Y) to the observer.
 	// return success.
 {
+	typedef typename ScalarOf<PointType>::type Scalar;
 	// Step 0 - error check
-	if (normal_ang > td.m_NormalTangentAng) {
+	if (normal_ang > NormalTangentAng) {
 		ang_from_observer = ang_from_sky = 0;
 		normalPt.x(0);
 		normalPt.y(0);
@@ -2581,23 +7304,28 @@ bool CalcFromNormal_Convex(const TheData&td,
 	}
 
 	// Step 1
-	double normal_ang_radians = to_radians(normal_ang);
-	normalPt.x( td.m_MirrorCOCPt.x() + td.m_radius * cos( normal_ang_radians ) );
-	normalPt.y( td.m_MirrorCOCPt.y() + td.m_radius * sin( normal_ang_radians ) );
+	Scalar normal_ang_radians = to_radians(normal_ang);
+	normalPt.x( MirrorCOCPt.x() + radius * cos( normal_ang_radians ) );
+	normalPt.y( MirrorCOCPt.y() + radius * sin( normal_ang_radians ) );
 
 	// Step 2
-double observer_ang_radians = atan2( normalPt.y() - td.m_ObserverPt.y(), normalPt.x() - td.m_ObserverPt.x() ); 
-double ang_from_observer_old = to_degrees( observer_ang_radians );
-	ang_from_observer = Direction( td.m_ObserverPt, normalPt );
+	ang_from_observer = Direction( ObserverPt, normalPt );
 
 	// Step 3
-double ang_from_sky_old = 2* normal_ang + ang_from_observer;
 	ang_from_sky = normal_ang + normal_ang + (180-ang_from_observer) + 180;
 
-//printf("angle-from_observer(old)=%g, new=%g, angle-from-sky (old)=%g, new=%g\n", ang_from_observer_old, ang_from_observer, ang_from_sky_old, ang_from_sky );
 	return true;
 }
 
+bool CalcFromNormal_Convex(const TheData&td,
+			double normal_ang,
+		       	double& ang_from_observer,
+		       	double& ang_from_sky,
+		       	Point & normalPt)
+{
+	return CalcFromNormal_Convex( td.m_MirrorCOCPt, td.m_radius, td.m_ObserverPt, td.m_NormalTangentAng, normal_ang, ang_from_observer, ang_from_sky, normalPt );
+}
+
 
 
 bool SearchForSkyAng_Convex(const TheData& td,
@@ -2606,16 +7334,49 @@ bool SearchForSkyAng_Convex(const TheData& td,
 			double &found_sky_ang,
 			double &found_observer_ang,
 			Point  &found_MirrorPoint,
-			double acceptable_difference = 0.001)
+			double acceptable_difference = 0.001,
+			double start_normal = BadValue,
+			double start_window = 1.0)
 {
 	/* Successive approximation.
+	 * If start_normal is given (e.g. the solution of a neighboring case), a window of +/-start_window degrees
+	 * around it - widened until it brackets the target - lets the bisection skip the steps whose outcome the
+	 * window already decides. The later steps are the same as without start_normal, so is the result.
 	 */
 	double prev_ang_from_sky = 0; // to determine when we are close enough
 
 	double max_normal =  td.m_NormalTangentAng; // The search will close the window between max_normal and min_normal
 	double min_normal = -td.m_NormalTangentAng;
+	const double tolerance = dvo_quality->m_tolerance;
+	int first_iteration = 0;
+
+	for (double window = start_window; (start_normal != BadValue) && (window > 0); window *= 4) {
+		double low_normal  = Max( start_normal - window, min_normal );
+		double high_normal = Min( start_normal + window, max_normal );
+		double junk, low_sky, high_sky;
+		Point junk_pt; // (not the shared default - this may be running in several threads)
+		bool low_ok  = CalcFromNormal_Convex(td, low_normal,  junk, low_sky,  junk_pt);
+		bool high_ok = CalcFromNormal_Convex(td, high_normal, junk, high_sky, junk_pt);
+		if (low_ok && high_ok && (low_sky <= target_sky_ang) && (target_sky_ang <= high_sky)) {
+			// (a skipped step could only have stopped the search if an edge of the window is already within tolerance)
+			if (NearlyEqual(low_sky, target_sky_ang, SmallValue, tolerance) || NearlyEqual(high_sky, target_sky_ang, SmallValue, tolerance)) break;
+			double skipped_normal = BadValue;
+			while (first_iteration < dvo_quality->m_search_iterations) {
+				double guess_normal = (max_normal + min_normal) / 2;
+				if      (guess_normal <= low_normal)  min_normal = guess_normal;
+				else if (guess_normal >= high_normal) max_normal = guess_normal;
+				else break;
+				skipped_normal = guess_normal;
+				first_iteration++;
+			}
+			if (skipped_normal != BadValue) // the last skipped step's angle - for the convergence test
+				CalcFromNormal_Convex(td, skipped_normal, junk, prev_ang_from_sky, junk_pt);
+			break;
+		}
+		if ((low_normal == min_normal) && (high_normal == max_normal)) break; // Back to the full window
+	}
 
-	for (int iterate_counter = 0; iterate_counter < 100; iterate_counter++) {
+	for (int iterate_counter = first_iteration; iterate_counter < dvo_quality->m_search_iterations; iterate_counter++) {
 		double guess_normal = (max_normal + min_normal) / 2;
 
 		double ang_from_observer, ang_from_sky;
@@ -2629,8 +7390,8 @@ bool SearchForSkyAng_Convex(const TheData& td,
 				       	success, mirror_point.x(), mirror_point.y(), min_normal, max_normal);
 
 			// Conditions to stop looping...
-			if ( NearlyEqual(ang_from_sky, target_sky_ang) || ((iterate_counter >= 1) && NearlyEqual(prev_ang_from_sky, ang_from_sky))) {
-				bool passed = NearlyEqual(ang_from_sky,target_sky_ang); // Fails if didn't converge
+			if ( NearlyEqual(ang_from_sky, target_sky_ang, SmallValue, tolerance) || ((iterate_counter >= 1) && NearlyEqual(prev_ang_from_sky, ang_from_sky, SmallValue, tolerance))) {
+				bool passed = NearlyEqual(ang_from_sky, target_sky_ang, SmallValue, tolerance); // Fails if didn't converge
 
 				if (! passed ) { // Didn't converge
 					if (dvo_debug >= 3)
@@ -2659,6 +7420,153 @@ bool SearchForSkyAng_Convex(const TheData& td,
 }
 
 
+double NormalTangentAng_Convex(double radius, double distance)
+	// The normal angle (from the mirror's COC) of the tangent point - the upper-most point of the mirror that
+	// an observer at (distance,0) can see.
+{
+	// Calculate the tangent - imagine a right-triangle - mirror-tangent is 90 degrees, other 2 vertices are at observer and Mirror COC
+	double angle_tangentPt_obs_mirrorCoc = to_degrees( asin( radius / distance ) ); // angle at observer
+	double third_angle = 180.0 -90.0 - angle_tangentPt_obs_mirrorCoc; // angle at Mirror's COC
+	double third_angle_to_X_axis = 180.0 - third_angle; // assumes observer and Mirror's COC are both on X axis (Y=0)
+	return 90.0 + (90.0 - third_angle_to_X_axis); // From Mirror's COC
+}
+
+
+inline TracedRay::RayStatus ConvexRayKernel(double normal_dir, double sun_dir, double& reflect_dir)
+    // An incident ray (direction sun_dir) targets the point at normal_dir (from the COC) on the outside of a convex mirror.
+{
+    if (cos( to_radians(normal_dir - sun_dir) ) >= 0) return TracedRay::Obscured; // the point faces away from the sun
+    reflect_dir = NormalizeAngle( 2*normal_dir - sun_dir + 180 );
+    return TracedRay::Unobscured;
+}
+
+void TheData::TraceFan_Convex(int num_rays)
+    /* Forward ray-trace for a convex mirror - a fan of num_rays incident rays (from each of the top and bottom of the sun),
+     * spaced evenly across the incoming beam (so each carries the same flux) over the sunlit part of the arc
+     * (m_min_normal_dir to m_max_normal_dir), and each reflected off the outside of the circle. The reflected rays diverge.
+     * Extended back, neighboring rays cross on the virtual-image envelope (caustic) behind the mirror. Those crossings
+     * take the place of the Concave mirror's m_TopIntersectionPts and m_BotIntersectionPts (for ref_focal_d, ref_blur, ...).
+     */
+{
+    const double axis_dir = m_sun_dir + 180; // normal direction of the point on the mirror that faces the sun
+    // The sunlit part of the arc - as angles from axis_dir (within +/-90). If it's in two pieces, the larger is traced.
+    const double arc_start = NormalizeAngle( m_min_normal_dir - axis_dir + 180 ) - 180;
+    const double arc_length = m_max_normal_dir - m_min_normal_dir;
+    double lit_lo = 0, lit_hi = 0;
+    if (arc_length >= 360) { lit_lo = -90; lit_hi = 90; } // the whole circle
+    else for (int wrap=-1; wrap<=1; wrap++) {
+        double lo = Max( arc_start + 360*wrap, -90.0 );
+        double hi = Min( arc_start + 360*wrap + arc_length, 90.0 );
+        if (hi - lo > lit_hi - lit_lo) { lit_lo = lo; lit_hi = hi; }
+    }
+    if (lit_hi <= lit_lo) return; // none of the arc faces the sun
+
+    // The rays' offsets from the axis (across the incoming beam)
+    const double beam_lo = m_radius * sin( to_radians(lit_lo) );
+    const double beam_hi = m_radius * sin( to_radians(lit_hi) );
+    m_MidArcPt = Find2ndPoint( m_MirrorCOCPt, axis_dir + (lit_lo + lit_hi)/2, m_radius );
+    m_NumRayPositions = num_rays;
+
+    RayBatch& fan = m_FanRays;
+    fan.Resize( 2 * size_t(num_rays) );
+    const double weight = (beam_hi - beam_lo) / num_rays;
+    ParallelFor( num_rays, [&](size_t begin, size_t end, unsigned) {
+        for (size_t ii=begin; ii<end; ii++) {
+            double offset = beam_lo + (beam_hi - beam_lo) * (ii + 0.5) / num_rays;
+            double normal_dir = axis_dir + to_degrees( asin( offset / m_radius ) );
+            for (int bot=0; bot<=1; bot++) {
+                size_t index = ii + bot * size_t(num_rays);
+                fan.m_normal_dir[index] = NormalizeAngle( normal_dir );
+                fan.m_mirror[index] = 0;
+                fan.m_position[index] = m_radius * to_radians( NormalizeAngle( normal_dir - m_min_normal_dir ) );
+                fan.m_sun_dir[index] = m_sun_dir + (bot ? -m_sun_width_ang : m_sun_width_ang)/2;
+                fan.m_weight[index] = weight;
+                TracedRay::RayStatus status = ConvexRayKernel( normal_dir, fan.m_sun_dir[index], fan.m_reflect_dir[index] );
+                fan.m_ray_status[index] = status;
+                fan.m_strikes[index] = (status >= TracedRay::NStrike) ? 1 : 0;
+                fan.m_out_weight[index] = fan.m_strikes[index] ? weight * m_reflectivity : 0;
+                fan.m_exit_x[index] = m_MirrorCOCPt.x() + m_radius * cos( to_radians(normal_dir) );
+                fan.m_exit_y[index] = m_MirrorCOCPt.y() + m_radius * sin( to_radians(normal_dir) );
+            }
+        }
+    });
+
+    // The spread of the reflected directions. The ray at angle a (from axis_dir) reflects at about 2a from
+    // the sun's direction reversed - that unwraps the directions (the fan can cover nearly 360 degrees).
+    double min_spread = BadValue, max_spread = -BadValue;
+    for (size_t index=0; index<fan.Size(); index++) {
+        if (! fan.Reflected(index)) continue;
+        double twice_ang = 2 * (NormalizeAngle( fan.m_normal_dir[index] - axis_dir + 180 ) - 180);
+        double relative = twice_ang + NormalizeAngle( fan.m_reflect_dir[index] - (axis_dir + twice_ang) + 180 ) - 180;
+        min_spread = Min( min_spread, relative );
+        max_spread = Max( max_spread, relative );
+    }
+    if (max_spread >= min_spread) m_reflected_spread = max_spread - min_spread;
+
+    // The virtual-image envelope - where neighboring reflected rays (extended back) cross
+    for (int bot=0; bot<=1; bot++) {
+        std::deque<Point>& envelope = bot ? m_BotIntersectionPts : m_TopIntersectionPts;
+        BBox& bbox = bot ? m_BotIntersectionBBox : m_TopIntersectionBBox;
+        for (size_t ii=1; ii<size_t(num_rays); ii++) {
+            size_t index = ii + bot * size_t(num_rays);
+            if (! fan.Reflected(index) || ! fan.Reflected(index-1)) continue;
+            Point intersection_pt;
+            if (Intersection( Point(fan.m_exit_x[index-1], fan.m_exit_y[index-1]), fan.m_reflect_dir[index-1] + 180, // (extended back)
+                              Point(fan.m_exit_x[index],   fan.m_exit_y[index]),   fan.m_reflect_dir[index]   + 180, intersection_pt )) {
+                envelope.push_back( intersection_pt );
+                bbox.Update( intersection_pt );
+            }
+        }
+    }
+    ReflectedRayMetrics();
+}
+
+
+void TheData::CalculateGradient_Convex(int do_pupil)
+	/* The derivatives of the three searches (SearchForSkyAng_Convex()) - by implicit differentiation of
+	 * sky_ang(normal, parameter) = target(parameter) at each found normal - and then of the pupils and brightness.
+	 */
+{
+	if (!Defined(m_SunMidMirrorPt) || !Defined(m_SunBotMirrorPt) || !Defined(m_SunTopMirrorPt) || (m_Brightness2 == BadValue)) return;
+	const Dual radius( m_radius, GradientSeed("radius") );
+	const Dual sun_dir( m_sun_dir, GradientSeed("sun_dir") );
+	const Dual sun_width( m_sun_width_ang, GradientSeed("sun_width") );
+	const DualPoint coc( m_MirrorCOCPt.x(), m_MirrorCOCPt.y() );
+	const DualPoint observer( Dual( m_ObserverPt.x(), GradientSeed("distance") ), m_ObserverPt.y() ); // (the observer is at (distance,0))
+	const DualPoint constant_observer( m_ObserverPt.x(), m_ObserverPt.y() );
+
+	const Point* mirror_pts[] = { &m_SunMidMirrorPt, &m_SunBotMirrorPt, &m_SunTopMirrorPt };
+	DualPoint found_pts[3];
+	Dual found_observer_ang[3], sun_mid_ang;
+	for (int ii=0; ii<3; ii++) {
+		double normal = Direction( m_MirrorCOCPt, *mirror_pts[ii] );
+		if (normal > 180) normal -= 360; // (the searches are within +/-m_NormalTangentAng)
+		Dual target = (ii == 0) ? sun_dir : (ii == 1) ? sun_mid_ang - sun_width/2 : sun_mid_ang + sun_width/2;
+		Dual observer_ang, sky_ang;
+		DualPoint mirror_pt;
+
+		// d(sky_ang)/d(parameter) at a fixed normal, and d(sky_ang)/d(normal) at fixed parameters
+		CalcFromNormal_Convex( coc, radius, observer, m_NormalTangentAng, Dual(normal), observer_ang, sky_ang, mirror_pt );
+		double sky_by_parameter = sky_ang.d;
+		CalcFromNormal_Convex( coc, Dual(m_radius), constant_observer, m_NormalTangentAng, Dual(normal, 1), observer_ang, sky_ang, mirror_pt );
+		double sky_by_normal = sky_ang.d;
+		if (sky_by_normal == 0) return;
+
+		Dual found_normal( normal, (target.d - sky_by_parameter) / sky_by_normal );
+		CalcFromNormal_Convex( coc, radius, observer, m_NormalTangentAng, found_normal, found_observer_ang[ii], sky_ang, found_pts[ii] );
+		if (ii == 0) sun_mid_ang = sky_ang;
+	}
+
+	m_gradient["brightness2"] = (ApparentWidth_ang( found_pts[2], found_pts[1], observer ) / sun_width).d;
+	if (do_pupil && (m_Brightness != BadValue)) {
+		Dual pupil_entrance = ApparentWidth( found_pts[2], found_pts[1], sun_dir );
+		Dual pupil_exit     = ApparentWidth( found_pts[2], found_pts[1], found_observer_ang[0] );
+		m_gradient["pupil"] = m_gradient["pupil1"] = pupil_entrance.d;
+		m_gradient["pupil2"] = pupil_exit.d;
+		m_gradient["brightness"] = (pupil_entrance / pupil_exit).d;
+	}
+}
+
 void TheData::Calculate_Convex(int num_rays, int do_pupil)
 	/* The object a few 'input' parameters, and numerous 'derived' values - that are determined from the
 	 * 'input' parameters. This routine determines those derived values.
@@ -2675,11 +7583,7 @@ void TheData::Calculate_Convex(int num_rays, int do_pupil)
 			m_distance = 2.0;
 		}
 
-		// Calculate the tangent - imagine a right-triangle - mirror-tangent is 90 degrees, other 2 vertices are at observer and Mirror COC
-		double angle_tangentPt_obs_mirrorCoc = to_degrees( asin( m_radius / Distance(m_MirrorCOCPt, m_ObserverPt) ) ); // angle at observer
-		double third_angle = 180.0 -90.0 - angle_tangentPt_obs_mirrorCoc; // angle at Mirror's COC
-		double third_angle_to_X_axis = 180.0 - third_angle; // assumes observer and Mirror's COC are both on X axis (Y=0)
-		m_NormalTangentAng = 90.0 + (90.0 - third_angle_to_X_axis); // From Mirror's COC
+		m_NormalTangentAng = NormalTangentAng_Convex( m_radius, Distance(m_MirrorCOCPt, m_ObserverPt) );
 		if (1) { // Finds the tangent point
 			double junk1, junk2;
 			CalcFromNormal_Convex(*this, m_NormalTangentAng, junk1, junk2, m_TangentPt);
@@ -2687,13 +7591,20 @@ void TheData::Calculate_Convex(int num_rays, int do_pupil)
 		m_ObserverTangentAng = Direction( m_ObserverPt, m_TangentPt );
 
 
-		// Calculate (searches) for the 3 rays from observer to mirror to sun (reverse ray-tracing)
-		double normal_mid, normal_bot, normal_top;
-		bool success1 = SearchForSkyAng_Convex(*this, m_sun_dir, normal_mid, m_SunMidAng, m_ObserverReflectedSunMid, m_SunMidMirrorPt);
-		double target_sun_bot_ang = m_SunMidAng - m_sun_width_ang/2;
-		double target_sun_top_ang = m_SunMidAng + m_sun_width_ang/2;
-		bool success2 = SearchForSkyAng_Convex(*this, target_sun_bot_ang, normal_bot, m_SunBotAng, m_ObserverReflectedSunBot, m_SunBotMirrorPt);
-		bool success3 = SearchForSkyAng_Convex(*this, target_sun_top_ang, normal_top, m_SunTopAng, m_ObserverReflectedSunTop, m_SunTopMirrorPt);
+		// Calculate (searches) for the 3 rays from observer to mirror to sun (reverse ray-tracing) - unless only the fan's results are wanted
+		double normal_mid = BadValue, normal_bot = BadValue, normal_top = BadValue;
+		bool success1 = false, success2 = false, success3 = false;
+		double target_sun_bot_ang = BadValue, target_sun_top_ang = BadValue;
+		if (m_outputs & OutSolved) {
+			success1 = SearchForSkyAng_Convex(*this, m_sun_dir, normal_mid, m_SunMidAng, m_ObserverReflectedSunMid, m_SunMidMirrorPt);
+			target_sun_bot_ang = m_SunMidAng - m_sun_width_ang/2;
+			target_sun_top_ang = m_SunMidAng + m_sun_width_ang/2;
+			success2 = SearchForSkyAng_Convex(*this, target_sun_bot_ang, normal_bot, m_SunBotAng, m_ObserverReflectedSunBot, m_SunBotMirrorPt);
+			success3 = SearchForSkyAng_Convex(*this, target_sun_top_ang, normal_top, m_SunTopAng, m_ObserverReflectedSunTop, m_SunTopMirrorPt);
+		}
+		if (success1) m_quality_error = Max( m_quality_error, fabs( m_SunMidAng - m_sun_dir ) );
+		if (success2) m_quality_error = Max( m_quality_error, fabs( m_SunBotAng - target_sun_bot_ang ) );
+		if (success3) m_quality_error = Max( m_quality_error, fabs( m_SunTopAng - target_sun_top_ang ) );
 
 #if 0 // try1
 		if (success1 && success2 && success3 && do_pupil) { // experimental
@@ -2744,6 +7655,8 @@ void TheData::Calculate_Convex(int num_rays, int do_pupil)
 #endif
 
 
+		if (m_convex_fan && (num_rays > 0) && (m_outputs & (OutRays | OutFocal))) TraceFan_Convex(num_rays); // forward ray-trace
+
 		if (dvo_debug>=2)
 			printf("Results: %d%d%d: observer_angs: %g, %g, %g (diff=%g) sun_angs: (tar=%g) %g, %g, %g (diff=%g) (Normals=%g,%g,%g), Pupil=%g/%g, Bright=%g,%g\n",
 				success1, success2, success3,
@@ -2756,6 +7669,108 @@ void TheData::Calculate_Convex(int num_rays, int do_pupil)
 }
 
 
+bool ConvexBatch::Solve(size_t ii, TheData& scratch, double start_normal, double start_window)
+    /* Calculate_Convex()'s three searches (and the pupil/brightness calculations) for case ii. The case is solved in its
+     * own frame - rotated about the mirror's COC so that its observer is on the +X axis (as Calculate_Convex() requires) -
+     * and the results rotated back. scratch is working storage (one per thread). start_normal, if given, is an estimate of
+     * m_normal_mid[ii] (e.g. a neighboring case's) - to narrow the searches (see SearchForSkyAng_Convex()).
+     */
+{
+    m_success[ii] = 0;
+    m_normal_mid[ii] = m_observed_mid[ii] = m_observed_bot[ii] = m_observed_top[ii] = BadValue;
+    m_mirror_x[ii] = m_mirror_y[ii] = m_brightness[ii] = m_brightness2[ii] = BadValue;
+
+    const double x = m_observer_x[ii];
+    const double y = m_observer_y[ii];
+    const double distance = sqrt( x*x + y*y );
+    if (! (distance > m_radius)) return false; // the observer is on (or inside) the mirror
+
+    const double frame_dir = to_degrees( atan2(y, x) ); // direction of the observer from the COC
+    scratch.m_IsConvex = true;
+    scratch.m_radius = m_radius;
+    Set(scratch.m_MirrorCOCPt, 0, 0);
+    Set(scratch.m_ObserverPt, distance, 0);
+    scratch.m_NormalTangentAng = NormalTangentAng_Convex( m_radius, distance );
+    const double sun_dir = NormalizeAngle( m_sun_dir[ii] - frame_dir );
+    if (start_normal != BadValue) start_normal = NormalizeAngle( start_normal - frame_dir + 180 ) - 180;
+
+    double normal_mid, normal_bot, normal_top;
+    double sun_mid_ang, sun_bot_ang, sun_top_ang;
+    double observed_mid, observed_bot, observed_top;
+    Point mid_pt, bot_pt, top_pt;
+    if (! SearchForSkyAng_Convex(scratch, sun_dir, normal_mid, sun_mid_ang, observed_mid, mid_pt, 0.001, start_normal, start_window) ) return false;
+    // The bot and top rays reflect about a quarter of the sun's width from the mid ray
+    const bool warm = (start_normal != BadValue);
+    if (! SearchForSkyAng_Convex(scratch, sun_mid_ang - m_sun_width_ang/2, normal_bot, sun_bot_ang, observed_bot, bot_pt, 0.001,
+                                 warm ? normal_mid - m_sun_width_ang/4 : BadValue, m_sun_width_ang/4) ) return false;
+    if (! SearchForSkyAng_Convex(scratch, sun_mid_ang + m_sun_width_ang/2, normal_top, sun_top_ang, observed_top, top_pt, 0.001,
+                                 warm ? normal_mid + m_sun_width_ang/4 : BadValue, m_sun_width_ang/4) ) return false;
+
+    const double cos_frame = cos( to_radians(frame_dir) );
+    const double sin_frame = sin( to_radians(frame_dir) );
+    m_success[ii] = 1;
+    m_normal_mid[ii]   = NormalizeAngle( normal_mid   + frame_dir );
+    m_observed_mid[ii] = NormalizeAngle( observed_mid + frame_dir );
+    m_observed_bot[ii] = NormalizeAngle( observed_bot + frame_dir );
+    m_observed_top[ii] = NormalizeAngle( observed_top + frame_dir );
+    m_mirror_x[ii] = mid_pt.x() * cos_frame - mid_pt.y() * sin_frame;
+    m_mirror_y[ii] = mid_pt.x() * sin_frame + mid_pt.y() * cos_frame;
+    // The pupils and apparent widths don't depend on the frame
+    m_brightness[ii] = ApparentWidth( top_pt, bot_pt, sun_dir ) / ApparentWidth( top_pt, bot_pt, observed_mid );
+    m_brightness2[ii] = ApparentWidth_ang( top_pt, bot_pt, scratch.m_ObserverPt ) / m_sun_width_ang;
+    return true;
+}
+
+void SolveConvexBatch(const TheData& mirror, ConvexBatch& batch)
+    // Solves (ConvexBatch::Solve()) each of batch's cases for mirror - spread across the worker threads (see -threads).
+{
+    batch.m_radius = mirror.m_radius;
+    batch.m_sun_width_ang = mirror.m_sun_width_ang;
+    ParallelFor( batch.Size(), [&batch](size_t begin, size_t end, unsigned) {
+        TheData scratch;
+        for (size_t ii=begin; ii<end; ii++) batch.Solve(ii, scratch);
+    });
+}
+
+bool GlareMapReport(FILE *fout, const TheData& td, int case_index, bool header, double x0, double x1, int nx, double y0, double y1, int ny)
+    /* The reflected sun, as seen from each point of an nx by ny grid of observer positions (see -glaremap) - with
+     * the convex mirror's COC at (0,0). CSV - one line per grid point. The result columns are empty where the
+     * observer can't see the sun's reflection (or is inside the mirror). header: and 1st, the CSV header line.
+     * Returns false (nothing written) for a case that isn't convex.
+     */
+{
+    if (! td.m_IsConvex) {
+        fprintf(stderr, "Warning: -glaremap is only for convex mirrors. Case %d skipped.\n", case_index);
+        return false;
+    }
+    ConvexBatch batch;
+    batch.Resize( size_t(nx) * ny );
+    for (int yy=0; yy<ny; yy++) {
+        for (int xx=0; xx<nx; xx++) {
+            size_t index = size_t(yy) * nx + xx;
+            batch.m_observer_x[index] = (nx > 1) ? x0 + (x1 - x0) * xx / (nx-1) : x0;
+            batch.m_observer_y[index] = (ny > 1) ? y0 + (y1 - y0) * yy / (ny-1) : y0;
+            batch.m_sun_dir[index] = td.m_sun_dir;
+        }
+    }
+    SolveConvexBatch(td, batch);
+
+    if (header)
+        fprintf(fout, "case,sun_a,x,y,distance,observed_mid,observed_bot,observed_top,mirror_x,mirror_y,brightness,brightness2\n");
+    for (size_t ii=0; ii<batch.Size(); ii++) {
+        double x = batch.m_observer_x[ii];
+        double y = batch.m_observer_y[ii];
+        fprintf(fout, "%d,%g,%g,%g,%g,", case_index, td.m_sun_dir, x, y, sqrt( x*x + y*y ) );
+        if (batch.m_success[ii])
+            fprintf(fout, "%g,%g,%g,%g,%g,%g,%g\n", batch.m_observed_mid[ii], batch.m_observed_bot[ii], batch.m_observed_top[ii],
+                    batch.m_mirror_x[ii], batch.m_mirror_y[ii], batch.m_brightness[ii], batch.m_brightness2[ii] );
+        else
+            fprintf(fout, ",,,,,,\n");
+    }
+    return true;
+}
+
+
 static void OneRayFromSunToObserver_CalcLines(bool is_bad, double sun_ang,
 	       Point& found_sun_pt, Point& sun_pt2 /* start with mirror-point */,
 	       const Point& observer_pt,
@@ -3026,64 +8041,84 @@ bool TheData::GenSVG_Convex(FILE *fout, double offset_X, double offset_Y, bool f
 	}
 
 	if(last_call) fprintf(fout, "</svg>\n");
+	return true;
 }
 
 
 
 
-int brighttable()
+int brighttable(const TheData& settings, std::vector<double> distances, std::vector<double> sun_angles, const std::string& csv_filename)
+    /* The brightness (m_Brightness2) of the sun reflected off a convex mirror, for a table of distances (of the observer
+     * from the mirror's surface) and sun angles. settings provides the radius (default 100) and sun width. The rows (distances)
+     * are solved in parallel (see -threads) - and along each row, each search starts from its neighbor's solution.
+     */
 {
-    TheData td1;
-    
-    td1.m_radius = 100;
-    td1.m_IsConvex = true;
-    td1.m_ObserverPt.y(0);
-
-    static const double distances[] = { 0.1,0.2,0.5,1,2,5,10,20,50,100,200,500,1000,2000,5000,10000,20000,50000,100000,200000,500000,1000000,2000000,5000000};
-    const int num_distances = sizeof(distances)/sizeof(distances[0]);
-    static const int sun_angle_table[] = { 0, 1, 2, 5, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150, 160, 170, 180 };
-    const int num_sun_angles = sizeof(sun_angle_table)/sizeof(sun_angle_table[0]);
-
-    double results[num_distances][num_sun_angles]; // larger than needed (hopefully)
-    for (int ii=0; ii<num_distances; ii++) for (int jj=0; jj<num_sun_angles; jj++) results[ii][jj] = BadValue;
-
-    for (int distance_index=0; distance_index < num_distances; distance_index++) {
-        double distance = distances[distance_index];
-        td1.m_ObserverPt.x(100 + distance);
-
-        for (int sun_angle_index=0; sun_angle_index < num_sun_angles; sun_angle_index++) {
-            double sun_angle = sun_angle_table[sun_angle_index];
-            td1.m_sun_dir = sun_angle;
-
-            double normal_mid, normal_bot, normal_top;
-            bool success1 = SearchForSkyAng_Convex(td1, td1.m_sun_dir, normal_mid, td1.m_SunMidAng, td1.m_ObserverReflectedSunMid, td1.m_SunMidMirrorPt);
-            double target_sun_bot_ang = td1.m_SunMidAng - td1.m_sun_width_ang/2;
-            double target_sun_top_ang = td1.m_SunMidAng + td1.m_sun_width_ang/2;
-            bool success2 = SearchForSkyAng_Convex(td1, target_sun_bot_ang, normal_bot, td1.m_SunBotAng, td1.m_ObserverReflectedSunBot, td1.m_SunBotMirrorPt);
-            bool success3 = SearchForSkyAng_Convex(td1, target_sun_top_ang, normal_top, td1.m_SunTopAng, td1.m_ObserverReflectedSunTop, td1.m_SunTopMirrorPt);
-
-            td1.m_Brightness2 = ApparentWidth_ang( td1.m_SunTopMirrorPt, td1.m_SunBotMirrorPt, td1.m_ObserverPt ) / td1.m_sun_width_ang;
+    static const double default_distances[] = { 0.1,0.2,0.5,1,2,5,10,20,50,100,200,500,1000,2000,5000,10000,20000,50000,100000,200000,500000,1000000,2000000,5000000};
+    static const double default_sun_angles[] = { 0, 1, 2, 5, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150, 160, 170, 180 };
+    if (distances.empty())  distances.assign( default_distances, default_distances + sizeof(default_distances)/sizeof(default_distances[0]) );
+    if (sun_angles.empty()) sun_angles.assign( default_sun_angles, default_sun_angles + sizeof(default_sun_angles)/sizeof(default_sun_angles[0]) );
+    const size_t num_distances = distances.size();
+    const size_t num_sun_angles = sun_angles.size();
+
+    ConvexBatch batch;
+    batch.m_radius = (settings.m_radius != BadValue) ? settings.m_radius : 100;
+    batch.m_sun_width_ang = settings.m_sun_width_ang;
+    batch.Resize( num_distances * num_sun_angles );
+    for (size_t ii=0; ii<num_distances; ii++) {
+        for (size_t jj=0; jj<num_sun_angles; jj++) {
+            size_t index = ii * num_sun_angles + jj;
+            batch.m_observer_x[index] = batch.m_radius + distances[ii];
+            batch.m_observer_y[index] = 0;
+            batch.m_sun_dir[index] = sun_angles[jj];
+        }
+    }
 
-            if (td1.m_Brightness2 != BadValue) {
-                results[distance_index][sun_angle_index] = td1.m_Brightness2;
+    ParallelFor( num_distances, [&batch, &sun_angles, num_sun_angles](size_t begin, size_t end, unsigned) {
+        TheData scratch;
+        for (size_t ii=begin; ii<end; ii++) {
+            double start_normal = BadValue; // the previous cell's solution (if any)
+            for (size_t jj=0; jj<num_sun_angles; jj++) {
+                size_t index = ii * num_sun_angles + jj;
+                double start_window = (jj > 0) ? Max( fabs( sun_angles[jj] - sun_angles[jj-1] ), 0.01 ) : 1.0; // normal changes by about half the sun angle
+                batch.Solve( index, scratch, start_normal, start_window );
+                start_normal = batch.m_normal_mid[index]; // BadValue (a full search) if this one failed
             }
         }
-    }
+    });
 
+    if (! csv_filename.empty()) {
+        FILE *fout = fopen(csv_filename.c_str(), "w");
+        if (fout == NULL) {
+            fprintf(stderr, "Error: Can't open %s for writing.\n", csv_filename.c_str() );
+            return 1;
+        }
+        fprintf(fout, "distance,sun_a,observed_mid,mirror_x,mirror_y,brightness,brightness2\n");
+        for (size_t index=0; index<batch.Size(); index++) {
+            fprintf(fout, "%g,%g,", distances[index / num_sun_angles], sun_angles[index % num_sun_angles] );
+            if (batch.m_success[index])
+                fprintf(fout, "%g,%g,%g,%g,%g\n", batch.m_observed_mid[index], batch.m_mirror_x[index], batch.m_mirror_y[index],
+                        batch.m_brightness[index], batch.m_brightness2[index] );
+            else
+                fprintf(fout, ",,,,\n");
+        }
+        fclose(fout);
+        return 0;
+    }
 
     printf("Relative intensity (in ppm)\n");
     printf("%9s", " ");
-    for (int jj=0; jj<num_sun_angles; jj++) printf("%6d ", sun_angle_table[jj]);
+    for (size_t jj=0; jj<num_sun_angles; jj++) printf("%6g ", sun_angles[jj]);
     printf("\n");
 
-    for (int ii=0; ii<num_distances; ii++) {
+    for (size_t ii=0; ii<num_distances; ii++) {
         if (distances[ii] < 1) printf("%7.1f: ", distances[ii]);
         else                   printf("%7.0f: ", distances[ii]);
-        for (int jj=0; jj<num_sun_angles; jj++) {
-            if (results[ii][jj] == BadValue) printf("%6s ", " - ");
+        for (size_t jj=0; jj<num_sun_angles; jj++) {
+            size_t index = ii * num_sun_angles + jj;
+            if (! batch.m_success[index]) printf("%6s ", " - ");
             else {
                 char buffer[20];
-                sprintf(buffer,"%6d",  int(results[ii][jj] * 1e6) );
+                sprintf(buffer,"%6d",  int(batch.m_brightness2[index] * 1e6) );
                 printf("%6s ", buffer);
             }
         }
@@ -3092,3 +8127,5 @@ int brighttable()
 
     return 0;
 }
+
+} // namespace (the internals)
@@ -0,0 +1,86 @@
+// Copyright (c) Don Organ 2018, 2019
+// All rights reserved.
+
+/* smraytrc as a library (libsmraytrc.a - see the Makefile).
+ *
+ * A Context holds one case: its settings (a Config - each field as the command-line option it names) and,
+ * after Calculate(), its results. A Config is a single mirror and the default sun shape - -mirror, -mirror-row,
+ * -profile, -sun-shape and -gradient are only on the command line. Contexts are independent - there's no shared mutable
+ * state - so a program may calculate many of them concurrently, from as many threads as it likes.
+ * (A Context itself isn't locked - use each one from one thread at a time.)
+ *
+ *      smraytrc::Config config;
+ *      config.m_radius = 30; config.m_sun_dir = 290; config.m_min_normal_dir = 250; config.m_max_normal_dir = 290;
+ *      smraytrc::Context context(config);
+ *      if (context.Calculate()) printf("%g\n", context.Value("ref_width"));
+ */
+
+#ifndef SMRAYTRC_H
+#define SMRAYTRC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace smraytrc {
+
+const double BadValue = 9.999e9; // an unset Config value, or an undefined result
+
+struct Config {
+    bool m_convex;              // -convex (else -concave)
+    double m_radius;            // -r
+    double m_distance;          // -d (convex) from the observer to the mirror's center-of-curvature
+    double m_sun_dir;           // -sa. degrees
+    double m_min_normal_dir;    // -mna. degrees
+    double m_max_normal_dir;    // -mxa. degrees
+    double m_sun_width;         // -sw. degrees
+    int m_num_rays;             // -nr
+    double m_ray_tolerance;     // -nr auto <tolerance>. if >0, instead of m_num_rays
+    bool m_convex_fan;          // (m_convex) forward-trace a fan of m_num_rays - as -nr given with -convex
+    bool m_reverse;             // -reverse
+    bool m_pupil;               // -pupil
+    unsigned m_sun_samples;     // -sun-samples
+    uint64_t m_seed;            // -seed
+    unsigned m_flux_bins;       // -flux-bins (with m_screen)
+    unsigned m_farfield_bins;   // -farfield
+    double m_reflectivity;      // -reflectivity
+    double m_slope_error;       // -slope-error (if not 0, implies m_convolve - as on the command line)
+    bool m_convolve;            // -convolve
+    bool m_single_precision;    // -precision float
+    unsigned m_lut_cells;       // -lut
+    std::vector<double> m_screen;   // -screen: empty, or X1,Y1,X2,Y2
+    std::vector<double> m_stencils; // -stencil: X1,Y1,X2,Y2 per line
+    std::vector<double> m_targets;  // -target: X,Y per point
+    std::string m_quality;      // -quality: fast, default or exact
+    int m_threads;              // -threads: for this Context's calculations. 0=one per hardware thread
+    int m_debug;                // -debug
+
+    Config();
+};
+
+class Context {
+    public:
+        explicit Context(const Config& config);
+        ~Context();
+
+        const Config& GetConfig() const;
+        bool Calculate(); // returns success (false for invalid settings)
+
+        // Results - after Calculate()
+        double Value(const std::string& name) const;  // names as -csv2 (e.g. ref_width, pupil). BadValue if undefined or unrecognized
+        void RayReport(FILE *fout) const;              // as -report
+        bool SVG(FILE *fout, const std::string& title="") const; // as -svg - a complete SVG file for this case
+
+    private:
+        Context(const Context&);            // not copyable
+        Context& operator=(const Context&);
+
+        struct Impl;
+        std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace smraytrc
+
+#endif // SMRAYTRC_H